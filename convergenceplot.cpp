@@ -0,0 +1,133 @@
+/**********************************************************************
+  ConvergencePlot - Plot of the packmol objective function per loop
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "convergenceplot.h"
+
+#include <QPainter>
+#include <QPainterPath>
+
+#include <cmath>
+
+namespace Avogadro {
+
+  // values below this are plotted as converged
+  static const double minimumValue = 1.0e-10;
+
+  static double plotValue(double value)
+  {
+    return log10(qMax(value, minimumValue));
+  }
+
+  ConvergencePlot::ConvergencePlot(QWidget *parent) : QWidget(parent)
+  {
+    setMinimumHeight(80);
+    setBackgroundRole(QPalette::Base);
+    setAutoFillBackground(true);
+  }
+
+  QSize ConvergencePlot::sizeHint() const
+  {
+    return QSize(400, 120);
+  }
+
+  void ConvergencePlot::clear()
+  {
+    m_functionValues.clear();
+    m_violations.clear();
+    m_phaseStarts.clear();
+    update();
+  }
+
+  void ConvergencePlot::addPhase(int)
+  {
+    m_phaseStarts.append(m_functionValues.size());
+    update();
+  }
+
+  void ConvergencePlot::addLoop(int, double functionValue,
+      double maxDistanceViolation, double maxConstraintViolation)
+  {
+    if (functionValue < 0.0)
+      return;
+    m_functionValues.append(functionValue);
+    m_violations.append(qMax(maxDistanceViolation, maxConstraintViolation));
+    update();
+  }
+
+  void ConvergencePlot::paintEvent(QPaintEvent *)
+  {
+    QPainter painter(this);
+    QRect area = rect().adjusted(40, 6, -6, -6);
+    painter.setPen(palette().color(QPalette::Text));
+    painter.drawRect(area);
+
+    int n = m_functionValues.size();
+    if (n < 1)
+      return;
+
+    double yMin = plotValue(m_functionValues.at(0));
+    double yMax = yMin;
+    for (int i = 0; i < n; ++i) {
+      yMin = qMin(yMin, qMin(plotValue(m_functionValues.at(i)), plotValue(m_violations.at(i))));
+      yMax = qMax(yMax, qMax(plotValue(m_functionValues.at(i)), plotValue(m_violations.at(i))));
+    }
+    yMin = floor(yMin);
+    yMax = qMax(ceil(yMax), yMin + 1.0);
+
+    double dx = n > 1 ? static_cast<double>(area.width()) / (n - 1) : 0.0;
+    double dy = area.height() / (yMax - yMin);
+
+    // decades on the y axis
+    QFontMetrics metrics(font());
+    for (int e = static_cast<int>(yMin); e <= static_cast<int>(yMax); ++e) {
+      int y = area.bottom() - static_cast<int>((e - yMin) * dy);
+      painter.setPen(palette().color(QPalette::Mid));
+      painter.drawLine(area.left(), y, area.right(), y);
+      painter.setPen(palette().color(QPalette::Text));
+      painter.drawText(QRect(0, y - metrics.height() / 2, area.left() - 4, metrics.height()),
+          Qt::AlignRight | Qt::AlignVCenter, QString("1e%1").arg(e));
+    }
+
+    painter.setPen(QPen(palette().color(QPalette::Mid), 1, Qt::DashLine));
+    foreach (int start, m_phaseStarts) {
+      int x = area.left() + static_cast<int>(start * dx);
+      painter.drawLine(x, area.top(), x, area.bottom());
+    }
+
+    painter.setRenderHint(QPainter::Antialiasing);
+    QPainterPath function, violation;
+    for (int i = 0; i < n; ++i) {
+      QPointF f(area.left() + i * dx, area.bottom() - (plotValue(m_functionValues.at(i)) - yMin) * dy);
+      QPointF v(area.left() + i * dx, area.bottom() - (plotValue(m_violations.at(i)) - yMin) * dy);
+      if (i) {
+        function.lineTo(f);
+        violation.lineTo(v);
+      } else {
+        function.moveTo(f);
+        violation.moveTo(v);
+      }
+    }
+    painter.setPen(QPen(Qt::darkGreen, 2));
+    painter.drawPath(function);
+    painter.setPen(QPen(Qt::red, 1));
+    painter.drawPath(violation);
+  }
+
+} // end namespace Avogadro
+
+#include "convergenceplot.moc"
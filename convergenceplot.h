@@ -0,0 +1,57 @@
+/**********************************************************************
+  ConvergencePlot - Plot of the packmol objective function per loop
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef CONVERGENCEPLOT_H
+#define CONVERGENCEPLOT_H
+
+#include <QWidget>
+#include <QVector>
+
+namespace Avogadro {
+
+  /**
+   * Draws log10 of the objective function and of the largest violation for
+   * every GENCAN loop. Vertical lines mark the start of a new packing phase.
+   */
+  class ConvergencePlot : public QWidget
+  {
+    Q_OBJECT
+
+    public:
+      ConvergencePlot(QWidget *parent = 0);
+
+      QSize sizeHint() const;
+
+    public slots:
+      void clear();
+      void addPhase(int type);
+      void addLoop(int loop, double functionValue,
+          double maxDistanceViolation, double maxConstraintViolation);
+
+    protected:
+      void paintEvent(QPaintEvent *event);
+
+    private:
+      QVector<double> m_functionValues;
+      QVector<double> m_violations;
+      QVector<int> m_phaseStarts;
+  };
+
+} // end namespace Avogadro
+
+#endif
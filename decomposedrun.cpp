@@ -0,0 +1,162 @@
+/**********************************************************************
+  DecomposedRun - Pack parts of a large box and put them together
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "decomposedrun.h"
+#include "jobqueue.h"
+
+#include <QtConcurrentRun>
+
+namespace Avogadro {
+
+  static StitchResult stitchAndValidate(const QStringList &fileNames, const QString &fileType,
+      const QString &output, const Decomposition &decomposition, double tolerance)
+  {
+    StitchResult result;
+    result.fileName = output;
+
+    QList<std::vector<Eigen::Vector3d> > parts;
+    foreach (const QString &fileName, fileNames) {
+      parts.append(std::vector<Eigen::Vector3d>());
+      if (!readResultPositions(fileName, fileType, parts.last())) {
+        result.error = QObject::tr("Could not read %1.").arg(fileName);
+        return result;
+      }
+    }
+
+    if (!stitchResults(fileNames, fileType, output)) {
+      result.error = QObject::tr("Could not write %1.").arg(output);
+      return result;
+    }
+
+    result.report = validateSeams(parts, decomposition, tolerance);
+    result.ok = true;
+    return result;
+  }
+
+  static StitchResult replicateAndValidate(const QString &cellFile, const QString &fileType,
+      const QString &output, const Replication &replication, double tolerance)
+  {
+    StitchResult result;
+    result.fileName = output;
+
+    std::vector<Eigen::Vector3d> cell;
+    if (!readResultPositions(cellFile, fileType, cell)) {
+      result.error = QObject::tr("Could not read %1.").arg(cellFile);
+      return result;
+    }
+
+    if (!replicateResult(cellFile, fileType, replication, output, &result.error))
+      return result;
+
+    result.report = validateReplication(cell, replication, tolerance);
+    result.ok = true;
+    return result;
+  }
+
+  DecomposedRun::DecomposedRun(JobQueue *queue, QObject *parent) : QObject(parent), 
+      m_queue(queue), m_replicate(false), m_tolerance(2.0)
+  {
+    m_watcher = new QFutureWatcher<StitchResult>(this);
+    connect(m_watcher, SIGNAL(finished()), this, SLOT(stitchFinished()));
+    connect(queue, SIGNAL(jobFinished(PackmolJob*)), this, SLOT(jobFinished(PackmolJob*)));
+  }
+
+  DecomposedRun::~DecomposedRun()
+  {
+    m_watcher->waitForFinished();
+  }
+
+  void DecomposedRun::start(const QList<PackmolJob*> &jobs, const Decomposition &decomposition,
+      const QString &fileType, double tolerance, const QString &output)
+  {
+    abort();
+    foreach (PackmolJob *job, jobs)
+      m_jobs.append(job);
+    m_decomposition = decomposition;
+    m_replicate = false;
+    m_fileType = fileType;
+    m_tolerance = tolerance;
+    m_output = output;
+  }
+
+  void DecomposedRun::start(PackmolJob *job, const Replication &replication,
+      const QString &fileType, double tolerance, const QString &output)
+  {
+    abort();
+    m_jobs.append(job);
+    m_replication = replication;
+    m_replicate = true;
+    m_fileType = fileType;
+    m_tolerance = tolerance;
+    m_output = output;
+  }
+
+  void DecomposedRun::abort()
+  {
+    QList<QPointer<PackmolJob> > jobs = m_jobs;
+    m_jobs.clear();
+    foreach (PackmolJob *job, jobs)
+      m_queue->abort(job);
+  }
+
+  void DecomposedRun::jobFinished(PackmolJob *job)
+  {
+    if (!m_jobs.contains(job))
+      return;
+
+    if (job->status() != PackmolJob::Finished) {
+      // one missing slab leaves a hole, the rest is of no use
+      QString message = tr("%1: %2").arg(job->name()).arg(job->statusString());
+      abort();
+      emit failed(message);
+      return;
+    }
+
+    QStringList fileNames;
+    foreach (PackmolJob *part, m_jobs) {
+      if (!part) {
+        abort();
+        emit failed(tr("A part of the decomposed run was removed."));
+        return;
+      }
+      if (part->status() != PackmolJob::Finished)
+        return; // still waiting
+      fileNames.append(part->resultFileName());
+    }
+
+    m_jobs.clear();
+    if (m_replicate)
+      m_watcher->setFuture(QtConcurrent::run(replicateAndValidate, fileNames.first(), m_fileType,
+            m_output, m_replication, m_tolerance));
+    else
+      m_watcher->setFuture(QtConcurrent::run(stitchAndValidate, fileNames, m_fileType,
+            m_output, m_decomposition, m_tolerance));
+  }
+
+  void DecomposedRun::stitchFinished()
+  {
+    StitchResult result = m_watcher->result();
+    if (result.ok)
+      emit finished(result.fileName, result.report);
+    else
+      emit failed(result.error);
+  }
+
+} // end namespace Avogadro
+
+#include "decomposedrun.moc"
@@ -0,0 +1,93 @@
+/**********************************************************************
+  DecomposedRun - Pack parts of a large box and put them together
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef DECOMPOSEDRUN_H
+#define DECOMPOSEDRUN_H
+
+#include "packmolresult.h"
+
+#include <QObject>
+#include <QList>
+#include <QPointer>
+#include <QFutureWatcher>
+
+namespace Avogadro {
+
+  class JobQueue;
+  class PackmolJob;
+
+  struct StitchResult
+  {
+    StitchResult() : ok(false) {}
+
+    bool ok;
+    QString error;
+    QString fileName;
+    SeamReport report;
+  };
+
+  /**
+   * Waits for the jobs packing the parts of a Decomposition (or the cell of
+   * a Replication), then stitches (or repeats) their results into one file
+   * and checks the seams on a worker thread.
+   */
+  class DecomposedRun : public QObject
+  {
+    Q_OBJECT
+
+    public:
+      DecomposedRun(JobQueue *queue, QObject *parent = 0);
+      ~DecomposedRun();
+
+      /**
+       * Follow @p jobs, job i packs decomposition.parts[i]. The stitched
+       * result is written to @p output.
+       */
+      void start(const QList<PackmolJob*> &jobs, const Decomposition &decomposition,
+          const QString &fileType, double tolerance, const QString &output);
+      //! Follow @p job packing replication.cell, its copies are written to @p output
+      void start(PackmolJob *job, const Replication &replication, const QString &fileType,
+          double tolerance, const QString &output);
+      void abort();
+      bool isRunning() const { return !m_jobs.isEmpty() || m_watcher->isRunning(); }
+      //! True if the last run started replicates a cell
+      bool isReplicating() const { return m_replicate; }
+
+    signals:
+      void finished(const QString &fileName, const SeamReport &report);
+      void failed(const QString &message);
+
+    private slots:
+      void jobFinished(PackmolJob *job);
+      void stitchFinished();
+
+    private:
+      JobQueue *m_queue;
+      QList<QPointer<PackmolJob> > m_jobs;
+      Decomposition m_decomposition;
+      Replication m_replication;
+      bool m_replicate;
+      QString m_fileType;
+      double m_tolerance;
+      QString m_output;
+      QFutureWatcher<StitchResult> *m_watcher;
+  };
+
+} // end namespace Avogadro
+
+#endif
@@ -0,0 +1,74 @@
+/**********************************************************************
+  EngineRun - Run the built-in PackingEngine on a worker thread
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "enginerun.h"
+
+#include <QtConcurrentRun>
+
+namespace Avogadro {
+
+  EngineRun::EngineRun(QObject *parent) : QObject(parent)
+  {
+    m_watcher = new QFutureWatcher<bool>(this);
+    connect(m_watcher, SIGNAL(finished()), this, SLOT(packFinished()));
+  }
+
+  EngineRun::~EngineRun()
+  {
+    abort();
+    m_watcher->waitForFinished();
+  }
+
+  void EngineRun::start(const PackingProblem &problem)
+  {
+    if (isRunning())
+      return;
+    m_problem = problem;
+    m_result = PackingResult();
+    m_abort = 0;
+    m_watcher->setFuture(QtConcurrent::run(this, &EngineRun::run));
+  }
+
+  void EngineRun::abort()
+  {
+    // polled by the engine between iterations
+    m_abort = 1;
+  }
+
+  bool EngineRun::run()
+  {
+    PackingEngine engine(m_problem);
+    return engine.pack(m_result, this);
+  }
+
+  bool EngineRun::progress(int loop, int maxLoops, double functionValue,
+      double maxDistanceViolation, double maxConstraintViolation)
+  {
+    // queued to the GUI thread
+    emit loopFinished(loop, maxLoops, functionValue, maxDistanceViolation, maxConstraintViolation);
+    return m_abort == 0;
+  }
+
+  void EngineRun::packFinished()
+  {
+    emit finished(m_watcher->result(), m_abort != 0);
+  }
+
+} // end namespace Avogadro
+
+#include "enginerun.moc"
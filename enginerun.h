@@ -0,0 +1,75 @@
+/**********************************************************************
+  EngineRun - Run the built-in PackingEngine on a worker thread
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef ENGINERUN_H
+#define ENGINERUN_H
+
+#include "packingengine.h"
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QFutureWatcher>
+
+namespace Avogadro {
+
+  /**
+   * Packs a PackingProblem in-process. Progress is reported with the same
+   * numbers packmol prints after each loop.
+   */
+  class EngineRun : public QObject, public PackingMonitor
+  {
+    Q_OBJECT
+
+    public:
+      EngineRun(QObject *parent = 0);
+      ~EngineRun();
+
+      void start(const PackingProblem &problem);
+      void abort();
+      bool isRunning() const { return m_watcher->isRunning(); }
+
+      const PackingProblem& problem() const { return m_problem; }
+      //! Valid after finished() was emitted
+      const PackingResult& result() const { return m_result; }
+
+      // PackingMonitor, called on the worker thread
+      bool progress(int loop, int maxLoops, double functionValue,
+          double maxDistanceViolation, double maxConstraintViolation);
+      bool canceled() const { return m_abort != 0; }
+
+    signals:
+      void loopFinished(int loop, int maxLoops, double functionValue,
+          double maxDistanceViolation, double maxConstraintViolation);
+      //! @p aborted is true if abort() stopped the run
+      void finished(bool converged, bool aborted);
+
+    private slots:
+      void packFinished();
+
+    private:
+      bool run();
+
+      PackingProblem m_problem;
+      PackingResult m_result;
+      QAtomicInt m_abort;
+      QFutureWatcher<bool> *m_watcher;
+  };
+
+} // end namespace Avogadro
+
+#endif
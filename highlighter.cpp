@@ -18,55 +18,58 @@
 
 #include "highlighter.h"
 
-#include <QRegExp>
-
 namespace Avogadro {
 
-  Highlighter::Highlighter(QTextDocument *parent) : QSyntaxHighlighter(parent)
+  Highlighter::Highlighter(QTextDocument *parent) : QSyntaxHighlighter(parent),
+      m_maxKeywordLength(0)
   {
-    HighlightingRule rule;
-
-    keywordFormat.setForeground(Qt::darkGreen);
-    keywordFormat.setFontWeight(QFont::Bold);
-    QStringList keywordPatterns;
-
-    // Python keywords
-    keywordPatterns << "\\bstructure\\b" << "\\bend\\b" << "\\btolerance\\b"
-                    << "\\boutput\\b" << "\\bfiletype\\b" << "\\bnumber\\b"
-                    << "\\binside\\b" << "\\bcube\\b" << "\\bbox\\b"
-                    << "\\bsphere\\b" << "\\boutside\\b" << "\\batoms\\b"
-                    << "\\bcenter\\b" << "\\bfixed\\b" << "\\bellipsoid\\b"
-                    << "\\bplane\\b" << "\\bover\\b" << "\\bbelow\\b"
-                    << "\\bcylinder\\b" << "\\badd_amber_ter\\b"
-                    << "\\badd_box_sides\\b" << "\\brandominitialpoint\\b"
-                    << "\\bseed\\b" << "\\bmaxit\\b" << "\\bnloop\\b"
-                    << "\\bwriteout\\b";
+    m_keywordFormat.setForeground(Qt::darkGreen);
+    m_keywordFormat.setFontWeight(QFont::Bold);
+    m_commentFormat.setForeground(Qt::blue);
+    m_commentFormat.setFontWeight(QFont::Bold);
 
-    foreach (const QString &pattern, keywordPatterns) {
-        rule.pattern = QRegExp(pattern);
-        rule.format = keywordFormat;
-        highlightingRules.append(rule);
+    const char *keywords[] = {
+      "structure", "end", "tolerance", "output", "filetype", "number",
+      "inside", "cube", "box", "sphere", "outside", "atoms", "center",
+      "fixed", "ellipsoid", "plane", "over", "below", "cylinder",
+      "add_amber_ter", "add_box_sides", "randominitialpoint", "seed",
+      "maxit", "nloop", "writeout", "restart_to", "restart_from",
+      "resnumbers", "chain", "changechains", "precision", "movefrac",
+      "movebadrandom", "discale", "sidemax", "connect", 0
+    };
+    for (int i = 0; keywords[i]; ++i) {
+      m_keywords.insert(QString::fromLatin1(keywords[i]));
+      m_maxKeywordLength = qMax(m_maxKeywordLength, static_cast<int>(qstrlen(keywords[i])));
     }
+  }
 
-    singleLineCommentFormat.setForeground(Qt::blue);
-    singleLineCommentFormat.setFontWeight(QFont::Bold);
-    rule.pattern = QRegExp("#[^\n]*");
-    rule.format = singleLineCommentFormat;
-    highlightingRules.append(rule);
+  static inline bool isWordCharacter(QChar c)
+  {
+    return c.isLetterOrNumber() || c == QLatin1Char('_');
   }
 
   void Highlighter::highlightBlock(const QString &text)
   {
-    foreach (const HighlightingRule &rule, highlightingRules) {
-        QRegExp expression(rule.pattern);
-        int index = text.indexOf(expression);
-        while (index >= 0) {
-            int length = expression.matchedLength();
-            setFormat(index, length, rule.format);
-            index = text.indexOf(expression, index + length);
-        }
+    const QChar *data = text.constData();
+    int length = text.length();
+    int i = 0;
+    while (i < length) {
+      if (data[i] == QLatin1Char('#')) {
+        setFormat(i, length - i, m_commentFormat);
+        return;
+      }
+      if (!isWordCharacter(data[i])) {
+        ++i;
+        continue;
+      }
+      int start = i;
+      while (i < length && isWordCharacter(data[i]))
+        ++i;
+      // wraps the block's characters, no copy
+      if (i - start <= m_maxKeywordLength
+          && m_keywords.contains(QString::fromRawData(data + start, i - start)))
+        setFormat(start, i - start, m_keywordFormat);
     }
-  //  setCurrentBlockState(0);
   }
 
 } // namespace
@@ -21,13 +21,20 @@
 
 #include <QSyntaxHighlighter>
 
-#include <QHash>
+#include <QSet>
+#include <QString>
 #include <QTextCharFormat>
 
 class QTextDocument;
 
 namespace Avogadro {
 
+  /**
+   * Highlights packmol keywords and comments in a single pass over each
+   * block. QSyntaxHighlighter only calls highlightBlock() for blocks that
+   * changed, and no block state is kept so an edit never spills over into
+   * the following blocks.
+   */
   class Highlighter : public QSyntaxHighlighter
   {
       Q_OBJECT
@@ -39,15 +46,10 @@ namespace Avogadro {
       void highlightBlock(const QString &text);
 
     private:
-      struct HighlightingRule
-      {
-        QRegExp pattern;
-        QTextCharFormat format;
-      };
-      
-      QVector<HighlightingRule> highlightingRules;
-      QTextCharFormat keywordFormat;
-      QTextCharFormat singleLineCommentFormat;
+      QSet<QString> m_keywords;
+      int m_maxKeywordLength;
+      QTextCharFormat m_keywordFormat;
+      QTextCharFormat m_commentFormat;
   };
 
 } // namespace
@@ -0,0 +1,350 @@
+/**********************************************************************
+  InputDocument - Parsed packmol input
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "inputdocument.h"
+
+#include <QtAlgorithms>
+
+namespace Avogadro {
+
+  PackmolInputDocument::PackmolInputDocument(const QString &text)
+  {
+    setText(text);
+  }
+
+  void PackmolInputDocument::setText(const QString &text)
+  {
+    m_lines = text.split('\n');
+    m_parsed.resize(m_lines.size());
+    for (int i = 0; i < m_lines.size(); ++i)
+      m_parsed[i] = tokenize(m_lines.at(i));
+    buildBlocks();
+  }
+
+  void PackmolInputDocument::replaceLines(int first, int removed, const QStringList &lines)
+  {
+    first = qBound(0, first, m_lines.size());
+    removed = qBound(0, removed, m_lines.size() - first);
+
+    // overwrite the lines both have, then remove or insert the others in place
+    int common = qMin(removed, lines.size());
+    for (int i = 0; i < common; ++i) {
+      m_lines[first + i] = lines.at(i);
+      m_parsed[first + i] = tokenize(lines.at(i));
+    }
+    if (removed > common) {
+      m_parsed.remove(first + common, removed - common);
+      m_lines.erase(m_lines.begin() + first + common, m_lines.begin() + first + removed);
+    } else if (lines.size() > common) {
+      int inserted = lines.size() - common;
+      m_parsed.insert(first + common, inserted, InputLine());
+      if (inserted <= 16) {
+        for (int i = common; i < lines.size(); ++i)
+          m_lines.insert(first + i, lines.at(i));
+      } else {
+        // one insert per line would move the tail for every line of a paste
+        m_lines = m_lines.mid(0, first + common) + lines.mid(common) + m_lines.mid(first + common);
+      }
+      for (int i = common; i < lines.size(); ++i)
+        m_parsed[first + i] = tokenize(lines.at(i));
+    }
+
+    updateBlocks(first, removed, lines.size());
+  }
+
+  QString PackmolInputDocument::text() const
+  {
+    return m_lines.join("\n");
+  }
+
+  InputLine PackmolInputDocument::tokenize(const QString &line)
+  {
+    InputLine parsed;
+    const QChar *data = line.constData();
+    int length = line.length();
+    int i = 0;
+    while (i < length && data[i] != QLatin1Char('#')) {
+      if (data[i].isSpace()) {
+        ++i;
+        continue;
+      }
+      int start = i;
+      while (i < length && !data[i].isSpace() && data[i] != QLatin1Char('#'))
+        ++i;
+      parsed.tokens.append(line.mid(start, i - start));
+    }
+
+    if (parsed.tokens.isEmpty()) {
+      parsed.kind = InputLine::Blank;
+      return parsed;
+    }
+    parsed.keyword = parsed.tokens.first().toLower();
+    if (parsed.keyword == "structure")
+      parsed.kind = InputLine::Structure;
+    else if (parsed.keyword == "atoms")
+      parsed.kind = InputLine::Atoms;
+    else if (parsed.keyword == "end")
+      parsed.kind = InputLine::End;
+    else if (parsed.keyword == "inside" || parsed.keyword == "outside" || parsed.keyword == "over"
+        || parsed.keyword == "above" || parsed.keyword == "below")
+      parsed.kind = InputLine::Constraint;
+    else
+      parsed.kind = InputLine::Keyword;
+    return parsed;
+  }
+
+  void PackmolInputDocument::addError(QList<InputError> &errors, int line, const QString &message)
+  {
+    InputError error;
+    error.line = line;
+    error.message = message;
+    errors.append(error);
+  }
+
+  //! Index of the first structure starting at or after @p line
+  static int structureFrom(const QList<InputStructure> &structures, int line)
+  {
+    int low = 0, high = structures.size();
+    while (low < high) {
+      int middle = (low + high) / 2;
+      if (structures.at(middle).firstLine < line)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    return low;
+  }
+
+  static void shiftLines(QList<int> &lines, int delta)
+  {
+    for (int i = 0; i < lines.size(); ++i)
+      lines[i] += delta;
+  }
+
+  static void shiftStructure(InputStructure &structure, int delta)
+  {
+    structure.firstLine += delta;
+    if (structure.lastLine >= 0)
+      structure.lastLine += delta;
+    shiftLines(structure.keywordLines, delta);
+    shiftLines(structure.constraintLines, delta);
+    for (int i = 0; i < structure.atomsBlocks.size(); ++i) {
+      InputAtomsBlock &atoms = structure.atomsBlocks[i];
+      atoms.firstLine += delta;
+      if (atoms.lastLine >= 0)
+        atoms.lastLine += delta;
+      shiftLines(atoms.constraintLines, delta);
+    }
+  }
+
+  int PackmolInputDocument::enclosingStructure(int line) const
+  {
+    // an open structure lasts until the next one starts
+    int i = structureFrom(m_structures, line) - 1;
+    if (i < 0)
+      return -1;
+    const InputStructure &structure = m_structures.at(i);
+    return structure.lastLine < 0 || structure.lastLine >= line ? i : -1;
+  }
+
+  void PackmolInputDocument::buildBlocks()
+  {
+    m_globalLines.clear();
+    m_structures.clear();
+    m_errors.clear();
+    parseBlocks(0, m_parsed.size(), 0, m_globalLines, m_structures, m_errors);
+  }
+
+  void PackmolInputDocument::updateBlocks(int first, int removed, int added)
+  {
+    // back up to a line outside structures, the lines before it are unchanged
+    int start = first;
+    for (int s = enclosingStructure(start); s >= 0; s = enclosingStructure(start))
+      start = m_structures.at(s).firstLine;
+
+    QList<int> globalLines;
+    QList<InputStructure> structures;
+    QList<InputError> errors;
+    int delta = added - removed;
+    int stop = parseBlocks(start, first + added, delta, globalLines, structures, errors);
+    int oldStop = stop - delta; // the old blocks from here on are still right
+
+    int begin = structureFrom(m_structures, start);
+    int end = structureFrom(m_structures, oldStop);
+    if (delta)
+      for (int i = end; i < m_structures.size(); ++i)
+        shiftStructure(m_structures[i], delta);
+    // typing inside a structure replaces it, nothing moves
+    int common = qMin(end - begin, structures.size());
+    for (int i = 0; i < common; ++i)
+      m_structures[begin + i] = structures.at(i);
+    m_structures.erase(m_structures.begin() + begin + common, m_structures.begin() + end);
+    for (int i = common; i < structures.size(); ++i)
+      m_structures.insert(begin + i, structures.at(i));
+
+    QList<int>::iterator globalBegin = qLowerBound(m_globalLines.begin(), m_globalLines.end(), start);
+    QList<int>::iterator globalEnd = qLowerBound(globalBegin, m_globalLines.end(), oldStop);
+    for (QList<int>::iterator i = globalEnd; delta && i != m_globalLines.end(); ++i)
+      *i += delta;
+    int globalIndex = globalBegin - m_globalLines.begin();
+    m_globalLines.erase(globalBegin, globalEnd);
+    for (int i = 0; i < globalLines.size(); ++i)
+      m_globalLines.insert(globalIndex + i, globalLines.at(i));
+
+    // errors are few, the missing end errors come last
+    QList<InputError> merged;
+    foreach (const InputError &error, m_errors)
+      if (error.line < start)
+        merged.append(error);
+    merged += errors;
+    foreach (InputError error, m_errors)
+      if (error.line >= oldStop) {
+        error.line += delta;
+        merged.append(error);
+      }
+    m_errors = merged;
+  }
+
+  int PackmolInputDocument::parseBlocks(int first, int resume, int delta, QList<int> &globalLines,
+      QList<InputStructure> &structures, QList<InputError> &errors) const
+  {
+    InputStructure *structure = 0;
+    InputAtomsBlock *atoms = 0;
+    int i = first;
+    for (; i < m_parsed.size(); ++i) {
+      // the rest parses like before the edit
+      if (!structure && i >= resume && enclosingStructure(i - delta) < 0)
+        return i;
+
+      const InputLine &parsed = m_parsed.at(i);
+      switch (parsed.kind) {
+        case InputLine::Blank:
+          break;
+        case InputLine::Structure:
+          if (structure)
+            addError(errors, i, "structure before \"end structure\"");
+          structures.append(InputStructure());
+          structure = &structures.last();
+          atoms = 0;
+          structure->firstLine = i;
+          if (parsed.tokens.size() == 2)
+            structure->fileName = parsed.tokens.at(1);
+          else
+            addError(errors, i, "structure takes one file name");
+          break;
+        case InputLine::Atoms:
+          if (!structure) {
+            addError(errors, i, "atoms outside a structure");
+            break;
+          }
+          if (atoms)
+            addError(errors, i, "atoms before \"end atoms\"");
+          structure->atomsBlocks.append(InputAtomsBlock());
+          atoms = &structure->atomsBlocks.last();
+          atoms->firstLine = i;
+          atoms->lastLine = -1;
+          for (int j = 1; j < parsed.tokens.size(); ++j) {
+            bool ok;
+            int atom = parsed.tokens.at(j).toInt(&ok);
+            if (ok && atom > 0)
+              atoms->atoms.append(atom);
+            else
+              addError(errors, i, QString("invalid atom \"%1\"").arg(parsed.tokens.at(j)));
+          }
+          break;
+        case InputLine::End:
+          if (atoms) {
+            atoms->lastLine = i;
+            atoms = 0;
+          } else if (structure) {
+            structure->lastLine = i;
+            structure = 0;
+          } else {
+            addError(errors, i, "end without structure");
+          }
+          break;
+        case InputLine::Constraint:
+          if (atoms)
+            atoms->constraintLines.append(i);
+          else if (structure)
+            structure->constraintLines.append(i);
+          else
+            addError(errors, i, "constraint outside a structure");
+          break;
+        case InputLine::Keyword:
+          if (!structure) {
+            globalLines.append(i);
+            break;
+          }
+          structure->keywordLines.append(i);
+          if (parsed.keyword == "number") {
+            bool ok = parsed.tokens.size() == 2;
+            int number = ok ? parsed.tokens.at(1).toInt(&ok) : 0;
+            if (ok && number > 0)
+              structure->number = number;
+            else
+              addError(errors, i, "number takes one positive integer");
+          }
+          break;
+      }
+    }
+
+    if (atoms)
+      addError(errors, atoms->firstLine, "missing \"end atoms\"");
+    if (structure)
+      addError(errors, structure->firstLine, "missing \"end structure\"");
+    return i;
+  }
+
+  int PackmolInputDocument::globalLine(const QString &keyword) const
+  {
+    foreach (int i, m_globalLines)
+      if (m_parsed.at(i).keyword == keyword)
+        return i;
+    return -1;
+  }
+
+  void PackmolInputDocument::setGlobalKeyword(const QString &keyword, const QString &value)
+  {
+    int i = globalLine(keyword);
+    QStringList lines;
+    lines << keyword + " " + value;
+    if (i >= 0)
+      replaceLines(i, 1, lines);
+    else
+      replaceLines(0, 0, lines);
+  }
+
+  QStringList PackmolInputDocument::structureFiles() const
+  {
+    QStringList files;
+    foreach (const InputStructure &structure, m_structures)
+      if (!structure.fileName.isEmpty())
+        files.append(structure.fileName);
+    return files;
+  }
+
+  int PackmolInputDocument::numMolecules() const
+  {
+    int count = 0;
+    foreach (const InputStructure &structure, m_structures)
+      count += structure.number;
+    return count;
+  }
+
+} // end namespace Avogadro
@@ -0,0 +1,130 @@
+/**********************************************************************
+  InputDocument - Parsed packmol input
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef INPUTDOCUMENT_H
+#define INPUTDOCUMENT_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QVector>
+
+namespace Avogadro {
+
+  //! One line of input split in tokens, without its comment
+  struct InputLine
+  {
+    enum Kind { Blank, Structure, Atoms, End, Constraint, Keyword };
+
+    Kind kind;
+    QString keyword;           // first token in lower case, empty for blank lines
+    QStringList tokens;
+  };
+
+  //! An atoms ... end atoms block, line numbers are 0-based
+  struct InputAtomsBlock
+  {
+    int firstLine;
+    int lastLine;              // -1 if the block is not closed
+    QList<int> atoms;          // 1-based, as written
+    QList<int> constraintLines;
+  };
+
+  struct InputStructure
+  {
+    InputStructure() : firstLine(-1), lastLine(-1), number(1) {}
+
+    int firstLine;
+    int lastLine;              // the end structure line, -1 if missing
+    QString fileName;
+    int number;
+    QList<int> keywordLines;    // number, center, fixed, chain, ...
+    QList<int> constraintLines; // constraints for all atoms
+    QList<InputAtomsBlock> atomsBlocks;
+  };
+
+  struct InputError
+  {
+    int line;
+    QString message;
+  };
+
+  /**
+   * The lines of a packmol input with their tokens and the structure blocks
+   * they form. replaceLines() only tokenizes the lines that changed and only
+   * rebuilds the blocks from the edit's enclosing structure up to the first
+   * line where the parse is back in step, later blocks are shifted. text()
+   * writes the lines back as they were read or edited, comments included.
+   */
+  class PackmolInputDocument
+  {
+    public:
+      PackmolInputDocument() {}
+      explicit PackmolInputDocument(const QString &text);
+
+      void setText(const QString &text);
+      //! Replace @p removed lines starting at @p first by @p lines
+      void replaceLines(int first, int removed, const QStringList &lines);
+      QString text() const;
+
+      int numLines() const { return m_lines.size(); }
+      const QString& line(int i) const { return m_lines.at(i); }
+      const InputLine& parsedLine(int i) const { return m_parsed.at(i); }
+
+      //! Lines outside structure blocks that are not blank
+      const QList<int>& globalLines() const { return m_globalLines; }
+      //! The first line setting global @p keyword, -1 if there is none
+      int globalLine(const QString &keyword) const;
+      //! Replace the global @p keyword's line or add it in front
+      void setGlobalKeyword(const QString &keyword, const QString &value);
+
+      const QList<InputStructure>& structures() const { return m_structures; }
+      QStringList structureFiles() const;
+      int numMolecules() const;
+
+      //! Problems found while building the blocks, in line order
+      const QList<InputError>& errors() const { return m_errors; }
+
+    private:
+      static InputLine tokenize(const QString &line);
+      void buildBlocks();
+      //! Rebuild the blocks after replacing @p removed lines at @p first by @p added lines
+      void updateBlocks(int first, int removed, int added);
+      /**
+       * Parse the blocks from line @p first on, which must be outside any
+       * structure. From line @p resume on, the parse stops at the first line
+       * outside structures that also was before the edit (@p delta lines
+       * earlier in the current blocks).
+       * @return The line the parse stopped at, numLines() at the end
+       */
+      int parseBlocks(int first, int resume, int delta, QList<int> &globalLines,
+          QList<InputStructure> &structures, QList<InputError> &errors) const;
+      //! Index of the structure the parser is in before @p line, -1 if none
+      int enclosingStructure(int line) const;
+      static void addError(QList<InputError> &errors, int line, const QString &message);
+
+      QStringList m_lines;
+      QVector<InputLine> m_parsed;
+      QList<int> m_globalLines;
+      QList<InputStructure> m_structures;
+      QList<InputError> m_errors;
+  };
+
+} // end namespace Avogadro
+
+#endif
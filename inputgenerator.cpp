@@ -0,0 +1,647 @@
+/**********************************************************************
+  InputGenerator - Generate packmol input files from plain descriptions
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "inputgenerator.h"
+#include "inputdocument.h"
+#include "packmolgeometry.h"
+#include "molecularvolume.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QStringList>
+#include <QPair>
+#include <QtAlgorithms>
+
+#include <algorithm>
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace Avogadro {
+
+  double SolvationSpec::volume() const
+  {
+    switch (shape) {
+      case Box: {
+        Eigen::Vector3d d = max - min;
+        return d.x() * d.y() * d.z();
+      }
+      case Sphere:
+        return 4.0 / 3.0 * M_PI * radius * radius * radius;
+      case Ellipsoid:
+        return 4.0 / 3.0 * M_PI * semiAxes.x() * semiAxes.y() * semiAxes.z();
+      case Cylinder:
+        return M_PI * radius * radius * length;
+    }
+    return 0.0;
+  }
+
+  double SolvationSpec::solventVolume() const
+  {
+    if (soluteFileName.isEmpty())
+      return volume();
+    if (!shellRegions.isEmpty() && soluteNumber == 1) {
+      // the shell is outside the solute already, as in generateSolvationInput()
+      double shell = 0.0;
+      foreach (const ShellRegion &region, shellRegions)
+        shell += region.volume;
+      return shell;
+    }
+    return std::max(0.0, volume() - soluteNumber * soluteVolume);
+  }
+
+  void SolvationSpec::fitToSolute(const std::vector<Eigen::Vector3d> &positions, double spacing)
+  {
+    if (positions.empty())
+      return;
+
+    Eigen::Vector3d lo(positions[0]), hi(positions[0]);
+    for (std::size_t i = 0; i < positions.size(); ++i)
+      for (int j = 0; j < 3; ++j) {
+        if (positions[i][j] < lo[j]) lo[j] = positions[i][j];
+        if (positions[i][j] > hi[j]) hi[j] = positions[i][j];
+      }
+
+    switch (shape) {
+      case Box:
+        min = lo - Eigen::Vector3d::Constant(spacing);
+        max = hi + Eigen::Vector3d::Constant(spacing);
+        break;
+      case Sphere:
+        minimalEnclosingSphere(positions, center, radius);
+        radius += spacing;
+        break;
+      case Ellipsoid: {
+        // the bounding box's proportions, grown until every atom is inside
+        center = 0.5 * (lo + hi);
+        Eigen::Vector3d half = 0.5 * (hi - lo);
+        for (int j = 0; j < 3; ++j)
+          half[j] = std::max(half[j], 0.5); // flat or linear solutes
+        double scale2 = 0.0;
+        for (std::size_t i = 0; i < positions.size(); ++i) {
+          Eigen::Vector3d d = positions[i] - center;
+          double r2 = 0.0;
+          for (int j = 0; j < 3; ++j)
+            r2 += (d[j] / half[j]) * (d[j] / half[j]);
+          scale2 = std::max(scale2, r2);
+        }
+        semiAxes = std::sqrt(scale2) * half + Eigen::Vector3d::Constant(spacing);
+        break;
+      }
+      case Cylinder: {
+        // the smallest circle around the atoms seen along each axis
+        double best = -1.0;
+        std::vector<Eigen::Vector3d> projected(positions.size());
+        for (int k = 0; k < 3; ++k) {
+          for (std::size_t i = 0; i < positions.size(); ++i) {
+            projected[i] = positions[i];
+            projected[i][k] = 0.0;
+          }
+          Eigen::Vector3d c;
+          double r;
+          minimalEnclosingSphere(projected, c, r);
+          r += spacing;
+          double l = hi[k] - lo[k] + 2.0 * spacing;
+          if (best < 0.0 || r * r * l < best) {
+            best = r * r * l;
+            axis = k;
+            center = c;
+            center[k] = 0.5 * (lo[k] + hi[k]);
+            radius = r;
+            length = l;
+          }
+        }
+        break;
+      }
+    }
+  }
+
+  void SolvationSpec::fitSmallestShape(const std::vector<Eigen::Vector3d> &positions,
+      double spacing)
+  {
+    Shape shapes[] = { Box, Sphere, Ellipsoid, Cylinder };
+    SolvationSpec best;
+    for (int i = 0; i < 4; ++i) {
+      SolvationSpec fitted(*this);
+      fitted.shape = shapes[i];
+      fitted.fitToSolute(positions, spacing);
+      if (i == 0 || fitted.volume() < best.volume())
+        best = fitted;
+    }
+    *this = best;
+  }
+
+  void SolvationSpec::fitShell(const std::vector<Eigen::Vector3d> &positions,
+      const std::vector<int> &atomicNumbers, double thickness)
+  {
+    shellRegions.clear();
+    if (positions.empty() || thickness <= 0.0)
+      return;
+
+    // the shell volume next to every atom, buried atoms have none
+    std::vector<int> atoms(positions.size());
+    for (std::size_t i = 0; i < atoms.size(); ++i)
+      atoms[i] = static_cast<int>(i);
+    std::vector<double> atomVolumes;
+    double shellVolume = hydrationShellVolume(positions, atomicNumbers, thickness, atoms,
+        atomVolumes);
+    std::vector<int> surface;
+    std::vector<double> vdw(positions.size());
+    double maxRadius = 0.0;
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+      vdw[i] = vanDerWaalsRadius(i < atomicNumbers.size() ? atomicNumbers[i] : 0);
+      maxRadius = std::max(maxRadius, vdw[i]);
+      if (atomVolumes[i] > 0.0)
+        surface.push_back(static_cast<int>(i));
+    }
+
+    // Farthest point clustering of the surface atoms. A shell point belongs
+    // to the atom with the closest surface, which is less than thickness
+    // away, so the sphere of that atom's cluster holds it. Each sphere also
+    // reaches up to the cluster radius beyond the shell, where packmol puts
+    // solvent just as well, so the clusters shrink until the spheres hold
+    // little more than the shell (or there are maxClusters of them).
+    const std::size_t maxClusters = 4096;
+    double clusterRadius = thickness;
+    while (!surface.empty()) {
+      shellRegions.clear();
+      std::vector<int> centers;
+      std::vector<int> cluster(surface.size(), 0);
+      std::vector<double> distance(surface.size(), -1.0);
+      int next = 0;
+      while (centers.size() < maxClusters) {
+        centers.push_back(next);
+        double farthest = 0.0;
+        for (std::size_t i = 0; i < surface.size(); ++i) {
+          double d = (positions[surface[i]] - positions[surface[next]]).norm();
+          if (distance[i] < 0.0 || d < distance[i]) {
+            distance[i] = d;
+            cluster[i] = static_cast<int>(centers.size()) - 1;
+          }
+        }
+        for (std::size_t i = 0; i < surface.size(); ++i)
+          if (distance[i] > farthest) {
+            farthest = distance[i];
+            next = static_cast<int>(i);
+          }
+        if (farthest <= clusterRadius)
+          break;
+      }
+
+      std::vector<double> radii(centers.size(), 0.0), volumes(centers.size(), 0.0);
+      for (std::size_t i = 0; i < surface.size(); ++i) {
+        int c = cluster[i];
+        radii[c] = std::max(radii[c], distance[i] + vdw[surface[i]] + thickness);
+        volumes[c] += atomVolumes[surface[i]];
+      }
+      std::vector<Eigen::Vector3d> sphereCenters(centers.size());
+      for (std::size_t c = 0; c < centers.size(); ++c) {
+        ShellRegion region;
+        region.center = sphereCenters[c] = positions[surface[centers[c]]];
+        region.radius = radii[c];
+        region.volume = volumes[c];
+        shellRegions.append(region);
+      }
+
+      if (centers.size() >= maxClusters || clusterRadius < 0.5)
+        break;
+      if (sphereVolumeOutside(positions, atomicNumbers, sphereCenters, radii)
+          <= 1.25 * shellVolume)
+        break;
+      clusterRadius *= 0.7;
+    }
+
+    // the counter ions go anywhere around the solute
+    shape = Sphere;
+    fitToSolute(positions, maxRadius + thickness);
+  }
+
+  void SolvationSpec::scale(double factor)
+  {
+    Eigen::Vector3d mid = 0.5 * (min + max);
+    Eigen::Vector3d half = 0.5 * factor * (max - min);
+    min = mid - half;
+    max = mid + half;
+    radius *= factor;
+    semiAxes *= factor;
+    length *= factor;
+  }
+
+  double BilayerSpec::regionVolume(Structure::Type type) const
+  {
+    double area = dimensions.x() * dimensions.y();
+    double volume = 0.0;
+    Structure::Type soluteType;
+    switch (type) {
+      case Structure::Lipid:
+        volume = area * (lipidLength + 1.0);
+        soluteType = Structure::LipophilicSolute;
+        break;
+      case Structure::PolarSolvent:
+        volume = area * (0.5 * (dimensions.z() - 2.0 * lipidLength) + 3.0);
+        soluteType = Structure::PolarSolute;
+        break;
+      default:
+        return 0.0;
+    }
+    foreach (const Structure &structure, structures)
+      if (structure.type == soluteType)
+        volume -= 0.5 * structure.number * structure.volume;
+    return std::max(0.0, volume);
+  }
+
+  double calcNumberOfMolecules(double mw, double density, double volume)
+  {
+    // mass [g/mol]
+    // density [g/ml]
+    // volume [A^3]
+    // 1 ml = 1 cm^3 = 10^24A^3
+    // 1 A^3 = 10^-24cm^3
+
+    double mass = volume * density;
+    double moles = mass / mw;
+    double number = moles * 6.022 * 10e-2;
+    return number;
+  }
+
+  double calcVolumeOfMolecules(double mw, double density, double number)
+  {
+    double moles = number / (6.022 * 10e+23);
+    double mass = moles * mw;
+    double volume = mass / density;
+    return volume * 10e+24;
+  }
+
+  QString inputFileName(const QString &fileName, const QString &fileType)
+  {
+    return QFileInfo(fileName).baseName() + "." + fileType;
+  }
+
+  QList<int> parseIntList(const QString &text, bool *ok)
+  {
+    QList<int> result;
+    bool valid = true;
+    foreach (const QString &item, text.split(',', QString::SkipEmptyParts)) {
+      // a leading '-' is a sign, the next one separates the range
+      QString trimmed = item.trimmed();
+      int dash = trimmed.indexOf('-', 1);
+      bool ok1 = false, ok2 = false;
+      if (dash < 0) {
+        result.append(trimmed.toInt(&ok1));
+        ok2 = true;
+      } else {
+        int first = trimmed.left(dash).toInt(&ok1);
+        int last = trimmed.mid(dash + 1).toInt(&ok2);
+        // each value is a job, don't expand typos like 1-1000000000
+        ok2 = ok2 && last >= first && static_cast<qint64>(last) - first < 100000;
+        for (int i = first; ok1 && ok2 && i <= last; ++i)
+          result.append(i);
+      }
+      valid = valid && ok1 && ok2;
+    }
+    if (ok)
+      *ok = valid;
+    return result;
+  }
+
+  QList<double> parseDoubleList(const QString &text, bool *ok)
+  {
+    QList<double> result;
+    bool valid = true;
+    foreach (const QString &item, text.split(',', QString::SkipEmptyParts)) {
+      bool itemOk;
+      result.append(item.trimmed().toDouble(&itemOk));
+      valid = valid && itemOk;
+    }
+    if (ok)
+      *ok = valid;
+    return result;
+  }
+
+  QList<SweepPoint> expandSweep(const SweepSpec &spec)
+  {
+    // a single "unchanged" entry for the parameters that are not swept
+    QList<int> seeds = spec.seeds.isEmpty() ? QList<int>() << 0 : spec.seeds;
+    QList<double> tolerances = spec.tolerances.isEmpty() ? QList<double>() << 0.0 : spec.tolerances;
+    QList<int> numbers = spec.solventNumbers.isEmpty() ? QList<int>() << 0 : spec.solventNumbers;
+    QList<double> scales = spec.boxScales.isEmpty() ? QList<double>() << 0.0 : spec.boxScales;
+
+    QList<SweepPoint> points;
+    foreach (int seed, seeds)
+      foreach (double tolerance, tolerances)
+        foreach (int number, numbers)
+          foreach (double scale, scales) {
+            SweepPoint point;
+            point.seed = seed;
+            point.tolerance = tolerance;
+            point.solventNumber = number;
+            point.boxScale = scale;
+            QStringList name;
+            if (seed)
+              name << QString("seed %1").arg(seed);
+            if (tolerance > 0.0)
+              name << QString("tolerance %1").arg(tolerance);
+            if (number)
+              name << QString("solvent %1").arg(number);
+            if (scale > 0.0)
+              name << QString("box x%1").arg(scale);
+            point.name = name.join(", ");
+            points.append(point);
+          }
+    return points;
+  }
+
+  QString setGlobalKeyword(const QString &input, const QString &keyword, const QString &value)
+  {
+    PackmolInputDocument document(input);
+    document.setGlobalKeyword(keyword, value);
+    return document.text();
+  }
+
+  QString headerString(const PackmolHeader &header)
+  {
+    QString text;
+    text += "tolerance " + QString::number(header.tolerance, 'f', 1) + "\n";
+    text += "filetype " +  header.fileType + "\n";
+    text += "output " + header.output + "\n";
+    if (header.seed)
+      text += "seed " + QString::number(header.seed) + "\n";
+    if (header.writeout)
+      text += "writeout " + QString::number(header.writeout) + "\n";
+    if (header.addBoxSides)
+      text += "add_box_sides\n";
+    if (header.addAmberTer)
+      text += "add_amber_ter\n";
+    text += "\n";
+    return text;
+  }
+
+  static QString numbers(const Eigen::Vector3d &v)
+  {
+    return QString::number(v.x(), 'f', 1) + " " + QString::number(v.y(), 'f', 1) + " "
+        + QString::number(v.z(), 'f', 1);
+  }
+
+  QString solvationConstraintString(const SolvationSpec &spec)
+  {
+    switch (spec.shape) {
+      default:
+      case SolvationSpec::Box:
+        return "inside box " + numbers(spec.min) + " " + numbers(spec.max);
+      case SolvationSpec::Sphere:
+        return "inside sphere " + numbers(spec.center) + " " + QString::number(spec.radius, 'f', 1);
+      case SolvationSpec::Ellipsoid:
+        return "inside ellipsoid " + numbers(spec.center) + " " + numbers(spec.semiAxes) + " 1.0";
+      case SolvationSpec::Cylinder: {
+        // packmol wants the start of the axis, its direction, the radius and the length
+        Eigen::Vector3d direction(Eigen::Vector3d::Zero());
+        direction[spec.axis] = 1.0;
+        return "inside cylinder " + numbers(spec.center - 0.5 * spec.length * direction) + " "
+            + numbers(direction) + " " + QString::number(spec.radius, 'f', 1) + " "
+            + QString::number(spec.length, 'f', 1);
+      }
+    }
+  }
+
+  QString generateSolvationInput(const PackmolHeader &header, const SolvationSpec &spec)
+  {
+    QString contraint = solvationConstraintString(spec);
+    QString text;
+    text += headerString(header);
+    if (spec.soluteFileName.length() > 0) {
+      // solute
+      text += "# solute\n";
+      text += "structure " + inputFileName(spec.soluteFileName, header.fileType) + "\n";
+      text += "  number " + QString::number(spec.soluteNumber) + "\n";
+      if (spec.soluteNumber == 1)
+        text += "  fixed 0. 0. 0. 0. 0. 0.\n";
+      else
+        text += "  " + contraint + "\n";
+      text += "end structure\n";
+      text += "\n";
+
+      if (spec.addCounterIons) {
+        int soluteCharge = spec.soluteCharge * spec.soluteNumber;
+
+        // coutner ions
+        if (soluteCharge) {
+          text += "# counter ions\n";
+          if (soluteCharge < 0) {
+            // add Na ions...
+            text += "structure sodium." + header.fileType + "\n";
+            text += "  number " + QString::number(-soluteCharge) + "\n";
+            text += "  " + contraint + "\n";
+            text += "end structure\n";
+          } else {
+            // Add Cl ions...
+            text += "structure chlorine." + header.fileType + "\n";
+            text += "  number " + QString::number(soluteCharge) + "\n";
+            text += "  " + contraint + "\n";
+            text += "end structure\n";
+          }
+          text += "\n";
+        }
+      }
+    }
+
+    if (!spec.shellRegions.isEmpty() && spec.soluteNumber == 1) {
+      // packmol has no union of regions, every sphere gets its own block
+      // with its share of the molecules (largest remainders round up)
+      double total = 0.0;
+      foreach (const ShellRegion &region, spec.shellRegions)
+        total += region.volume;
+      QList<int> counts;
+      QList<QPair<double, int> > remainders;
+      int assigned = 0;
+      for (int i = 0; i < spec.shellRegions.size(); ++i) {
+        double share = total > 0.0 ? spec.solventNumber * spec.shellRegions.at(i).volume / total : 0.0;
+        counts.append(static_cast<int>(share));
+        remainders.append(qMakePair(counts.last() - share, i));
+        assigned += counts.last();
+      }
+      qSort(remainders);
+      for (int i = 0; i < spec.solventNumber - assigned && i < remainders.size(); ++i)
+        ++counts[remainders.at(i).second];
+
+      text += "# solvent shell\n";
+      for (int i = 0; i < spec.shellRegions.size(); ++i) {
+        if (!counts.at(i))
+          continue;
+        const ShellRegion &region = spec.shellRegions.at(i);
+        text += "structure " + inputFileName(spec.solventFileName, header.fileType) + "\n";
+        text += "  number " + QString::number(counts.at(i)) + "\n";
+        text += "  inside sphere " + numbers(region.center) + " "
+            + QString::number(region.radius, 'f', 1) + "\n";
+        text += "end structure\n";
+      }
+      text += "\n";
+      return text;
+    }
+
+    // solvent
+    text += "# solvent\n";
+    text += "structure " + inputFileName(spec.solventFileName, header.fileType) + "\n";
+    text += "  number " + QString::number(spec.solventNumber) + "\n";
+    text += "  " + contraint + "\n";
+    text += "end structure\n";
+    text += "\n";
+
+    return text;
+  }
+
+  QString generateBilayerInput(const PackmolHeader &header, const BilayerSpec &spec)
+  {
+    QString text;
+    text += headerString(header);
+
+    double L = spec.lipidLength;
+    double dimX = spec.dimensions.x();
+    double dimY = spec.dimensions.y();
+    double dimZ = spec.dimensions.z();
+
+    // lipid polar head with polar solvent overlap
+    double overlap = 3.0;
+    foreach (const Structure &structure, spec.structures) {
+      QString fileName = inputFileName(structure.fileName, header.fileType);
+      // zShift: make sure center of bilayer is at coordinates origin...
+      double zShift = - dimZ / 2.0;
+      double xMin = - dimX / 2.0;
+      double xMax = dimX / 2.0;
+      double yMin = - dimY / 2.0;
+      double yMax = dimY / 2.0;
+      if (structure.type == Structure::Lipid) {
+        double thickness = 0.5 * (dimZ - 2.0 * L);
+        text += "structure " + fileName + "\n";
+        text += "  number " + QString::number(structure.number) + "\n";
+        text += "  inside box " + QString::number(xMin, 'f', 1) + " "
+                                + QString::number(yMin, 'f', 1) + " "
+                                + QString::number(thickness + zShift, 'f', 1) + " "
+                                + QString::number(xMax, 'f', 1) + " "
+                                + QString::number(yMax, 'f', 1) + " "
+                                + QString::number(thickness + L + 1.0 + zShift, 'f', 1) + "\n";
+        text += "  atoms # list polar head atoms here\n";
+        text += "    below plane 0.0 0.0 1.0 " + QString::number(thickness + overlap + 2.0 + zShift, 'f', 1) + "\n";
+        text += "  end atoms\n";
+        text += "  atoms # list lipophilic tail atoms here\n";
+        text += "    over plane 0.0 0.0 1.0 " + QString::number(thickness + overlap + L - 3.0 + zShift, 'f', 1) + "\n";
+        text += "  end atoms\n";
+        text += "end structure\n";
+        text += "\n";
+        text += "structure " + fileName + "\n";
+        text += "  number " + QString::number(structure.number) + "\n";
+        text += "  inside box " + QString::number(xMin, 'f', 1) + " "
+                                + QString::number(yMin, 'f', 1) + " "
+                                + QString::number(dimZ - thickness - L - 1.0 + zShift, 'f', 1) + " "
+                                + QString::number(xMax, 'f', 1) + " "
+                                + QString::number(yMax, 'f', 1) + " "
+                                + QString::number(dimZ - thickness + zShift, 'f', 1) + "\n";
+        text += "  atoms # list polar head atoms here\n";
+        text += "    over plane 0.0 0.0 1.0 " + QString::number(dimZ -
+            thickness - overlap - 2.0 + zShift, 'f', 1) + "\n";
+        text += "  end atoms\n";
+        text += "  atoms # list lipophilic tail atoms here\n";
+        text += "    below plane 0.0 0.0 1.0 " + QString::number(dimZ -
+            thickness - overlap - L + 3.0 + zShift, 'f', 1) + "\n";
+        text += "  end atoms\n";
+        text += "end structure\n";
+        text += "\n";
+
+      } else
+      if (structure.type == Structure::PolarSolvent) {
+        double thickness = 0.5 * (dimZ - 2.0 * L) + 3.0;
+        text += "structure " + fileName + "\n";
+        text += "  number " + QString::number(structure.number) + "\n";
+        text += "  inside box " + QString::number(xMin, 'f', 1) + " "
+                                + QString::number(yMin, 'f', 1) + " "
+                                + QString::number(zShift, 'f', 1) + " "
+                                + QString::number(xMax, 'f', 1) + " "
+                                + QString::number(yMax, 'f', 1) + " "
+                                + QString::number(thickness + zShift, 'f', 1) + "\n";
+        text += "end structure\n";
+        text += "\n";
+        text += "structure " + fileName + "\n";
+        text += "  number " + QString::number(structure.number) + "\n";
+        text += "  inside box " + QString::number(xMin, 'f', 1) + " "
+                                + QString::number(yMin, 'f', 1) + " "
+                                + QString::number(dimZ - thickness + zShift, 'f', 1) + " "
+                                + QString::number(xMax, 'f', 1) + " "
+                                + QString::number(yMax, 'f', 1) + " "
+                                + QString::number(dimZ + zShift, 'f', 1) + "\n";
+        text += "end structure\n";
+        text += "\n";
+      } else {
+        // half of the solutes in each leaflet, in the polar solvent or
+        // between the lipid tails, where regionVolume() made room for them
+        double zMin[2], zMax[2];
+        if (structure.type == Structure::PolarSolute) {
+          double thickness = 0.5 * (dimZ - 2.0 * L) + 3.0;
+          zMin[0] = zShift;
+          zMax[0] = thickness + zShift;
+          zMin[1] = dimZ - thickness + zShift;
+          zMax[1] = dimZ + zShift;
+        } else {
+          double thickness = 0.5 * (dimZ - 2.0 * L);
+          zMin[0] = thickness + overlap + 2.0 + zShift;
+          zMax[0] = thickness + L + 1.0 + zShift;
+          zMin[1] = dimZ - thickness - L - 1.0 + zShift;
+          zMax[1] = dimZ - thickness - overlap - 2.0 + zShift;
+        }
+        int numbers[2] = { (structure.number + 1) / 2, structure.number / 2 };
+        for (int leaflet = 0; leaflet < 2; ++leaflet) {
+          if (!numbers[leaflet])
+            continue;
+          text += "structure " + fileName + "\n";
+          text += "  number " + QString::number(numbers[leaflet]) + "\n";
+          text += "  inside box " + QString::number(xMin, 'f', 1) + " "
+                                  + QString::number(yMin, 'f', 1) + " "
+                                  + QString::number(zMin[leaflet], 'f', 1) + " "
+                                  + QString::number(xMax, 'f', 1) + " "
+                                  + QString::number(yMax, 'f', 1) + " "
+                                  + QString::number(zMax[leaflet], 'f', 1) + "\n";
+          text += "end structure\n";
+          text += "\n";
+        }
+      }
+    }
+
+    return text;
+  }
+
+  bool writeCounterIonFile(const QString &ion, const QString &fileType, const QString &fileName)
+  {
+    QString symbol = (ion == "sodium") ? "Na" : "Cl";
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+      return false;
+    QTextStream stream(&file);
+    if (fileType == "pdb") {
+      stream << "HETATM    1 " << symbol.toUpper() << "   LIG     1       0.000   0.000   0.000  1.00  0.00          " << symbol << "  ";
+    } else {
+      // xyz
+      stream << "1\n";
+      stream << ion << ".xyz\n";
+      stream << symbol << "         0.00000        0.00000        0.00000";
+    }
+    file.close();
+    return true;
+  }
+
+} // end namespace Avogadro
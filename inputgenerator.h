@@ -0,0 +1,207 @@
+/**********************************************************************
+  InputGenerator - Generate packmol input files from plain descriptions
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef INPUTGENERATOR_H
+#define INPUTGENERATOR_H
+
+#include <Eigen/Core>
+
+#include <QString>
+#include <QList>
+
+#include <vector>
+
+// Nothing in here depends on QtGui or Avogadro, it is used by both the
+// plugin and the packmol-gen command line tool.
+
+namespace Avogadro {
+
+  /**
+   * Global keywords at the top of every input file.
+   */
+  struct PackmolHeader
+  {
+    PackmolHeader() : tolerance(2.0), fileType("pdb"), output("result.pdb"),
+        seed(0), writeout(0), addBoxSides(false), addAmberTer(false) {}
+
+    double tolerance;
+    QString fileType;
+    QString output;
+    int seed;                  // 0 for packmol's default seed
+    int writeout;              // loops between intermediate results, 0 for packmol's default
+    bool addBoxSides;
+    bool addAmberTer;
+  };
+
+  //! A sphere of the hydration shell and the shell volume that is its share (A^3)
+  struct ShellRegion
+  {
+    Eigen::Vector3d center;
+    double radius;
+    double volume;
+  };
+
+  /**
+   * A solute (optional) with counter ions in a box, sphere, ellipsoid or
+   * cylinder of solvent. Ellipsoids and cylinders are along the x, y and z
+   * axes.
+   */
+  struct SolvationSpec
+  {
+    enum Shape { Box, Sphere, Ellipsoid, Cylinder };
+
+    SolvationSpec() : shape(Box), min(Eigen::Vector3d::Zero()),
+        max(Eigen::Vector3d::Zero()), center(Eigen::Vector3d::Zero()), radius(0.0),
+        semiAxes(Eigen::Vector3d::Zero()), axis(2), length(0.0),
+        soluteNumber(1), soluteCharge(0), soluteVolume(0.0), addCounterIons(false),
+        solventNumber(0) {}
+
+    Shape shape;
+    Eigen::Vector3d min, max;  // box
+    Eigen::Vector3d center;    // sphere, ellipsoid, cylinder
+    double radius;             // sphere, cylinder
+    Eigen::Vector3d semiAxes;  // ellipsoid
+    int axis;                  // cylinder, 0, 1 or 2 for x, y or z
+    double length;             // cylinder
+
+    QString soluteFileName;    // empty for pure solvent
+    int soluteNumber;
+    int soluteCharge;          // total formal charge of one solute molecule
+    double soluteVolume;       // excluded volume of one solute molecule (A^3)
+    bool addCounterIons;
+
+    QString solventFileName;
+    int solventNumber;
+    //! Only a shell around a single, fixed solute is filled if not empty, see fitShell()
+    QList<ShellRegion> shellRegions;
+
+    //! Volume of the shape in A^3
+    double volume() const;
+    //! volume() minus the volume taken by the solutes, what the solvent fills
+    double solventVolume() const;
+    //! Fit the shape to the solute @p positions with @p spacing on all sides
+    void fitToSolute(const std::vector<Eigen::Vector3d> &positions, double spacing);
+    //! Fit every shape to the solute and keep the one with the smallest volume
+    void fitSmallestShape(const std::vector<Eigen::Vector3d> &positions, double spacing);
+    /**
+     * Cover the solvent shell of @p thickness around the solute with
+     * overlapping spheres, one per cluster of surface atoms, and make the
+     * shape the sphere around all of them. The clusters are made smaller
+     * until the spheres outside the solute are at most 25% larger than the
+     * shell. The solvent is split over the spheres by the shell volume near
+     * each cluster.
+     */
+    void fitShell(const std::vector<Eigen::Vector3d> &positions,
+        const std::vector<int> &atomicNumbers, double thickness);
+    //! Scale the shape by @p factor around its center
+    void scale(double factor);
+  };
+
+  struct Structure
+  {
+    enum Type { Lipid, PolarSolvent, PolarSolute, LipophilicSolute };
+
+    Structure() : type(Lipid), number(0), density(1.0), volume(0.0) {}
+
+    QString fileName;
+    Type type;
+    int number;
+    double density;
+    double volume;             // excluded volume of one molecule (A^3), solutes only
+  };
+
+  /**
+   * A lipid bilayer in the xy-plane with polar solvent on both sides,
+   * centered at the origin.
+   */
+  struct BilayerSpec
+  {
+    BilayerSpec() : dimensions(Eigen::Vector3d::Zero()), lipidLength(0.0) {}
+
+    Eigen::Vector3d dimensions;
+    double lipidLength;        // length of the longest lipid
+    QList<Structure> structures;
+
+    /**
+     * Volume available to structures of @p type in one leaflet, 0.0 for
+     * types not placed. Solutes take their volume from the lipid
+     * (lipophilic) or polar solvent (polar) region, half in each leaflet.
+     */
+    double regionVolume(Structure::Type type) const;
+  };
+
+  /**
+   * Parameters to vary between runs. Empty lists keep the value from the
+   * base input. Every combination becomes one run.
+   */
+  struct SweepSpec
+  {
+    QList<int> seeds;
+    QList<double> tolerances;
+    QList<int> solventNumbers; // needs a SolvationSpec
+    QList<double> boxScales;   // needs a SolvationSpec
+  };
+
+  struct SweepPoint
+  {
+    SweepPoint() : seed(0), tolerance(0.0), solventNumber(0), boxScale(0.0) {}
+
+    QString name;
+    int seed;                  // 0 = unchanged
+    double tolerance;          // 0.0 = unchanged
+    int solventNumber;         // 0 = unchanged
+    double boxScale;           // 0.0 = unchanged
+  };
+
+  //! "1-4,8,-2" -> 1 2 3 4 8 -2, @p ok is false for malformed input
+  QList<int> parseIntList(const QString &text, bool *ok = 0);
+  //! "1.5, 2.0" -> 1.5 2.0
+  QList<double> parseDoubleList(const QString &text, bool *ok = 0);
+  //! All combinations of the values in @p spec
+  QList<SweepPoint> expandSweep(const SweepSpec &spec);
+
+  /**
+   * Set a global keyword (e.g. seed or tolerance) in an existing input,
+   * replacing the line outside the structure blocks or adding one at the top.
+   */
+  QString setGlobalKeyword(const QString &input, const QString &keyword, const QString &value);
+
+  // mass [g/mol], density [g/ml], volume [A^3]
+  double calcNumberOfMolecules(double mw, double density, double volume);
+  double calcVolumeOfMolecules(double mw, double density, double number);
+
+  //! The name a structure file gets in the input, e.g. /home/x/water.mol2 -> water.pdb
+  QString inputFileName(const QString &fileName, const QString &fileType);
+
+  QString headerString(const PackmolHeader &header);
+  //! The "inside box/sphere/ellipsoid/cylinder" line for the solvation shape
+  QString solvationConstraintString(const SolvationSpec &spec);
+
+  QString generateSolvationInput(const PackmolHeader &header, const SolvationSpec &spec);
+  //! Solutes are split over the leaflets, see BilayerSpec::regionVolume()
+  QString generateBilayerInput(const PackmolHeader &header, const BilayerSpec &spec);
+
+  /**
+   * Write a single sodium or chlorine ion ("sodium" or "chlorine") to
+   * @p fileName in @p fileType format (pdb or xyz).
+   */
+  bool writeCounterIonFile(const QString &ion, const QString &fileType, const QString &fileName);
+
+} // end namespace Avogadro
+
+#endif
@@ -0,0 +1,538 @@
+/**********************************************************************
+  JobQueue - Run packmol jobs concurrently
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "jobqueue.h"
+#include "packmoloutputparser.h"
+#include "packmolprocess.h"
+
+#include <QFile>
+#include <QTimer>
+#include <QDir>
+#include <QDateTime>
+#include <QTime>
+#include <QTextStream>
+#include <QThread>
+#include <QDesktopServices>
+#include <QFileInfo>
+#include <QSettings>
+#include <QDebug>
+
+namespace Avogadro {
+
+  PackmolJob::PackmolJob(int id, const QString &name, const QString &workingDirectory,
+      const QString &output, QObject *parent) : QObject(parent), m_id(id), m_name(name),
+      m_workingDirectory(workingDirectory), m_output(output), m_status(Queued),
+      m_exitCode(0), m_wallTimeLimit(0), m_cpuTimeLimit(0), m_process(0), m_log(0)
+  {
+    m_parser = new PackmolOutputParser(this);
+  }
+
+  PackmolJob::~PackmolJob()
+  {
+    // JobQueue stops its processes first, this is the last resort
+    if (m_process) {
+      m_process->disconnect();
+      m_process->kill();
+      m_process->waitForFinished(1000);
+    }
+  }
+
+  QProcess* PackmolJob::process() const
+  {
+    return m_process;
+  }
+
+  QString PackmolJob::statusString() const
+  {
+    switch (m_status) {
+      case Queued:
+        return tr("Queued");
+      case Running:
+        return tr("Running");
+      case Finished:
+        return tr("Finished");
+      case Failed:
+        return tr("Failed");
+      case Aborted:
+        return tr("Aborted");
+    }
+    return QString();
+  }
+
+  QString PackmolJob::inputFileName() const
+  {
+    return QDir(m_workingDirectory).filePath("input.inp");
+  }
+
+  QString PackmolJob::logFileName() const
+  {
+    return QDir(m_workingDirectory).filePath("packmol.log");
+  }
+
+  QString PackmolJob::resultFileName() const
+  {
+    return QDir(m_workingDirectory).filePath(m_output);
+  }
+
+  QString PackmolJob::restartFileName() const
+  {
+    return QDir(m_workingDirectory).filePath("restart.pack");
+  }
+
+  bool PackmolJob::hasCheckpoint() const
+  {
+    return QFileInfo(restartFileName()).size() > 0;
+  }
+
+  QString PackmolJob::stateFileName() const
+  {
+    return QDir(m_workingDirectory).filePath("run.ini");
+  }
+
+  void PackmolJob::flushLog()
+  {
+    if (m_log && m_log->isOpen())
+      m_log->flush();
+  }
+
+  JobQueue::JobQueue(QObject *parent) : QObject(parent), m_nextId(1), m_gracePeriod(3000),
+      m_wallTimeLimit(0), m_cpuTimeLimit(0)
+  {
+    m_maxConcurrent = qMax(1, QThread::idealThreadCount());
+    m_limitTimer = new QTimer(this);
+    m_limitTimer->setInterval(1000);
+    connect(m_limitTimer, SIGNAL(timeout()), this, SLOT(checkLimits()));
+    // flushing every write is too slow for verbose runs, a crash loses at most a second
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setInterval(1000);
+    connect(m_flushTimer, SIGNAL(timeout()), this, SLOT(flushLogs()));
+    // not in the temporary directory, runs have to survive a crash or reboot
+    m_rootDirectory = QDir(QDesktopServices::storageLocation(QDesktopServices::DataLocation))
+        .filePath("packmol-runs");
+  }
+
+  JobQueue::~JobQueue()
+  {
+    // terminate all processes at once and share one grace period, waiting
+    // for them one by one would keep Avogadro from quitting
+    QList<PackmolProcess*> processes;
+    foreach (PackmolJob *job, m_jobs) {
+      if (!job->m_process)
+        continue;
+      job->m_process->disconnect(this);
+      job->m_process->terminate();
+      processes.append(job->m_process);
+    }
+    QTime elapsed;
+    elapsed.start();
+    foreach (PackmolProcess *process, processes)
+      process->waitForFinished(qMax(0, qMin(m_gracePeriod, 1000) - elapsed.elapsed()));
+    foreach (PackmolProcess *process, processes) {
+      if (process->state() == QProcess::NotRunning)
+        continue;
+      process->kill();
+      process->waitForFinished(1000);
+    }
+    foreach (PackmolJob *job, m_jobs)
+      if (job->m_process) {
+        job->m_status = PackmolJob::Aborted;
+        job->m_process = 0;
+        saveState(job);
+      }
+    qDeleteAll(processes);
+  }
+
+  void JobQueue::setMaxConcurrent(int maxConcurrent)
+  {
+    m_maxConcurrent = qMax(1, maxConcurrent);
+    startNext();
+  }
+
+  void JobQueue::setWallTimeLimit(int seconds)
+  {
+    m_wallTimeLimit = qMax(0, seconds);
+  }
+
+  void JobQueue::setCpuTimeLimit(int seconds)
+  {
+    m_cpuTimeLimit = qMax(0, seconds);
+  }
+
+  PackmolJob* JobQueue::createJob(const QString &name, const QString &output)
+  {
+    int id = m_nextId++;
+    QString dirName = QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss")
+        + QString("-%1").arg(id);
+    QDir root(m_rootDirectory);
+    if (!root.mkpath(dirName))
+      return 0;
+
+    PackmolJob *job = new PackmolJob(id, name, root.filePath(dirName), output, this);
+    connect(job->parser(), SIGNAL(progressChanged(int)), this, SLOT(parserProgress()));
+    return job;
+  }
+
+  bool JobQueue::enqueue(PackmolJob *job, const QString &input)
+  {
+    QFile inputFile(job->inputFileName());
+    if (!inputFile.open(QIODevice::WriteOnly | QIODevice::Text))
+      return false;
+    QTextStream stream(&inputFile);
+    stream << input.toAscii();
+    inputFile.close();
+
+    m_jobs.append(job);
+    saveState(job);
+    emit jobAdded(job);
+    startNext();
+    return true;
+  }
+
+  int JobQueue::restoreJobs()
+  {
+    QDir root(m_rootDirectory);
+    QStringList dirNames = root.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+    int restored = 0;
+    foreach (const QString &dirName, dirNames) {
+      QString directory = root.filePath(dirName);
+      bool known = false;
+      foreach (PackmolJob *job, m_jobs)
+        known = known || QDir(job->workingDirectory()) == QDir(directory);
+      QString stateFile = QDir(directory).filePath("run.ini");
+      if (known || !QFile::exists(stateFile))
+        continue;
+      QSettings state(stateFile, QSettings::IniFormat);
+      if (state.value("removed", false).toBool())
+        continue;
+
+      PackmolJob *job = new PackmolJob(m_nextId++, state.value("name").toString(), directory,
+          state.value("output").toString(), this);
+      connect(job->parser(), SIGNAL(progressChanged(int)), this, SLOT(parserProgress()));
+      job->m_exitCode = state.value("exitCode", 0).toInt();
+      job->m_status = static_cast<PackmolJob::Status>(state.value("status", 
+            PackmolJob::Aborted).toInt());
+      if (job->m_status == PackmolJob::Queued || job->m_status == PackmolJob::Running) {
+        // the session ended while it ran, packmol may still be running
+        Orphan orphan;
+        orphan.pid = state.value("pid", 0).toLongLong();
+        orphan.workingDirectory = directory;
+        orphan.executable = state.value("executable").toString();
+        if (PackmolProcess::terminateOrphan(orphan.pid, directory, orphan.executable, false)) {
+          m_orphans.append(orphan);
+          QFile log(job->logFileName());
+          if (log.open(QIODevice::WriteOnly | QIODevice::Append))
+            log.write(tr("Stopped packmol (pid %1) left running by an earlier session\n")
+                .arg(orphan.pid).toLocal8Bit());
+        }
+        job->m_status = PackmolJob::Aborted;
+        saveState(job);
+      }
+      QFile log(job->logFileName());
+      if (log.open(QIODevice::ReadOnly))
+        job->m_parser->addData(log.readAll());
+
+      m_jobs.append(job);
+      emit jobAdded(job);
+      ++restored;
+    }
+    if (!m_orphans.isEmpty())
+      QTimer::singleShot(m_gracePeriod, this, SLOT(killOrphans()));
+    return restored;
+  }
+
+  void JobQueue::killOrphans()
+  {
+    // only those that ignored SIGTERM are still there
+    foreach (const Orphan &orphan, m_orphans)
+      PackmolProcess::terminateOrphan(orphan.pid, orphan.workingDirectory, orphan.executable, true);
+    m_orphans.clear();
+  }
+
+  void JobQueue::saveState(PackmolJob *job, bool removed)
+  {
+    QSettings state(job->stateFileName(), QSettings::IniFormat);
+    state.setValue("name", job->name());
+    state.setValue("output", job->m_output);
+    state.setValue("status", static_cast<int>(job->status()));
+    state.setValue("exitCode", job->exitCode());
+    state.setValue("removed", removed);
+    // lets the next session find packmol if this one dies
+    qint64 pid = job->m_process ? job->m_process->processId() : 0;
+    if (pid) {
+      state.setValue("pid", pid);
+      state.setValue("executable", m_executable);
+    } else {
+      state.remove("pid");
+    }
+  }
+
+  PackmolJob* JobQueue::job(int id) const
+  {
+    foreach (PackmolJob *job, m_jobs)
+      if (job->id() == id)
+        return job;
+    return 0;
+  }
+
+  int JobQueue::numRunning() const
+  {
+    int running = 0;
+    foreach (PackmolJob *job, m_jobs)
+      if (job->status() == PackmolJob::Running)
+        ++running;
+    return running;
+  }
+
+  void JobQueue::startNext()
+  {
+    int running = numRunning();
+    foreach (PackmolJob *job, m_jobs) {
+      if (running >= m_maxConcurrent)
+        break;
+      if (job->status() != PackmolJob::Queued)
+        continue;
+
+      job->m_log = new QFile(job->logFileName(), job);
+      if (!job->m_log->open(QIODevice::WriteOnly)) {
+        delete job->m_log;
+        job->m_log = 0;
+      }
+
+      job->m_process = new PackmolProcess(job);
+      job->m_process->setCpuTimeLimit(m_cpuTimeLimit);
+      job->m_cpuTimeLimit = m_cpuTimeLimit;
+      job->m_wallTimeLimit = m_wallTimeLimit;
+      connect(job->m_process, SIGNAL(started()), this, SLOT(processStarted()));
+      connect(job->m_process, SIGNAL(readyReadStandardOutput()), this, SLOT(readOutput()));
+      connect(job->m_process, SIGNAL(readyReadStandardError()), this, SLOT(readError()));
+      connect(job->m_process, SIGNAL(finished(int,QProcess::ExitStatus)),
+          this, SLOT(processFinished(int,QProcess::ExitStatus)));
+      connect(job->m_process, SIGNAL(error(QProcess::ProcessError)),
+          this, SLOT(processError(QProcess::ProcessError)));
+      job->m_process->setStandardInputFile(job->inputFileName());
+      job->m_process->setWorkingDirectory(job->workingDirectory());
+      job->m_status = PackmolJob::Running;
+      job->m_started = QDateTime::currentDateTime();
+      saveState(job);
+      job->m_process->start(m_executable);
+      ++running;
+      if (job->m_wallTimeLimit && !m_limitTimer->isActive())
+        m_limitTimer->start();
+      if (!m_flushTimer->isActive())
+        m_flushTimer->start();
+      emit jobChanged(job);
+    }
+  }
+
+  void JobQueue::stopProcess(PackmolJob *job)
+  {
+    PackmolProcess *process = job->m_process;
+    if (!process)
+      return;
+    job->m_process = 0;
+    process->disconnect(this);
+    // the job may be deleted before the process has exited
+    process->setParent(this);
+    process->stop(m_gracePeriod);
+  }
+
+  void JobQueue::checkLimits()
+  {
+    QDateTime now = QDateTime::currentDateTime();
+    bool limited = false;
+    foreach (PackmolJob *job, m_jobs) {
+      if (job->status() != PackmolJob::Running || !job->m_wallTimeLimit)
+        continue;
+      if (job->m_started.secsTo(now) < job->m_wallTimeLimit) {
+        limited = true;
+        continue;
+      }
+      write(job, tr("Wall-clock limit of %1 s exceeded, stopping packmol\n")
+          .arg(job->m_wallTimeLimit).toLocal8Bit());
+      stopProcess(job);
+      finish(job, PackmolJob::Failed);
+    }
+    if (!limited)
+      m_limitTimer->stop();
+  }
+
+  void JobQueue::flushLogs()
+  {
+    bool running = false;
+    foreach (PackmolJob *job, m_jobs) {
+      if (job->status() != PackmolJob::Running)
+        continue;
+      job->flushLog();
+      running = true;
+    }
+    if (!running)
+      m_flushTimer->stop();
+  }
+
+  void JobQueue::abort(PackmolJob *job)
+  {
+    if (!job)
+      return;
+    if (job->status() == PackmolJob::Queued) {
+      finish(job, PackmolJob::Aborted);
+    } else if (job->status() == PackmolJob::Running) {
+      write(job, tr("Aborting...\n").toLocal8Bit());
+      stopProcess(job);
+      finish(job, PackmolJob::Aborted);
+    }
+  }
+
+  void JobQueue::abortAll()
+  {
+    // queued jobs first so aborting a running one doesn't start them
+    foreach (PackmolJob *job, m_jobs)
+      if (job->status() == PackmolJob::Queued)
+        abort(job);
+    foreach (PackmolJob *job, m_jobs)
+      abort(job);
+  }
+
+  //! Delete @p path with everything in it, Qt 4 has no QDir::removeRecursively()
+  static bool removeDirectory(const QString &path)
+  {
+    QDir dir(path);
+    bool ok = true;
+    QFileInfoList entries = dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot
+        | QDir::Hidden | QDir::System);
+    foreach (const QFileInfo &info, entries) {
+      if (info.isDir() && !info.isSymLink())
+        ok = removeDirectory(info.absoluteFilePath()) && ok;
+      else
+        ok = dir.remove(info.fileName()) && ok;
+    }
+    return dir.rmdir(dir.absolutePath()) && ok;
+  }
+
+  void JobQueue::removeFinished(bool deleteFiles)
+  {
+    QString root = QDir(m_rootDirectory).absolutePath() + "/";
+    foreach (PackmolJob *job, m_jobs) {
+      if (job->status() == PackmolJob::Queued || job->status() == PackmolJob::Running)
+        continue;
+      m_jobs.removeAll(job);
+      saveState(job, true);
+      // never anything outside the job's own directory under the root
+      QString directory = QDir(job->workingDirectory()).absolutePath();
+      if (deleteFiles && directory.startsWith(root) && !removeDirectory(directory))
+        qDebug() << "Could not delete" << directory;
+      emit jobRemoved(job);
+      job->deleteLater();
+    }
+  }
+
+  PackmolJob* JobQueue::jobForProcess(QObject *process) const
+  {
+    return process ? qobject_cast<PackmolJob*>(process->parent()) : 0;
+  }
+
+  void JobQueue::write(PackmolJob *job, const QByteArray &data)
+  {
+    // buffered, see flushLogs()
+    if (job->m_log)
+      job->m_log->write(data);
+    emit jobOutput(job, data);
+  }
+
+  void JobQueue::processStarted()
+  {
+    PackmolJob *job = jobForProcess(sender());
+    if (job && job->m_process)
+      saveState(job);
+  }
+
+  void JobQueue::readOutput()
+  {
+    PackmolJob *job = jobForProcess(sender());
+    if (!job || !job->m_process)
+      return;
+    QByteArray data = job->m_process->readAllStandardOutput();
+    job->m_parser->addData(data);
+    write(job, data);
+  }
+
+  void JobQueue::readError()
+  {
+    PackmolJob *job = jobForProcess(sender());
+    if (!job || !job->m_process)
+      return;
+    write(job, job->m_process->readAllStandardError());
+  }
+
+  void JobQueue::processFinished(int exitCode, QProcess::ExitStatus exitStatus)
+  {
+    PackmolJob *job = jobForProcess(sender());
+    if (!job || job->status() != PackmolJob::Running || !job->m_process)
+      return;
+
+    // drain what is left
+    QByteArray data = job->m_process->readAllStandardOutput();
+    job->m_parser->addData(data);
+    write(job, data);
+    write(job, job->m_process->readAllStandardError());
+
+    if (exitStatus == QProcess::CrashExit && job->m_cpuTimeLimit)
+      write(job, tr("packmol was killed, it may have exceeded the CPU time limit of %1 s\n")
+          .arg(job->m_cpuTimeLimit).toLocal8Bit());
+
+    job->m_exitCode = exitCode;
+    bool ok = exitStatus == QProcess::NormalExit && exitCode == 0
+        && QFile::exists(job->resultFileName());
+    finish(job, ok ? PackmolJob::Finished : PackmolJob::Failed);
+  }
+
+  void JobQueue::processError(QProcess::ProcessError error)
+  {
+    if (error != QProcess::FailedToStart)
+      return; // finished() follows for the other errors
+    PackmolJob *job = jobForProcess(sender());
+    if (!job || job->status() != PackmolJob::Running)
+      return;
+    write(job, tr("Could not start %1\n").arg(m_executable).toLocal8Bit());
+    finish(job, PackmolJob::Failed);
+  }
+
+  void JobQueue::finish(PackmolJob *job, PackmolJob::Status status)
+  {
+    job->m_status = status;
+    if (job->m_log)
+      job->m_log->close();
+    if (job->m_process) {
+      job->m_process->deleteLater();
+      job->m_process = 0;
+    }
+    saveState(job);
+    emit jobChanged(job);
+    emit jobFinished(job);
+    startNext();
+  }
+
+  void JobQueue::parserProgress()
+  {
+    PackmolJob *job = qobject_cast<PackmolJob*>(sender()->parent());
+    if (job)
+      emit jobChanged(job);
+  }
+
+} // end namespace Avogadro
+
+#include "jobqueue.moc"
@@ -0,0 +1,210 @@
+/**********************************************************************
+  JobQueue - Run packmol jobs concurrently
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <QObject>
+#include <QProcess>
+#include <QList>
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+
+class QFile;
+class QTimer;
+
+namespace Avogadro {
+
+  class PackmolOutputParser;
+  class PackmolProcess;
+
+  /**
+   * A single packmol run. Every job has its own working directory that
+   * contains input.inp, the staged structures, packmol.log, the result,
+   * the restart checkpoint and run.ini with the job's state.
+   */
+  class PackmolJob : public QObject
+  {
+    Q_OBJECT
+
+    public:
+      enum Status { Queued, Running, Finished, Failed, Aborted };
+
+      PackmolJob(int id, const QString &name, const QString &workingDirectory,
+          const QString &output, QObject *parent = 0);
+      ~PackmolJob();
+
+      int id() const { return m_id; }
+      const QString& name() const { return m_name; }
+      Status status() const { return m_status; }
+      QString statusString() const;
+      const QString& workingDirectory() const { return m_workingDirectory; }
+      QString inputFileName() const;
+      QString logFileName() const;
+      //! The file packmol writes its result to
+      QString resultFileName() const;
+      const QString& output() const { return m_output; }
+      //! Checkpoint written by packmol's restart_to keyword
+      QString restartFileName() const;
+      bool hasCheckpoint() const;
+      //! The state that survives Avogadro, see JobQueue::restoreJobs()
+      QString stateFileName() const;
+      int exitCode() const { return m_exitCode; }
+      //! Write buffered output to logFileName() before reading it
+      void flushLog();
+
+      PackmolOutputParser* parser() const { return m_parser; }
+      QProcess* process() const;
+
+    private:
+      friend class JobQueue;
+
+      int m_id;
+      QString m_name;
+      QString m_workingDirectory;
+      QString m_output;
+      Status m_status;
+      int m_exitCode;
+      QDateTime m_started;
+      int m_wallTimeLimit;       // seconds, 0 for none
+      int m_cpuTimeLimit;
+      PackmolProcess *m_process;
+      QFile *m_log;
+      PackmolOutputParser *m_parser;
+  };
+
+  /**
+   * Runs queued packmol jobs with at most maxConcurrent() processes at the
+   * same time. Output of every job is written to its log file and parsed
+   * by the job's PackmolOutputParser.
+   *
+   * Stopping a job asks packmol to terminate and kills it after
+   * gracePeriod(), without blocking. Jobs that exceed their wall-clock or
+   * CPU time limit fail. Destroying the queue stops all processes.
+   */
+  class JobQueue : public QObject
+  {
+    Q_OBJECT
+
+    public:
+      JobQueue(QObject *parent = 0);
+      ~JobQueue();
+
+      void setExecutable(const QString &executable) { m_executable = executable; }
+      const QString& executable() const { return m_executable; }
+
+      int maxConcurrent() const { return m_maxConcurrent; }
+
+      //! Milliseconds between asking a process to terminate and killing it
+      void setGracePeriod(int msec) { m_gracePeriod = msec; }
+      int gracePeriod() const { return m_gracePeriod; }
+
+      //! Limits for jobs started from now on in seconds, 0 for none
+      int wallTimeLimit() const { return m_wallTimeLimit; }
+      int cpuTimeLimit() const { return m_cpuTimeLimit; }
+
+      //! Directory under which new job directories are created (persistent by default)
+      void setRootDirectory(const QString &directory) { m_rootDirectory = directory; }
+      const QString& rootDirectory() const { return m_rootDirectory; }
+
+      /**
+       * Create a job with a new, empty working directory. The caller writes
+       * the structures there and then calls enqueue() with the input.
+       * @return The job or 0 if the directory could not be created.
+       */
+      PackmolJob* createJob(const QString &name, const QString &output);
+      //! Write @p input to the job's directory and queue it
+      bool enqueue(PackmolJob *job, const QString &input);
+
+      void abort(PackmolJob *job);
+      void abortAll();
+      /**
+       * Forget about jobs that are no longer queued or running. Their
+       * directories are deleted if @p deleteFiles, otherwise they stay
+       * and are skipped by restoreJobs().
+       */
+      void removeFinished(bool deleteFiles = false);
+      /**
+       * Add the jobs of an earlier session found in rootDirectory(). Jobs
+       * that were still queued or running then are marked Aborted, packmol
+       * processes they left running are terminated (see
+       * PackmolProcess::terminateOrphan()).
+       * @return The number of restored jobs.
+       */
+      int restoreJobs();
+
+      const QList<PackmolJob*>& jobs() const { return m_jobs; }
+      PackmolJob* job(int id) const;
+      int numRunning() const;
+
+    public slots:
+      void setMaxConcurrent(int maxConcurrent);
+      void setWallTimeLimit(int seconds);
+      void setCpuTimeLimit(int seconds);
+
+    signals:
+      void jobAdded(PackmolJob *job);
+      void jobRemoved(PackmolJob *job);
+      void jobChanged(PackmolJob *job);
+      void jobOutput(PackmolJob *job, const QByteArray &data);
+      void jobFinished(PackmolJob *job);
+
+    private slots:
+      void processStarted();
+      void readOutput();
+      void readError();
+      void processFinished(int exitCode, QProcess::ExitStatus exitStatus);
+      void processError(QProcess::ProcessError error);
+      void parserProgress();
+      void checkLimits();
+      void flushLogs();
+      void killOrphans();
+
+    private:
+      struct Orphan
+      {
+        qint64 pid;
+        QString workingDirectory;
+        QString executable;
+      };
+
+      void startNext();
+      //! Detach the process from @p job and stop it in the background
+      void stopProcess(PackmolJob *job);
+      void finish(PackmolJob *job, PackmolJob::Status status);
+      void write(PackmolJob *job, const QByteArray &data);
+      void saveState(PackmolJob *job, bool removed = false);
+      PackmolJob* jobForProcess(QObject *process) const;
+
+      QList<PackmolJob*> m_jobs;
+      QString m_executable;
+      QString m_rootDirectory;
+      int m_maxConcurrent;
+      int m_nextId;
+      int m_gracePeriod;
+      int m_wallTimeLimit;
+      int m_cpuTimeLimit;
+      QTimer *m_limitTimer;
+      QTimer *m_flushTimer;
+      QList<Orphan> m_orphans;
+  };
+
+} // end namespace Avogadro
+
+#endif
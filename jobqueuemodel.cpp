@@ -0,0 +1,117 @@
+/**********************************************************************
+  JobQueueModel - Table model showing the jobs in a JobQueue
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "jobqueuemodel.h"
+#include "jobqueue.h"
+#include "packmoloutputparser.h"
+
+namespace Avogadro {
+
+  JobQueueModel::JobQueueModel(JobQueue *queue, QObject *parent)
+    : QAbstractTableModel(parent), m_queue(queue)
+  {
+    m_jobs = queue->jobs();
+    connect(queue, SIGNAL(jobAdded(PackmolJob*)), this, SLOT(jobAdded(PackmolJob*)));
+    connect(queue, SIGNAL(jobRemoved(PackmolJob*)), this, SLOT(jobRemoved(PackmolJob*)));
+    connect(queue, SIGNAL(jobChanged(PackmolJob*)), this, SLOT(jobChanged(PackmolJob*)));
+  }
+
+  int JobQueueModel::rowCount(const QModelIndex &) const
+  {
+    return m_jobs.size();
+  }
+
+  int JobQueueModel::columnCount(const QModelIndex &) const
+  {
+    return 4;
+  }
+
+  QVariant JobQueueModel::data(const QModelIndex &index, int role) const
+  {
+    PackmolJob *job = this->job(index);
+    if (!job || role != Qt::DisplayRole)
+      return QVariant();
+
+    switch (index.column()) {
+      case 0:
+        return job->name();
+      case 1:
+        return job->statusString();
+      case 2:
+        return QString("%1%").arg(job->parser()->percentComplete());
+      case 3:
+        return job->workingDirectory();
+    }
+    return QVariant();
+  }
+
+  QVariant JobQueueModel::headerData(int column, Qt::Orientation orientation, int role) const
+  {
+    if (role != Qt::DisplayRole)
+      return QVariant();
+
+    if (orientation == Qt::Horizontal) {
+      switch (column) {
+        case 0:
+          return tr("Name");
+        case 1:
+          return tr("Status");
+        case 2:
+          return tr("Progress");
+        case 3:
+          return tr("Directory");
+      }
+    }
+
+    return QVariant();
+  }
+
+  PackmolJob* JobQueueModel::job(const QModelIndex &index) const
+  {
+    if (!index.isValid() || index.row() >= m_jobs.size())
+      return 0;
+    return m_jobs.at(index.row());
+  }
+
+  void JobQueueModel::jobAdded(PackmolJob *job)
+  {
+    beginInsertRows(QModelIndex(), m_jobs.size(), m_jobs.size());
+    m_jobs.append(job);
+    endInsertRows();
+  }
+
+  void JobQueueModel::jobRemoved(PackmolJob *job)
+  {
+    int row = m_jobs.indexOf(job);
+    if (row < 0)
+      return;
+    beginRemoveRows(QModelIndex(), row, row);
+    m_jobs.removeAt(row);
+    endRemoveRows();
+  }
+
+  void JobQueueModel::jobChanged(PackmolJob *job)
+  {
+    int row = m_jobs.indexOf(job);
+    if (row >= 0)
+      emit dataChanged(index(row, 0), index(row, columnCount() - 1));
+  }
+
+} // end namespace Avogadro
+
+#include "jobqueuemodel.moc"
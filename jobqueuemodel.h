@@ -0,0 +1,56 @@
+/**********************************************************************
+  JobQueueModel - Table model showing the jobs in a JobQueue
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef JOBQUEUEMODEL_H
+#define JOBQUEUEMODEL_H
+
+#include <QAbstractTableModel>
+
+namespace Avogadro {
+
+  class JobQueue;
+  class PackmolJob;
+
+  class JobQueueModel : public QAbstractTableModel
+  {
+    Q_OBJECT
+
+    public:
+      JobQueueModel(JobQueue *queue, QObject *parent = 0);
+
+      int rowCount(const QModelIndex &parent = QModelIndex()) const;
+      int columnCount(const QModelIndex &parent = QModelIndex()) const;
+      QVariant data(const QModelIndex &index, int role) const;
+      QVariant headerData(int section, Qt::Orientation orientation,
+          int role = Qt::DisplayRole) const;
+
+      PackmolJob* job(const QModelIndex &index) const;
+
+    private slots:
+      void jobAdded(PackmolJob *job);
+      void jobRemoved(PackmolJob *job);
+      void jobChanged(PackmolJob *job);
+
+    private:
+      JobQueue *m_queue;
+      QList<PackmolJob*> m_jobs;
+  };
+
+} // end namespace Avogadro
+
+#endif
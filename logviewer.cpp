@@ -0,0 +1,104 @@
+/**********************************************************************
+  LogViewer - Lazily loaded view of a (large) packmol log file
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "logviewer.h"
+
+#include <QPlainTextEdit>
+#include <QScrollBar>
+#include <QVBoxLayout>
+#include <QLabel>
+#include <QTextCursor>
+#include <QTimer>
+
+namespace Avogadro {
+
+  // bytes read per fetch
+  static const qint64 chunkSize = 256 * 1024;
+
+  LogViewer::LogViewer(const QString &fileName, QWidget *parent)
+    : QDialog(parent), m_file(fileName)
+  {
+    setWindowTitle(fileName);
+    setAttribute(Qt::WA_DeleteOnClose);
+    resize(700, 500);
+
+    m_text = new QPlainTextEdit(this);
+    m_text->setReadOnly(true);
+    m_text->setLineWrapMode(QPlainTextEdit::NoWrap);
+    m_text->setFont(QFont("Courier 10 Pitch"));
+    m_status = new QLabel(this);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(m_text);
+    layout->addWidget(m_status);
+
+    connect(m_text->verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(scrolled(int)));
+    // a bigger view may not scroll anymore
+    connect(m_text->verticalScrollBar(), SIGNAL(rangeChanged(int,int)), this, SLOT(fillView()));
+
+    if (!m_file.open(QIODevice::ReadOnly))
+      m_status->setText(tr("Could not open %1").arg(fileName));
+    else
+      fetchMore();
+  }
+
+  void LogViewer::fetchMore()
+  {
+    if (!m_file.isOpen())
+      return;
+
+    QByteArray data = m_file.read(chunkSize);
+    if (!data.isEmpty()) {
+      // keep lines intact, the rest is read with the next chunk
+      int end = data.lastIndexOf('\n');
+      if (end >= 0 && end + 1 < data.size() && !m_file.atEnd()) {
+        m_file.seek(m_file.pos() - (data.size() - end - 1));
+        data.truncate(end + 1);
+      }
+
+      int scroll = m_text->verticalScrollBar()->value();
+      QTextCursor cursor(m_text->document());
+      cursor.movePosition(QTextCursor::End);
+      cursor.insertText(QString::fromLocal8Bit(data));
+      m_text->verticalScrollBar()->setValue(scroll);
+    }
+
+    m_status->setText(tr("Showing %1 of %2 kB, scroll down to load more")
+        .arg(m_file.pos() / 1024).arg(m_file.size() / 1024));
+
+    // once the text is laid out, check whether it fills the view
+    if (!m_file.atEnd())
+      QTimer::singleShot(0, this, SLOT(fillView()));
+  }
+
+  void LogViewer::fillView()
+  {
+    // without a scroll bar, scrolled() is never called
+    if (m_file.isOpen() && !m_file.atEnd() && m_text->verticalScrollBar()->maximum() == 0)
+      fetchMore();
+  }
+
+  void LogViewer::scrolled(int value)
+  {
+    if (value == m_text->verticalScrollBar()->maximum())
+      fetchMore();
+  }
+
+} // end namespace Avogadro
+
+#include "logviewer.moc"
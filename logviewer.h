@@ -0,0 +1,59 @@
+/**********************************************************************
+  LogViewer - Lazily loaded view of a (large) packmol log file
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef LOGVIEWER_H
+#define LOGVIEWER_H
+
+#include <QDialog>
+#include <QFile>
+
+class QPlainTextEdit;
+class QLabel;
+
+namespace Avogadro {
+
+  /**
+   * Shows a log file one chunk at a time. The next chunk is read when the
+   * view is scrolled to the bottom, so opening a log of many megabytes is
+   * instantaneous and a log that is still being written keeps growing.
+   * Chunks are read until the view can scroll, so the rest of the log can
+   * always be reached.
+   */
+  class LogViewer : public QDialog
+  {
+    Q_OBJECT
+
+    public:
+      LogViewer(const QString &fileName, QWidget *parent = 0);
+
+    public slots:
+      void fetchMore();
+
+    private slots:
+      void scrolled(int value);
+      void fillView();
+
+    private:
+      QFile m_file;
+      QPlainTextEdit *m_text;
+      QLabel *m_status;
+  };
+
+} // end namespace Avogadro
+
+#endif
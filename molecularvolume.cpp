@@ -0,0 +1,493 @@
+/**********************************************************************
+  MolecularVolume - Excluded volume of a molecule on a voxel grid
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "molecularvolume.h"
+#include "packmolgeometry.h"
+
+#include <QThread>
+#include <QtConcurrentMap>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Avogadro {
+
+  double vanDerWaalsRadius(int atomicNumber)
+  {
+    // Bondi 1964, H from Rowland and Taylor 1996
+    static const double radii[] = {
+      2.00, 1.10, 1.40,                                     // -, H, He
+      1.82, 1.53, 1.92, 1.70, 1.55, 1.52, 1.47, 1.54,       // Li - Ne
+      2.27, 1.73, 1.84, 2.10, 1.80, 1.80, 1.75, 1.88,       // Na - Ar
+      2.75, 2.31, 2.00, 2.00, 2.00, 2.00, 2.00, 2.00, 2.00, // K - Co
+      1.63, 1.40, 1.39, 1.87, 2.11, 1.85, 1.90, 1.85, 2.02  // Ni - Kr
+    };
+    if (atomicNumber == 53)
+      return 1.98; // I
+    if (atomicNumber <= 0 || atomicNumber >= static_cast<int>(sizeof(radii) / sizeof(double)))
+      return 2.0;
+    return radii[atomicNumber];
+  }
+
+  namespace {
+
+    struct VoxelGrid
+    {
+      Eigen::Vector3d origin;  // center of voxel 0, 0, 0
+      double spacing;
+      int dims[3];
+
+      std::size_t index(int i, int j, int k) const
+      {
+        return (static_cast<std::size_t>(k) * dims[1] + j) * dims[0] + i;
+      }
+      std::size_t size() const
+      {
+        return static_cast<std::size_t>(dims[0]) * dims[1] * dims[2];
+      }
+    };
+
+    // structure of arrays, the culling loop over all spheres vectorizes
+    struct Spheres
+    {
+      std::vector<double> x, y, z, r;
+    };
+
+    /**
+     * A range of z planes of a grid. Every chunk only writes its own planes,
+     * so chunks never touch the same voxel.
+     */
+    struct SlabChunk
+    {
+      const VoxelGrid *grid;
+      int kBegin, kEnd;
+      const Spheres *spheres;
+      unsigned char *voxels;
+      const unsigned char *inside;    // grown atoms
+      const CellList *atoms;          // boundary(): centers of the grown atoms
+      const std::vector<double> *radii;
+      double cutoff;                  // largest radius plus two voxels
+      std::vector<Eigen::Vector3d> border;
+      std::size_t count;
+      const std::vector<int> *regions;        // countShell(): region of every atom
+      std::vector<std::size_t> regionCounts;
+
+      void rasterize();
+      void boundary();
+      void countExcluded();
+      void countShell();
+      void countOutside();
+    };
+
+    void SlabChunk::rasterize()
+    {
+      const VoxelGrid &g = *grid;
+      const Spheres &s = *spheres;
+      double h = g.spacing;
+      double zlo = g.origin.z() + kBegin * h;
+      double zhi = g.origin.z() + (kEnd - 1) * h;
+      int n = static_cast<int>(s.z.size());
+      std::vector<char> near(n);
+      for (int a = 0; a < n; ++a)
+        near[a] = (s.z[a] + s.r[a] >= zlo) & (s.z[a] - s.r[a] <= zhi);
+
+      for (int a = 0; a < n; ++a) {
+        if (!near[a])
+          continue;
+        double cx = s.x[a] - g.origin.x(), cy = s.y[a] - g.origin.y(), cz = s.z[a] - g.origin.z();
+        double r2 = s.r[a] * s.r[a];
+        int k0 = std::max(kBegin, static_cast<int>(std::ceil((cz - s.r[a]) / h)));
+        int k1 = std::min(kEnd - 1, static_cast<int>(std::floor((cz + s.r[a]) / h)));
+        for (int k = k0; k <= k1; ++k) {
+          double dz = k * h - cz;
+          double rz2 = r2 - dz * dz;
+          if (rz2 < 0.0)
+            continue;
+          double rz = std::sqrt(rz2);
+          int j0 = std::max(0, static_cast<int>(std::ceil((cy - rz) / h)));
+          int j1 = std::min(g.dims[1] - 1, static_cast<int>(std::floor((cy + rz) / h)));
+          for (int j = j0; j <= j1; ++j) {
+            double dy = j * h - cy;
+            double rx2 = rz2 - dy * dy;
+            if (rx2 < 0.0)
+              continue;
+            double rx = std::sqrt(rx2);
+            int i0 = std::max(0, static_cast<int>(std::ceil((cx - rx) / h)));
+            int i1 = std::min(g.dims[0] - 1, static_cast<int>(std::floor((cx + rx) / h)));
+            if (i0 <= i1)
+              std::memset(voxels + g.index(i0, j, k), 1, i1 - i0 + 1);
+          }
+        }
+      }
+    }
+
+    void SlabChunk::boundary()
+    {
+      // Empty voxels with an occupied face neighbor are just outside the
+      // grown atoms. They are moved onto the closest sphere, where a probe
+      // touches the atom, unless that spot is inside another sphere.
+      const VoxelGrid &g = *grid;
+      const std::vector<Eigen::Vector3d> &centers = atoms->points();
+      std::vector<int> neighbors;
+      std::ptrdiff_t strides[3] = { 1, g.dims[0], static_cast<std::ptrdiff_t>(g.dims[0]) * g.dims[1] };
+      for (int k = kBegin; k < kEnd; ++k)
+        for (int j = 0; j < g.dims[1]; ++j)
+          for (int i = 0; i < g.dims[0]; ++i) {
+            std::size_t v = g.index(i, j, k);
+            if (inside[v])
+              continue;
+            int ijk[3] = { i, j, k };
+            bool touches = false;
+            for (int d = 0; d < 3 && !touches; ++d)
+              touches = (ijk[d] > 0 && inside[v - strides[d]])
+                  || (ijk[d] < g.dims[d] - 1 && inside[v + strides[d]]);
+            if (!touches)
+              continue;
+
+            Eigen::Vector3d position = g.origin + g.spacing * Eigen::Vector3d(i, j, k);
+            neighbors.clear();
+            atoms->neighbors(position, cutoff, neighbors);
+            int closest = -1;
+            double gap = 0.0;
+            for (std::size_t n = 0; n < neighbors.size(); ++n) {
+              double d = (position - centers[neighbors[n]]).norm() - (*radii)[neighbors[n]];
+              if (closest < 0 || d < gap) {
+                closest = neighbors[n];
+                gap = d;
+              }
+            }
+            if (closest >= 0 && gap > 0.0) {
+              Eigen::Vector3d direction = position - centers[closest];
+              Eigen::Vector3d onSurface = centers[closest]
+                  + direction * ((*radii)[closest] / direction.norm());
+              bool buried = false;
+              for (std::size_t n = 0; n < neighbors.size() && !buried; ++n)
+                buried = neighbors[n] != closest && (onSurface - centers[neighbors[n]]).squaredNorm()
+                    < (*radii)[neighbors[n]] * (*radii)[neighbors[n]];
+              if (!buried)
+                position = onSurface;
+            }
+            border.push_back(position);
+          }
+    }
+
+    void SlabChunk::countExcluded()
+    {
+      // voxels covered by the grown atoms that no probe reached, these
+      // replace the reached ones in voxels
+      count = 0;
+      std::size_t begin = grid->index(0, 0, kBegin), end = grid->index(0, 0, kEnd);
+      for (std::size_t v = begin; v < end; ++v) {
+        voxels[v] = inside[v] && !voxels[v];
+        count += voxels[v];
+      }
+    }
+
+    void SlabChunk::countOutside()
+    {
+      // voxels set in voxels that are not excluded (inside)
+      count = 0;
+      std::size_t begin = grid->index(0, 0, kBegin), end = grid->index(0, 0, kEnd);
+      for (std::size_t v = begin; v < end; ++v)
+        count += voxels[v] && !inside[v];
+    }
+
+    void SlabChunk::countShell()
+    {
+      // voxels near the atoms (voxels) that are not excluded (inside), each
+      // counted for the atom with the closest van der Waals surface
+      const VoxelGrid &g = *grid;
+      const std::vector<Eigen::Vector3d> &centers = atoms->points();
+      std::vector<int> neighbors;
+      count = 0;
+      for (int k = kBegin; k < kEnd; ++k)
+        for (int j = 0; j < g.dims[1]; ++j)
+          for (int i = 0; i < g.dims[0]; ++i) {
+            std::size_t v = g.index(i, j, k);
+            if (!voxels[v] || inside[v])
+              continue;
+            ++count;
+            Eigen::Vector3d position = g.origin + g.spacing * Eigen::Vector3d(i, j, k);
+            neighbors.clear();
+            atoms->neighbors(position, cutoff, neighbors);
+            int closest = -1;
+            double gap = 0.0;
+            for (std::size_t n = 0; n < neighbors.size(); ++n) {
+              double d = (position - centers[neighbors[n]]).norm() - (*radii)[neighbors[n]];
+              if (closest < 0 || d < gap) {
+                closest = neighbors[n];
+                gap = d;
+              }
+            }
+            if (closest >= 0)
+              ++regionCounts[(*regions)[closest]];
+          }
+    }
+
+    Spheres makeSpheres(const std::vector<Eigen::Vector3d> &centers, const std::vector<double> &radii)
+    {
+      Spheres spheres;
+      int n = static_cast<int>(centers.size());
+      spheres.x.resize(n);
+      spheres.y.resize(n);
+      spheres.z.resize(n);
+      spheres.r.resize(n);
+      for (int i = 0; i < n; ++i) {
+        spheres.x[i] = centers[i].x();
+        spheres.y[i] = centers[i].y();
+        spheres.z[i] = centers[i].z();
+        spheres.r[i] = radii[i];
+      }
+      return spheres;
+    }
+
+  } // end anonymous namespace
+
+  namespace {
+
+    /**
+     * A grid around the atoms with room for spheres of up to @p reach around
+     * them and a layer of voxels beyond, kept below 64M voxels.
+     */
+    VoxelGrid makeGrid(const std::vector<Eigen::Vector3d> &positions, double reach, double spacing)
+    {
+      Eigen::Vector3d min = positions[0], max = positions[0];
+      for (std::size_t i = 0; i < positions.size(); ++i)
+        for (int d = 0; d < 3; ++d) {
+          min[d] = std::min(min[d], positions[i][d]);
+          max[d] = std::max(max[d], positions[i][d]);
+        }
+
+      VoxelGrid grid;
+      grid.spacing = spacing;
+      for (;;) {
+        double pad = reach + 2.0 * grid.spacing;
+        grid.origin = min - Eigen::Vector3d::Constant(pad);
+        double voxels = 1.0;
+        for (int d = 0; d < 3; ++d) {
+          grid.dims[d] = static_cast<int>(std::ceil((max[d] - min[d] + 2.0 * pad) / grid.spacing)) + 1;
+          voxels *= grid.dims[d];
+        }
+        if (voxels <= 64.0 * 1024.0 * 1024.0)
+          break;
+        grid.spacing *= 1.25;
+      }
+      return grid;
+    }
+
+    std::vector<SlabChunk> makeChunks(const VoxelGrid &grid)
+    {
+      int numChunks = std::min(grid.dims[2], 4 * std::max(1, QThread::idealThreadCount()));
+      std::vector<SlabChunk> chunks(numChunks);
+      for (int c = 0; c < numChunks; ++c) {
+        SlabChunk &chunk = chunks[c];
+        chunk.grid = &grid;
+        chunk.kBegin = static_cast<int>(static_cast<long long>(grid.dims[2]) * c / numChunks);
+        chunk.kEnd = static_cast<int>(static_cast<long long>(grid.dims[2]) * (c + 1) / numChunks);
+        chunk.spheres = 0;
+        chunk.voxels = 0;
+        chunk.inside = 0;
+        chunk.atoms = 0;
+        chunk.radii = 0;
+        chunk.cutoff = 0.0;
+        chunk.count = 0;
+        chunk.regions = 0;
+      }
+      return chunks;
+    }
+
+    /**
+     * Mark the solvent excluded voxels (van der Waals volume for @p probe
+     * 0.0) in @p excluded and return how many there are.
+     */
+    std::size_t excludedVoxels(const VoxelGrid &grid, std::vector<SlabChunk> &chunks,
+        const std::vector<Eigen::Vector3d> &positions, const std::vector<double> &vdwRadii,
+        double probe, std::vector<unsigned char> &excluded)
+    {
+      std::vector<double> radii(vdwRadii);
+      double maxRadius = 0.0;
+      for (std::size_t i = 0; i < radii.size(); ++i) {
+        radii[i] += probe;
+        maxRadius = std::max(maxRadius, radii[i]);
+      }
+
+      Spheres atoms = makeSpheres(positions, radii);
+      std::vector<unsigned char> inside(grid.size(), 0);
+      for (std::size_t c = 0; c < chunks.size(); ++c) {
+        chunks[c].spheres = &atoms;
+        chunks[c].voxels = &inside[0];
+      }
+      QtConcurrent::blockingMap(chunks, &SlabChunk::rasterize);
+
+      if (probe <= 0.0) {
+        excluded.swap(inside);
+        return static_cast<std::size_t>(std::count(excluded.begin(), excluded.end(), 1));
+      }
+
+      // roll the probe over the solvent accessible surface
+      CellList cells(positions, maxRadius + 2.0 * grid.spacing);
+      for (std::size_t c = 0; c < chunks.size(); ++c) {
+        chunks[c].inside = &inside[0];
+        chunks[c].atoms = &cells;
+        chunks[c].radii = &radii;
+        chunks[c].cutoff = maxRadius + 2.0 * grid.spacing;
+      }
+      QtConcurrent::blockingMap(chunks, &SlabChunk::boundary);
+      std::vector<Eigen::Vector3d> centers;
+      for (std::size_t c = 0; c < chunks.size(); ++c) {
+        centers.insert(centers.end(), chunks[c].border.begin(), chunks[c].border.end());
+        chunks[c].border.clear();
+      }
+      Spheres probes = makeSpheres(centers, std::vector<double>(centers.size(), probe));
+      excluded.assign(grid.size(), 0);
+      for (std::size_t c = 0; c < chunks.size(); ++c) {
+        chunks[c].spheres = &probes;
+        chunks[c].voxels = &excluded[0];
+      }
+      QtConcurrent::blockingMap(chunks, &SlabChunk::rasterize);
+      QtConcurrent::blockingMap(chunks, &SlabChunk::countExcluded);
+
+      std::size_t count = 0;
+      for (std::size_t c = 0; c < chunks.size(); ++c) {
+        count += chunks[c].count;
+        chunks[c].inside = 0;
+        chunks[c].atoms = 0;
+        chunks[c].radii = 0;
+      }
+      return count;
+    }
+
+    std::vector<double> vanDerWaalsRadii(std::size_t numAtoms, const std::vector<int> &atomicNumbers)
+    {
+      std::vector<double> radii(numAtoms);
+      for (std::size_t i = 0; i < numAtoms; ++i)
+        radii[i] = vanDerWaalsRadius(i < atomicNumbers.size() ? atomicNumbers[i] : 0);
+      return radii;
+    }
+
+  } // end anonymous namespace
+
+  double molecularVolume(const std::vector<Eigen::Vector3d> &positions,
+      const std::vector<int> &atomicNumbers, double probeRadius, double spacing)
+  {
+    if (positions.empty() || spacing <= 0.0)
+      return 0.0;
+    double probe = std::max(0.0, probeRadius);
+    std::vector<double> radii = vanDerWaalsRadii(positions.size(), atomicNumbers);
+
+    // room for the grown atoms and a layer of probe centers around them
+    VoxelGrid grid = makeGrid(positions, *std::max_element(radii.begin(), radii.end()) + probe,
+        spacing);
+    std::vector<SlabChunk> chunks = makeChunks(grid);
+    std::vector<unsigned char> excluded;
+    std::size_t count = excludedVoxels(grid, chunks, positions, radii, probe, excluded);
+    return count * grid.spacing * grid.spacing * grid.spacing;
+  }
+
+  double hydrationShellVolume(const std::vector<Eigen::Vector3d> &positions,
+      const std::vector<int> &atomicNumbers, double thickness, const std::vector<int> &regions,
+      std::vector<double> &regionVolumes, double probeRadius, double spacing)
+  {
+    int numRegions = regions.empty() ? 0 : *std::max_element(regions.begin(), regions.end()) + 1;
+    regionVolumes.assign(numRegions, 0.0);
+    if (positions.empty() || spacing <= 0.0 || thickness <= 0.0)
+      return 0.0;
+    double probe = std::max(0.0, probeRadius);
+    std::vector<double> radii = vanDerWaalsRadii(positions.size(), atomicNumbers);
+    double maxRadius = *std::max_element(radii.begin(), radii.end());
+
+    VoxelGrid grid = makeGrid(positions, maxRadius + std::max(probe, thickness), spacing);
+    std::vector<SlabChunk> chunks = makeChunks(grid);
+    std::vector<unsigned char> excluded;
+    excludedVoxels(grid, chunks, positions, radii, probe, excluded);
+
+    // everything within thickness of the van der Waals surface
+    std::vector<double> shellRadii(radii);
+    for (std::size_t i = 0; i < shellRadii.size(); ++i)
+      shellRadii[i] += thickness;
+    Spheres shell = makeSpheres(positions, shellRadii);
+    std::vector<unsigned char> near(grid.size(), 0);
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+      chunks[c].spheres = &shell;
+      chunks[c].voxels = &near[0];
+    }
+    QtConcurrent::blockingMap(chunks, &SlabChunk::rasterize);
+
+    std::vector<int> atomRegions(regions);
+    atomRegions.resize(positions.size(), 0);
+    regionVolumes.resize(std::max(numRegions, 1), 0.0);
+    CellList cells(positions, maxRadius + thickness + grid.spacing);
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+      chunks[c].inside = &excluded[0];
+      chunks[c].atoms = &cells;
+      chunks[c].radii = &radii;
+      chunks[c].cutoff = maxRadius + thickness + grid.spacing;
+      chunks[c].regions = &atomRegions;
+      chunks[c].regionCounts.assign(regionVolumes.size(), 0);
+    }
+    QtConcurrent::blockingMap(chunks, &SlabChunk::countShell);
+
+    double voxelVolume = grid.spacing * grid.spacing * grid.spacing;
+    std::size_t count = 0;
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+      count += chunks[c].count;
+      for (std::size_t r = 0; r < regionVolumes.size(); ++r)
+        regionVolumes[r] += chunks[c].regionCounts[r] * voxelVolume;
+    }
+    regionVolumes.resize(numRegions);
+    return count * voxelVolume;
+  }
+
+  double sphereVolumeOutside(const std::vector<Eigen::Vector3d> &positions,
+      const std::vector<int> &atomicNumbers, const std::vector<Eigen::Vector3d> &centers,
+      const std::vector<double> &radii, double probeRadius, double spacing)
+  {
+    if (positions.empty() || centers.empty() || spacing <= 0.0)
+      return 0.0;
+    double probe = std::max(0.0, probeRadius);
+    std::vector<double> vdwRadii = vanDerWaalsRadii(positions.size(), atomicNumbers);
+
+    // room for the spheres and the grown atoms
+    std::vector<Eigen::Vector3d> points(positions);
+    points.insert(points.end(), centers.begin(), centers.end());
+    double reach = *std::max_element(vdwRadii.begin(), vdwRadii.end()) + probe;
+    reach = std::max(reach, *std::max_element(radii.begin(), radii.end()));
+    VoxelGrid grid = makeGrid(points, reach, spacing);
+    std::vector<SlabChunk> chunks = makeChunks(grid);
+    std::vector<unsigned char> excluded;
+    excludedVoxels(grid, chunks, positions, vdwRadii, probe, excluded);
+
+    Spheres spheres = makeSpheres(centers, radii);
+    std::vector<unsigned char> covered(grid.size(), 0);
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+      chunks[c].spheres = &spheres;
+      chunks[c].voxels = &covered[0];
+    }
+    QtConcurrent::blockingMap(chunks, &SlabChunk::rasterize);
+    for (std::size_t c = 0; c < chunks.size(); ++c)
+      chunks[c].inside = &excluded[0];
+    QtConcurrent::blockingMap(chunks, &SlabChunk::countOutside);
+
+    std::size_t count = 0;
+    for (std::size_t c = 0; c < chunks.size(); ++c)
+      count += chunks[c].count;
+    return count * grid.spacing * grid.spacing * grid.spacing;
+  }
+
+} // end namespace Avogadro
@@ -0,0 +1,70 @@
+/**********************************************************************
+  MolecularVolume - Excluded volume of a molecule on a voxel grid
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef MOLECULARVOLUME_H
+#define MOLECULARVOLUME_H
+
+#include <Eigen/Core>
+
+#include <vector>
+
+namespace Avogadro {
+
+  //! Bondi van der Waals radius (A), 2.0 for elements without one
+  double vanDerWaalsRadius(int atomicNumber);
+
+  /**
+   * Volume (A^3) a molecule takes away from the solvent.
+   *
+   * The atoms are rasterized into a voxel grid of @p spacing, scanline by
+   * scanline, in parallel z slabs. With @p probeRadius 0.0 this is the van
+   * der Waals volume. Otherwise it is the solvent excluded volume: the
+   * atoms grow by the probe radius, and everything a probe touching the
+   * grown atoms can reach is removed again. Grooves and clefts too narrow
+   * for the probe then count as excluded.
+   *
+   * The spacing grows for very large molecules so the grid stays below
+   * 64M voxels.
+   */
+  double molecularVolume(const std::vector<Eigen::Vector3d> &positions,
+      const std::vector<int> &atomicNumbers, double probeRadius = 1.4, double spacing = 0.5);
+
+  /**
+   * Volume (A^3) of the shell within @p thickness of the van der Waals
+   * surface that lies outside the solvent excluded volume, where a
+   * hydration layer goes. Every shell voxel belongs to the atom with the
+   * closest surface; @p regionVolumes receives the shell volume of the
+   * atoms in each region (@p regions holds one index per atom, may be
+   * empty).
+   */
+  double hydrationShellVolume(const std::vector<Eigen::Vector3d> &positions,
+      const std::vector<int> &atomicNumbers, double thickness, const std::vector<int> &regions,
+      std::vector<double> &regionVolumes, double probeRadius = 1.4, double spacing = 0.5);
+
+  /**
+   * Volume (A^3) of the union of the spheres @p centers with @p radii that
+   * lies outside the solvent excluded volume of the molecule, the room a
+   * solvent packed into these spheres really gets.
+   */
+  double sphereVolumeOutside(const std::vector<Eigen::Vector3d> &positions,
+      const std::vector<int> &atomicNumbers, const std::vector<Eigen::Vector3d> &centers,
+      const std::vector<double> &radii, double probeRadius = 1.4, double spacing = 0.5);
+
+} // end namespace Avogadro
+
+#endif
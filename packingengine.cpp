@@ -0,0 +1,847 @@
+/**********************************************************************
+  PackingEngine - In-process alternative to the packmol executable
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "packingengine.h"
+#include "packmolgeometry.h"
+#include "inputdocument.h"
+
+#include <QStringList>
+#include <QThread>
+#include <QtConcurrentMap>
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <deque>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace Avogadro {
+
+  int PackingProblem::numAtoms() const
+  {
+    int count = 0;
+    foreach (const PackingStructure &structure, structures)
+      count += structure.number * static_cast<int>(structure.coordinates.size());
+    return count;
+  }
+
+  static bool parseNumbers(const QStringList &tokens, int first, int count, double *values)
+  {
+    if (tokens.size() < first + count)
+      return false;
+    for (int i = 0; i < count; ++i) {
+      bool ok;
+      // packmol accepts Fortran style "1.d0"
+      values[i] = QString(tokens.at(first + i)).replace('d', 'e').replace('D', 'e').toDouble(&ok);
+      if (!ok)
+        return false;
+    }
+    return true;
+  }
+
+  bool parsePackingInput(const QString &text, PackingProblem &problem, QString *error)
+  {
+    return parsePackingInput(PackmolInputDocument(text), problem, error);
+  }
+
+  bool parsePackingInput(const PackmolInputDocument &document, PackingProblem &problem,
+      QString *error)
+  {
+    if (!document.errors().isEmpty()) {
+      if (error) {
+        const InputError &first = document.errors().first();
+        *error = QString("line %1: %2").arg(first.line + 1).arg(first.message);
+      }
+      return false;
+    }
+
+    foreach (int n, document.globalLines()) {
+      const QStringList &tokens = document.parsedLine(n).tokens;
+      const QString &keyword = document.parsedLine(n).keyword;
+      double value;
+      if (keyword == "tolerance" && parseNumbers(tokens, 1, 1, &value)) {
+        problem.tolerance = value;
+      } else if (keyword == "seed" && parseNumbers(tokens, 1, 1, &value)) {
+        problem.seed = static_cast<int>(value);
+      } else if (keyword == "nloop" && parseNumbers(tokens, 1, 1, &value)) {
+        problem.maxLoops = static_cast<int>(value);
+      } else if (keyword == "filetype" && tokens.size() == 2) {
+        problem.fileType = tokens.at(1);
+      } else if (keyword == "output" && tokens.size() == 2) {
+        problem.output = tokens.at(1);
+      } else if (keyword == "pbc") {
+        if (error)
+          *error = QString("line %1: %2").arg(n + 1).arg(document.line(n).trimmed());
+        return false;
+      }
+      // the remaining global keywords tune packmol's optimizer
+    }
+
+    foreach (const InputStructure &block, document.structures()) {
+      problem.structures.append(PackingStructure());
+      PackingStructure *structure = &problem.structures.last();
+      structure->fileName = block.fileName;
+      structure->number = block.number;
+
+      // constraints in input order, the atoms blocks are interleaved
+      std::vector<int> atoms;
+      bool inAtoms = false;
+      for (int n = block.firstLine + 1; n < block.lastLine; ++n) {
+        const InputLine &line = document.parsedLine(n);
+        const QStringList &tokens = line.tokens;
+        const QString &keyword = line.keyword;
+        QString fail = QString("line %1: %2").arg(n + 1).arg(document.line(n).trimmed());
+
+        PackingConstraint constraint;
+        bool isConstraint = false;
+        if (line.kind == InputLine::Blank || keyword == "number") {
+          continue;
+        } else if (line.kind == InputLine::End) {
+          inAtoms = false;
+        } else if (keyword == "center") {
+          structure->center = true;
+        } else if (keyword == "fixed" && parseNumbers(tokens, 1, 6, structure->fixedPosition)) {
+          structure->fixed = true;
+        } else if (line.kind == InputLine::Atoms) {
+          atoms.clear();
+          for (int i = 1; i < tokens.size(); ++i)
+            atoms.push_back(tokens.at(i).toInt() - 1);
+          inAtoms = true;
+        } else if ((keyword == "inside" || keyword == "outside") && tokens.size() > 1) {
+          QString shape = tokens.at(1).toLower();
+          bool inside = keyword == "inside";
+          if (shape == "box" && parseNumbers(tokens, 2, 6, constraint.params)) {
+            constraint.type = inside ? PackingConstraint::InsideBox : PackingConstraint::OutsideBox;
+            isConstraint = true;
+          } else if (shape == "cube" && parseNumbers(tokens, 2, 4, constraint.params)) {
+            constraint.type = inside ? PackingConstraint::InsideBox : PackingConstraint::OutsideBox;
+            double side = constraint.params[3];
+            for (int i = 0; i < 3; ++i)
+              constraint.params[i + 3] = constraint.params[i] + side;
+            isConstraint = true;
+          } else if (shape == "sphere" && parseNumbers(tokens, 2, 4, constraint.params)) {
+            constraint.type = inside ? PackingConstraint::InsideSphere : PackingConstraint::OutsideSphere;
+            isConstraint = true;
+          } else if (shape == "ellipsoid" && parseNumbers(tokens, 2, 7, constraint.params)
+              && constraint.params[3] > 0.0 && constraint.params[4] > 0.0
+              && constraint.params[5] > 0.0) {
+            constraint.type = inside ? PackingConstraint::InsideEllipsoid
+                                     : PackingConstraint::OutsideEllipsoid;
+            isConstraint = true;
+          } else if (shape == "cylinder" && parseNumbers(tokens, 2, 8, constraint.params)
+              && Eigen::Vector3d(constraint.params[3], constraint.params[4],
+                constraint.params[5]).norm() > 0.0) {
+            constraint.type = inside ? PackingConstraint::InsideCylinder
+                                     : PackingConstraint::OutsideCylinder;
+            // packmol normalizes the direction
+            Eigen::Vector3d direction = Eigen::Vector3d(constraint.params[3],
+                constraint.params[4], constraint.params[5]).normalized();
+            for (int i = 0; i < 3; ++i)
+              constraint.params[i + 3] = direction[i];
+            isConstraint = true;
+          } else {
+            if (error)
+              *error = fail;
+            return false;
+          }
+        } else if ((keyword == "over" || keyword == "above" || keyword == "below")
+            && tokens.size() > 1 && tokens.at(1).toLower() == "plane"
+            && parseNumbers(tokens, 2, 4, constraint.params)) {
+          constraint.type = keyword == "below" ? PackingConstraint::BelowPlane
+                                               : PackingConstraint::OverPlane;
+          isConstraint = true;
+        } else if (keyword != "resnumbers" && keyword != "chain" && keyword != "segid"
+            && keyword != "changechains" && keyword != "radius") {
+          if (error)
+            *error = fail;
+          return false;
+        }
+
+        if (isConstraint) {
+          if (inAtoms)
+            constraint.atoms = atoms;
+          structure->constraints.append(constraint);
+        }
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Rotation Rz(g) Ry(b) Rx(a) and its derivatives with respect to the angles.
+   */
+  static void eulerRotation(double a, double b, double g, Eigen::Matrix3d &R,
+      Eigen::Matrix3d *dRa = 0, Eigen::Matrix3d *dRb = 0, Eigen::Matrix3d *dRg = 0)
+  {
+    double ca = std::cos(a), sa = std::sin(a);
+    double cb = std::cos(b), sb = std::sin(b);
+    double cg = std::cos(g), sg = std::sin(g);
+    Eigen::Matrix3d Rx, Ry, Rz;
+    Rx << 1, 0, 0,  0, ca, -sa,  0, sa, ca;
+    Ry << cb, 0, sb,  0, 1, 0,  -sb, 0, cb;
+    Rz << cg, -sg, 0,  sg, cg, 0,  0, 0, 1;
+    R = Rz * Ry * Rx;
+    if (dRa) {
+      Eigen::Matrix3d dRx, dRy, dRz;
+      dRx << 0, 0, 0,  0, -sa, -ca,  0, ca, -sa;
+      dRy << -sb, 0, cb,  0, 0, 0,  -cb, 0, -sb;
+      dRz << -sg, -cg, 0,  cg, -sg, 0,  0, 0, 0;
+      *dRa = Rz * Ry * dRx;
+      *dRb = Rz * dRy * Rx;
+      *dRg = dRz * Ry * Rx;
+    }
+  }
+
+  std::vector<Eigen::Vector3d> fixedPositions(const PackingStructure &structure)
+  {
+    std::vector<Eigen::Vector3d> positions(structure.coordinates);
+    Eigen::Vector3d center(Eigen::Vector3d::Zero());
+    if (structure.center && !positions.empty()) {
+      for (std::size_t i = 0; i < positions.size(); ++i)
+        center += positions[i];
+      center /= static_cast<double>(positions.size());
+    }
+    const double *q = structure.fixedPosition;
+    Eigen::Matrix3d R;
+    eulerRotation(q[3], q[4], q[5], R);
+    Eigen::Vector3d t(q[0], q[1], q[2]);
+    for (std::size_t i = 0; i < positions.size(); ++i)
+      positions[i] = t + R * (positions[i] - center);
+    return positions;
+  }
+
+  /**
+   * Penalty of one atom for one constraint (squared distance outside the
+   * region), its gradient is added to @p gradient.
+   */
+  static double constraintPenalty(const PackingConstraint &c, const Eigen::Vector3d &p,
+      Eigen::Vector3d &gradient, double &violation)
+  {
+    const double *q = c.params;
+    double f = 0.0;
+    switch (c.type) {
+      case PackingConstraint::InsideBox:
+        for (int j = 0; j < 3; ++j) {
+          double e = 0.0;
+          if (p[j] < q[j]) {
+            e = q[j] - p[j];
+            gradient[j] -= 2.0 * e;
+          } else if (p[j] > q[j + 3]) {
+            e = p[j] - q[j + 3];
+            gradient[j] += 2.0 * e;
+          }
+          f += e * e;
+          violation = std::max(violation, e);
+        }
+        break;
+      case PackingConstraint::OutsideBox: {
+        // inside: push towards the nearest face
+        double best = -1.0;
+        int bestDim = 0;
+        double bestSign = 0.0;
+        for (int j = 0; j < 3; ++j) {
+          if (p[j] <= q[j] || p[j] >= q[j + 3])
+            return 0.0;
+          double toMin = p[j] - q[j], toMax = q[j + 3] - p[j];
+          if (best < 0.0 || toMin < best) {
+            best = toMin;
+            bestDim = j;
+            bestSign = 1.0;
+          }
+          if (toMax < best) {
+            best = toMax;
+            bestDim = j;
+            bestSign = -1.0;
+          }
+        }
+        f = best * best;
+        gradient[bestDim] += 2.0 * best * bestSign;
+        violation = std::max(violation, best);
+        break;
+      }
+      case PackingConstraint::InsideSphere:
+      case PackingConstraint::OutsideSphere: {
+        Eigen::Vector3d d = p - Eigen::Vector3d(q[0], q[1], q[2]);
+        double r = d.norm();
+        double e = c.type == PackingConstraint::InsideSphere ? r - q[3] : q[3] - r;
+        if (e <= 0.0)
+          return 0.0;
+        f = e * e;
+        if (r > 0.0) {
+          double sign = c.type == PackingConstraint::InsideSphere ? 1.0 : -1.0;
+          gradient += (2.0 * e * sign / r) * d;
+        }
+        violation = std::max(violation, e);
+        break;
+      }
+      case PackingConstraint::InsideEllipsoid:
+      case PackingConstraint::OutsideEllipsoid: {
+        // distance to the surface along the ray from the center
+        Eigen::Vector3d d = p - Eigen::Vector3d(q[0], q[1], q[2]);
+        Eigen::Vector3d scaled(d.x() / q[3], d.y() / q[4], d.z() / q[5]);
+        double s = scaled.norm(), r = d.norm();
+        if (s == 0.0) {
+          if (c.type == PackingConstraint::InsideEllipsoid)
+            return 0.0;
+          double e = q[6] * std::min(q[3], std::min(q[4], q[5]));
+          violation = std::max(violation, e);
+          return e * e;
+        }
+        double e = r * (1.0 - q[6] / s);
+        double sign = 1.0;
+        if (c.type == PackingConstraint::OutsideEllipsoid) {
+          e = -e;
+          sign = -1.0;
+        }
+        if (e <= 0.0)
+          return 0.0;
+        f = e * e;
+        Eigen::Vector3d ds(scaled.x() / q[3], scaled.y() / q[4], scaled.z() / q[5]);
+        Eigen::Vector3d de = (1.0 - q[6] / s) / r * d + (r * q[6] / (s * s * s)) * ds;
+        gradient += (2.0 * e * sign) * de;
+        violation = std::max(violation, e);
+        break;
+      }
+      case PackingConstraint::InsideCylinder: {
+        Eigen::Vector3d u(q[3], q[4], q[5]);
+        Eigen::Vector3d d = p - Eigen::Vector3d(q[0], q[1], q[2]);
+        double w = d.dot(u);
+        Eigen::Vector3d radial = d - w * u;
+        double rho = radial.norm();
+        double axial = 0.0;
+        if (w < 0.0) {
+          axial = -w;
+          gradient -= 2.0 * axial * u;
+        } else if (w > q[7]) {
+          axial = w - q[7];
+          gradient += 2.0 * axial * u;
+        }
+        double outward = std::max(0.0, rho - q[6]);
+        if (outward > 0.0)
+          gradient += (2.0 * outward / rho) * radial;
+        f = axial * axial + outward * outward;
+        violation = std::max(violation, std::sqrt(f));
+        break;
+      }
+      case PackingConstraint::OutsideCylinder: {
+        // inside: push through the nearest of the wall and the two caps
+        Eigen::Vector3d u(q[3], q[4], q[5]);
+        Eigen::Vector3d d = p - Eigen::Vector3d(q[0], q[1], q[2]);
+        double w = d.dot(u);
+        Eigen::Vector3d radial = d - w * u;
+        double rho = radial.norm();
+        if (w <= 0.0 || w >= q[7] || rho >= q[6])
+          return 0.0;
+        double e = q[6] - rho;
+        Eigen::Vector3d direction(Eigen::Vector3d::Zero());
+        if (rho > 0.0)
+          direction = -radial / rho;
+        if (w < e) {
+          e = w;
+          direction = u;
+        }
+        if (q[7] - w < e) {
+          e = q[7] - w;
+          direction = -u;
+        }
+        f = e * e;
+        gradient += 2.0 * e * direction;
+        violation = std::max(violation, e);
+        break;
+      }
+      case PackingConstraint::OverPlane:
+      case PackingConstraint::BelowPlane: {
+        Eigen::Vector3d a(q[0], q[1], q[2]);
+        double norm = a.norm();
+        if (norm == 0.0)
+          return 0.0;
+        double signedDistance = (a.dot(p) - q[3]) / norm;
+        double e = c.type == PackingConstraint::OverPlane ? -signedDistance : signedDistance;
+        if (e <= 0.0)
+          return 0.0;
+        f = e * e;
+        double sign = c.type == PackingConstraint::OverPlane ? -1.0 : 1.0;
+        gradient += (2.0 * e * sign / norm) * a;
+        violation = std::max(violation, e);
+        break;
+      }
+    }
+    return f;
+  }
+
+  double constraintViolation(const PackingConstraint &constraint, const Eigen::Vector3d &position)
+  {
+    Eigen::Vector3d gradient(Eigen::Vector3d::Zero());
+    double violation = 0.0;
+    constraintPenalty(constraint, position, gradient, violation);
+    return violation;
+  }
+
+  bool constraintBounds(const PackingConstraint &constraint, Eigen::Vector3d &min,
+      Eigen::Vector3d &max)
+  {
+    const double *q = constraint.params;
+    Eigen::Vector3d center(q[0], q[1], q[2]);
+    switch (constraint.type) {
+      case PackingConstraint::InsideBox:
+        min = center;
+        max = Eigen::Vector3d(q[3], q[4], q[5]);
+        return true;
+      case PackingConstraint::InsideSphere:
+        min = center - Eigen::Vector3d::Constant(q[3]);
+        max = center + Eigen::Vector3d::Constant(q[3]);
+        return true;
+      case PackingConstraint::InsideEllipsoid:
+        min = center - q[6] * Eigen::Vector3d(q[3], q[4], q[5]);
+        max = center + q[6] * Eigen::Vector3d(q[3], q[4], q[5]);
+        return true;
+      case PackingConstraint::InsideCylinder: {
+        Eigen::Vector3d u(q[3], q[4], q[5]);
+        Eigen::Vector3d end = center + q[7] * u;
+        for (int j = 0; j < 3; ++j) {
+          double extent = q[6] * std::sqrt(std::max(0.0, 1.0 - u[j] * u[j]));
+          min[j] = std::min(center[j], end[j]) - extent;
+          max[j] = std::max(center[j], end[j]) + extent;
+        }
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  /**
+   * A range of molecules evaluated by one thread. Only the gradient of the
+   * chunk's own atoms and variables is written, so chunks never conflict.
+   */
+  struct PackingEngine::Chunk
+  {
+    PackingEngine *engine;
+    int begin, end;
+    const std::vector<double> *x;
+    std::vector<double> *gradient;
+    const CellList *cells;
+    bool distances;
+    double f, maxDistance, maxConstraint;
+
+    void computePositions()
+    {
+      for (int m = begin; m < end; ++m) {
+        const MoleculeRef &ref = engine->m_molecules[m];
+        if (ref.variable < 0)
+          continue;
+        const double *v = &(*x)[ref.variable];
+        Eigen::Matrix3d R;
+        eulerRotation(v[3], v[4], v[5], R);
+        Eigen::Vector3d t(v[0], v[1], v[2]);
+        const std::vector<Eigen::Vector3d> &reference = engine->m_reference[ref.structure];
+        for (int i = 0; i < ref.numAtoms; ++i)
+          engine->m_positions[ref.firstAtom + i] = t + R * reference[i];
+      }
+    }
+
+    void evaluate()
+    {
+      f = maxDistance = maxConstraint = 0.0;
+      double tol = engine->m_problem.tolerance;
+      double tol2 = tol * tol;
+      std::vector<int> neighbors;
+
+      for (int m = begin; m < end; ++m) {
+        const MoleculeRef &ref = engine->m_molecules[m];
+        const PackingStructure &structure = engine->m_problem.structures.at(ref.structure);
+        double violation = 0.0;
+
+        for (int i = 0; i < ref.numAtoms; ++i) {
+          int atom = ref.firstAtom + i;
+          const Eigen::Vector3d &p = engine->m_positions[atom];
+          Eigen::Vector3d g(Eigen::Vector3d::Zero());
+
+          for (int c = 0; c < structure.constraints.size(); ++c) {
+            if (!engine->m_constraintMask[ref.structure][c][i])
+              continue;
+            double constraintViolation = 0.0;
+            f += constraintPenalty(structure.constraints.at(c), p, g, constraintViolation);
+            maxConstraint = std::max(maxConstraint, constraintViolation);
+            violation = std::max(violation, constraintViolation);
+          }
+
+          if (distances) {
+            neighbors.clear();
+            cells->neighbors(p, tol, neighbors);
+            for (std::size_t n = 0; n < neighbors.size(); ++n) {
+              int other = neighbors[n];
+              int otherMolecule = engine->m_atomMolecule[other];
+              if (otherMolecule == m)
+                continue;
+              if (ref.variable < 0 && engine->m_molecules[otherMolecule].variable < 0)
+                continue; // two fixed molecules
+              Eigen::Vector3d d = p - engine->m_positions[other];
+              double v = tol2 - d.squaredNorm();
+              if (v <= 0.0)
+                continue;
+              // every pair is seen from both sides
+              f += 0.5 * v * v;
+              g -= (4.0 * v) * d;
+              double distanceViolation = tol - std::sqrt(tol2 - v);
+              maxDistance = std::max(maxDistance, distanceViolation);
+              violation = std::max(violation, distanceViolation);
+            }
+          }
+
+          engine->m_atomGradient[atom] = g;
+        }
+
+        engine->m_moleculeViolation[m] = violation;
+        if (ref.variable < 0)
+          continue;
+
+        // chain rule to the translation and the Euler angles
+        const double *v = &(*x)[ref.variable];
+        Eigen::Matrix3d R, dRa, dRb, dRg;
+        eulerRotation(v[3], v[4], v[5], R, &dRa, &dRb, &dRg);
+        const std::vector<Eigen::Vector3d> &reference = engine->m_reference[ref.structure];
+        double *grad = &(*gradient)[ref.variable];
+        for (int j = 0; j < 6; ++j)
+          grad[j] = 0.0;
+        for (int i = 0; i < ref.numAtoms; ++i) {
+          const Eigen::Vector3d &g = engine->m_atomGradient[ref.firstAtom + i];
+          grad[0] += g.x();
+          grad[1] += g.y();
+          grad[2] += g.z();
+          grad[3] += g.dot(dRa * reference[i]);
+          grad[4] += g.dot(dRb * reference[i]);
+          grad[5] += g.dot(dRg * reference[i]);
+        }
+      }
+    }
+  };
+
+  PackingEngine::PackingEngine(const PackingProblem &problem) : m_problem(problem), m_monitor(0)
+  {
+    // seed -1 takes the time, like packmol
+    unsigned long long seed = problem.seed == -1 ? static_cast<unsigned long long>(std::time(0))
+        : static_cast<unsigned long long>(problem.seed);
+    m_random = seed * 2654435761ULL + 88172645463325252ULL;
+
+    int numAtoms = 0;
+    int numVariables = 0;
+    for (int s = 0; s < m_problem.structures.size(); ++s) {
+      const PackingStructure &structure = m_problem.structures.at(s);
+      int size = static_cast<int>(structure.coordinates.size());
+
+      // free molecules rotate around their center
+      Eigen::Vector3d center(Eigen::Vector3d::Zero());
+      for (int i = 0; i < size; ++i)
+        center += structure.coordinates[i];
+      if (size)
+        center /= static_cast<double>(size);
+      std::vector<Eigen::Vector3d> reference(structure.coordinates);
+      for (int i = 0; i < size; ++i)
+        reference[i] -= center;
+      m_reference.push_back(reference);
+
+      // constraint masks
+      m_constraintMask.push_back(std::vector<std::vector<char> >());
+      foreach (const PackingConstraint &constraint, structure.constraints) {
+        std::vector<char> mask(size, constraint.atoms.empty() ? 1 : 0);
+        for (std::size_t i = 0; i < constraint.atoms.size(); ++i)
+          if (constraint.atoms[i] >= 0 && constraint.atoms[i] < size)
+            mask[constraint.atoms[i]] = 1;
+        m_constraintMask.back().push_back(mask);
+      }
+
+      // region used for random placement: the whole molecule "inside" constraints
+      Eigen::Vector3d min(Eigen::Vector3d::Constant(-1e30)), max(Eigen::Vector3d::Constant(1e30));
+      bool bounded = false;
+      foreach (const PackingConstraint &constraint, structure.constraints) {
+        if (!constraint.atoms.empty())
+          continue;
+        Eigen::Vector3d cmin, cmax;
+        if (!constraintBounds(constraint, cmin, cmax))
+          continue;
+        for (int j = 0; j < 3; ++j) {
+          min[j] = std::max(min[j], cmin[j]);
+          max[j] = std::min(max[j], cmax[j]);
+        }
+        bounded = true;
+      }
+      if (!bounded) {
+        // a cube with room for all atoms
+        double side = std::pow(std::max(1, m_problem.numAtoms()) * 10.0, 1.0 / 3.0);
+        min = Eigen::Vector3d::Constant(-0.5 * side);
+        max = Eigen::Vector3d::Constant(0.5 * side);
+      }
+      m_regionMin.push_back(min);
+      m_regionMax.push_back(max);
+
+      for (int copy = 0; copy < structure.number; ++copy) {
+        MoleculeRef ref;
+        ref.structure = s;
+        ref.firstAtom = numAtoms;
+        ref.numAtoms = size;
+        ref.variable = structure.fixed ? -1 : numVariables;
+        if (!structure.fixed)
+          numVariables += 6;
+        numAtoms += size;
+        m_molecules.push_back(ref);
+        for (int i = 0; i < size; ++i)
+          m_atomMolecule.push_back(static_cast<int>(m_molecules.size()) - 1);
+      }
+    }
+
+    m_positions.resize(numAtoms);
+    m_atomGradient.resize(numAtoms);
+    m_moleculeViolation.resize(m_molecules.size());
+
+    // fixed molecules never move
+    for (std::size_t m = 0; m < m_molecules.size(); ++m) {
+      const MoleculeRef &ref = m_molecules[m];
+      if (ref.variable >= 0)
+        continue;
+      std::vector<Eigen::Vector3d> positions = fixedPositions(m_problem.structures.at(ref.structure));
+      std::copy(positions.begin(), positions.end(), m_positions.begin() + ref.firstAtom);
+    }
+  }
+
+  double PackingEngine::random()
+  {
+    // xorshift64*, the same sequence for the same seed on every platform
+    m_random ^= m_random >> 12;
+    m_random ^= m_random << 25;
+    m_random ^= m_random >> 27;
+    return ((m_random * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  void PackingEngine::placeRandomly(int molecule, std::vector<double> &x)
+  {
+    const MoleculeRef &ref = m_molecules[molecule];
+    if (ref.variable < 0)
+      return;
+    const Eigen::Vector3d &min = m_regionMin[ref.structure];
+    const Eigen::Vector3d &max = m_regionMax[ref.structure];
+    for (int j = 0; j < 3; ++j)
+      x[ref.variable + j] = min[j] + random() * (max[j] - min[j]);
+    for (int j = 3; j < 6; ++j)
+      x[ref.variable + j] = 2.0 * M_PI * random();
+  }
+
+  double PackingEngine::evaluate(const std::vector<double> &x, std::vector<double> &gradient,
+      bool distances, double *maxDistance, double *maxConstraint)
+  {
+    int numMolecules = static_cast<int>(m_molecules.size());
+    int numChunks = std::min(numMolecules, 4 * std::max(1, QThread::idealThreadCount()));
+    std::vector<Chunk> chunks(std::max(1, numChunks));
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+      Chunk &chunk = chunks[c];
+      chunk.engine = this;
+      chunk.begin = static_cast<int>(c * numMolecules / chunks.size());
+      chunk.end = static_cast<int>((c + 1) * numMolecules / chunks.size());
+      chunk.x = &x;
+      chunk.gradient = &gradient;
+      chunk.cells = 0;
+      chunk.distances = distances;
+    }
+
+    gradient.assign(x.size(), 0.0);
+    QtConcurrent::blockingMap(chunks, &Chunk::computePositions);
+
+    CellList *cells = 0;
+    if (distances) {
+      cells = new CellList(m_positions, m_problem.tolerance);
+      for (std::size_t c = 0; c < chunks.size(); ++c)
+        chunks[c].cells = cells;
+    }
+    QtConcurrent::blockingMap(chunks, &Chunk::evaluate);
+    delete cells;
+
+    double f = 0.0, dist = 0.0, constraint = 0.0;
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+      f += chunks[c].f;
+      dist = std::max(dist, chunks[c].maxDistance);
+      constraint = std::max(constraint, chunks[c].maxConstraint);
+    }
+    if (maxDistance)
+      *maxDistance = dist;
+    if (maxConstraint)
+      *maxConstraint = constraint;
+    return f;
+  }
+
+  static double dot(const std::vector<double> &a, const std::vector<double> &b)
+  {
+    double result = 0.0;
+    for (std::size_t i = 0; i < a.size(); ++i)
+      result += a[i] * b[i];
+    return result;
+  }
+
+  double PackingEngine::minimize(std::vector<double> &x, bool distances, int maxIterations)
+  {
+    const int history = 5;
+    std::deque<std::vector<double> > S, Y;
+    std::vector<double> g, gn, xn, d(x.size());
+    double f = evaluate(x, g, distances);
+
+    for (int iteration = 0; iteration < maxIterations && f > 0.0; ++iteration) {
+      if (m_monitor && m_monitor->canceled())
+        break;
+      // L-BFGS two-loop recursion
+      d = g;
+      std::vector<double> alpha(S.size());
+      for (int k = static_cast<int>(S.size()) - 1; k >= 0; --k) {
+        alpha[k] = dot(S[k], d) / dot(Y[k], S[k]);
+        for (std::size_t i = 0; i < d.size(); ++i)
+          d[i] -= alpha[k] * Y[k][i];
+      }
+      if (!S.empty()) {
+        double gamma = dot(S.back(), Y.back()) / dot(Y.back(), Y.back());
+        for (std::size_t i = 0; i < d.size(); ++i)
+          d[i] *= gamma;
+      }
+      for (std::size_t k = 0; k < S.size(); ++k) {
+        double beta = dot(Y[k], d) / dot(Y[k], S[k]);
+        for (std::size_t i = 0; i < d.size(); ++i)
+          d[i] += S[k][i] * (alpha[k] - beta);
+      }
+      for (std::size_t i = 0; i < d.size(); ++i)
+        d[i] = -d[i];
+
+      double slope = dot(g, d);
+      if (slope >= 0.0) {
+        // not a descent direction, start over with steepest descent
+        S.clear();
+        Y.clear();
+        for (std::size_t i = 0; i < d.size(); ++i)
+          d[i] = -g[i];
+        slope = dot(g, d);
+      }
+
+      // no variable moves more than the tolerance (A or rad) in one step
+      double largest = 0.0;
+      for (std::size_t i = 0; i < d.size(); ++i)
+        largest = std::max(largest, std::fabs(d[i]));
+      if (largest == 0.0)
+        break;
+      double step = std::min(1.0, m_problem.tolerance / largest);
+
+      // backtracking line search (Armijo)
+      double fn = 0.0;
+      bool accepted = false;
+      xn.resize(x.size());
+      for (int trial = 0; trial < 30; ++trial) {
+        for (std::size_t i = 0; i < x.size(); ++i)
+          xn[i] = x[i] + step * d[i];
+        fn = evaluate(xn, gn, distances);
+        if (fn <= f + 1e-4 * step * slope) {
+          accepted = true;
+          break;
+        }
+        step *= 0.5;
+      }
+      if (!accepted)
+        break;
+
+      std::vector<double> s(x.size()), y(x.size());
+      for (std::size_t i = 0; i < x.size(); ++i) {
+        s[i] = xn[i] - x[i];
+        y[i] = gn[i] - g[i];
+      }
+      if (dot(s, y) > 1e-12) {
+        S.push_back(s);
+        Y.push_back(y);
+        if (static_cast<int>(S.size()) > history) {
+          S.pop_front();
+          Y.pop_front();
+        }
+      }
+
+      bool stalled = f - fn < 1e-10 * std::max(1.0, f);
+      x.swap(xn);
+      g.swap(gn);
+      f = fn;
+      if (stalled)
+        break;
+    }
+
+    return f;
+  }
+
+  bool PackingEngine::pack(PackingResult &result, PackingMonitor *monitor)
+  {
+    m_monitor = monitor;
+    std::vector<double> x, gradient;
+    int numVariables = 0;
+    for (std::size_t m = 0; m < m_molecules.size(); ++m)
+      if (m_molecules[m].variable >= 0)
+        numVariables += 6;
+    x.resize(numVariables);
+    int molecule = 0;
+    foreach (const PackingStructure &structure, m_problem.structures)
+      for (int copy = 0; copy < structure.number; ++copy, ++molecule) {
+        placeRandomly(molecule, x);
+        // molecules that replace tiled solvent start in its place
+        const MoleculeRef &ref = m_molecules[molecule];
+        if (ref.variable >= 0 && copy < static_cast<int>(structure.startCenters.size()))
+          for (int j = 0; j < 3; ++j)
+            x[ref.variable + j] = structure.startCenters[copy][j];
+      }
+
+    // initial approximation: only the constraints
+    minimize(x, false, 500);
+
+    // at least one loop, nothing is converged without evaluating it
+    double precision = 0.01 * m_problem.tolerance;
+    int maxLoops = std::max(1, m_problem.maxLoops);
+    int loop = 0;
+    double f = 0.0, maxDistance = 0.0, maxConstraint = 0.0;
+    for (; loop < maxLoops; ++loop) {
+      minimize(x, true, 200);
+      f = evaluate(x, gradient, true, &maxDistance, &maxConstraint);
+      if (monitor && (!monitor->progress(loop + 1, maxLoops, f, maxDistance, 
+              maxConstraint) || monitor->canceled()))
+        break;
+      if (maxDistance <= precision && maxConstraint <= precision)
+        break;
+      if (loop + 1 == maxLoops)
+        break;
+
+      // move the worst 5% of the molecules that still violate something
+      std::vector<std::pair<double, int> > bad;
+      for (std::size_t m = 0; m < m_molecules.size(); ++m)
+        if (m_molecules[m].variable >= 0 && m_moleculeViolation[m] > precision)
+          bad.push_back(std::make_pair(m_moleculeViolation[m], static_cast<int>(m)));
+      std::sort(bad.begin(), bad.end());
+      std::size_t numMoved = std::max<std::size_t>(1, bad.size() / 20);
+      for (std::size_t i = 0; i < numMoved && i < bad.size(); ++i)
+        placeRandomly(bad[bad.size() - 1 - i].second, x);
+    }
+
+    result.positions = m_positions;
+    result.functionValue = f;
+    result.maxDistanceViolation = maxDistance;
+    result.maxConstraintViolation = maxConstraint;
+    result.loops = std::min(loop + 1, maxLoops);
+    result.converged = maxDistance <= precision && maxConstraint <= precision;
+    return result.converged;
+  }
+
+} // end namespace Avogadro
@@ -0,0 +1,184 @@
+/**********************************************************************
+  PackingEngine - In-process alternative to the packmol executable
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef PACKINGENGINE_H
+#define PACKINGENGINE_H
+
+#include <Eigen/Core>
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+
+#include <utility>
+#include <vector>
+
+namespace Avogadro {
+
+  class PackmolInputDocument;
+
+  struct PackingConstraint
+  {
+    enum Type { InsideBox, OutsideBox, InsideSphere, OutsideSphere, OverPlane, BelowPlane,
+        InsideEllipsoid, OutsideEllipsoid, InsideCylinder, OutsideCylinder };
+
+    Type type;
+    // box: min max, sphere: center radius, plane: a b c d,
+    // ellipsoid: center semi-axes scale, cylinder: start direction radius length
+    double params[8];
+    std::vector<int> atoms;    // 0-based atoms of the structure it applies to, empty for all
+  };
+
+  struct PackingStructure
+  {
+    PackingStructure() : number(1), fixed(false), center(false), tiled(0)
+    {
+      for (int i = 0; i < 6; ++i)
+        fixedPosition[i] = 0.0;
+    }
+
+    QString fileName;
+    int number;
+    bool fixed;
+    double fixedPosition[6];   // x y z and euler angles of a fixed structure
+    bool center;               // a fixed structure is centered at x y z
+    QList<PackingConstraint> constraints;
+    std::vector<Eigen::Vector3d> coordinates; // filled in by the caller
+    int tiled;                 // molecules placed from a solvent box (in coordinates), see tileSolvent()
+    std::vector<Eigen::Vector3d> startCenters; // where the first molecules start, see tileSolvent()
+
+    // template topology, filled in by the caller to rebuild a result
+    std::vector<int> atomicNumbers;
+    std::vector<int> formalCharges;
+    std::vector<std::pair<int, int> > bonds;
+    std::vector<int> bondOrders;
+    QByteArray residueName;
+  };
+
+  /**
+   * What the engine packs: the structures with their constraints and the
+   * global keywords it uses.
+   */
+  struct PackingProblem
+  {
+    PackingProblem() : tolerance(2.0), seed(1234567), maxLoops(200) {}
+
+    double tolerance;
+    int seed;
+    int maxLoops;
+    QString fileType;
+    QString output;
+    QList<PackingStructure> structures;
+
+    int numAtoms() const;
+  };
+
+  /**
+   * Parse the part of the packmol input format the engine supports
+   * (tolerance, seed, nloop, structure/number/fixed/center, inside and
+   * outside box/cube/sphere/ellipsoid/cylinder, over/below plane and atoms
+   * blocks).
+   * @param error Set to a description of the first unsupported line.
+   */
+  bool parsePackingInput(const QString &text, PackingProblem &problem, QString *error = 0);
+  //! Same for an input that is already parsed, errors in its blocks are fatal
+  bool parsePackingInput(const PackmolInputDocument &document, PackingProblem &problem,
+      QString *error = 0);
+
+  //! How far (A) @p position lies outside the region of @p constraint, 0.0 if inside
+  double constraintViolation(const PackingConstraint &constraint, const Eigen::Vector3d &position);
+  //! Bounding box of an "inside" constraint, false for the other types
+  bool constraintBounds(const PackingConstraint &constraint, Eigen::Vector3d &min,
+      Eigen::Vector3d &max);
+  //! The atoms of a fixed structure where the engine puts them
+  std::vector<Eigen::Vector3d> fixedPositions(const PackingStructure &structure);
+
+  class PackingMonitor
+  {
+    public:
+      virtual ~PackingMonitor() {}
+      //! Called after every loop, return false to stop
+      virtual bool progress(int loop, int maxLoops, double functionValue,
+          double maxDistanceViolation, double maxConstraintViolation) = 0;
+      //! Polled between iterations, return true to stop as soon as possible
+      virtual bool canceled() const { return false; }
+  };
+
+  struct PackingResult
+  {
+    PackingResult() : converged(false), functionValue(0.0), maxDistanceViolation(0.0),
+        maxConstraintViolation(0.0), loops(0) {}
+
+    //! All atoms, structure by structure and molecule by molecule
+    std::vector<Eigen::Vector3d> positions;
+    bool converged;
+    double functionValue;
+    double maxDistanceViolation;   // A below the tolerance
+    double maxConstraintViolation; // A outside a region
+    int loops;
+  };
+
+  /**
+   * Packs molecules the way packmol does: every free molecule has a
+   * translation and three Euler angles, and the objective penalizes atoms
+   * of different molecules closer than the tolerance plus atoms outside
+   * their regions. Close pairs are found with a cell list and the objective
+   * and gradient are evaluated in parallel over chunks of molecules. The
+   * optimizer is L-BFGS; molecules that are still bad after a loop are
+   * moved to a random spot in their region.
+   */
+  class PackingEngine
+  {
+    public:
+      PackingEngine(const PackingProblem &problem);
+
+      bool pack(PackingResult &result, PackingMonitor *monitor = 0);
+
+      struct Chunk;
+
+    private:
+      struct MoleculeRef
+      {
+        int structure;
+        int firstAtom;
+        int numAtoms;
+        int variable;          // index of the first of 6 variables, -1 if fixed
+      };
+
+      double evaluate(const std::vector<double> &x, std::vector<double> &gradient,
+          bool distances, double *maxDistance = 0, double *maxConstraint = 0);
+      double minimize(std::vector<double> &x, bool distances, int maxIterations);
+      void placeRandomly(int molecule, std::vector<double> &x);
+      double random();
+
+      PackingProblem m_problem;
+      PackingMonitor *m_monitor;
+      std::vector<MoleculeRef> m_molecules;
+      std::vector<std::vector<Eigen::Vector3d> > m_reference; // centered coordinates per structure
+      std::vector<Eigen::Vector3d> m_positions;               // current atom positions
+      std::vector<Eigen::Vector3d> m_atomGradient;
+      std::vector<int> m_atomMolecule;
+      std::vector<std::vector<std::vector<char> > > m_constraintMask; // structure, constraint, atom
+      std::vector<Eigen::Vector3d> m_regionMin, m_regionMax;  // where to place each structure
+      std::vector<double> m_moleculeViolation;
+      unsigned long long m_random;
+  };
+
+} // end namespace Avogadro
+
+#endif
@@ -25,14 +25,31 @@
 #include "packmoldialog.h"
 #include "highlighter.h"
 #include "structuresmodel.h"
+#include "structurecache.h"
+#include "inputgenerator.h"
+#include "packmoloutputparser.h"
+#include "logviewer.h"
+#include "jobqueuemodel.h"
+#include "seedrace.h"
+#include "decomposedrun.h"
+#include "enginerun.h"
+#include "resultvalidator.h"
+#include "packmolresult.h"
+#include "resultreader.h"
+#include "resultmolecule.h"
+#include "resultpreview.h"
+#include "solventtiler.h"
 
 #include <Eigen/Core>
 
+#include <cmath>
+
 #include <avogadro/atom.h>
 #include <avogadro/molecule.h>
 #include <avogadro/moleculefile.h>
 
 #include <openbabel/mol.h>
+#include <openbabel/generic.h>
 
 #include <QFileDialog>
 #include <QMessageBox>
@@ -41,38 +58,226 @@
 #include <QDesktopServices>
 #include <QUrl>
 #include <QSharedPointer>
+#include <QTimer>
+#include <QDateTime>
+#include <QScrollBar>
+#include <QTextDocument>
+#include <QTextBlock>
+#include <QThread>
+#include <QtConcurrentRun>
 #include <QDebug>
 
 namespace Avogadro {
 
-  double calcNumberOfMolecules(double mw, double density, double volume)
+  /**
+   * Snapshot of the solvation widgets, taken on the GUI thread so the
+   * estimate can be computed on a worker thread. The structures are read
+   * there too, the worker only uses their coordinates.
+   */
+  struct SolvationInput
+  {
+    int generation;
+    SolvationSpec spec;
+    QSharedPointer<CachedStructure> solute;  // null without a (readable) solute
+    QSharedPointer<CachedStructure> solvent;
+    bool adjustShape;
+    bool alignSolute;  // fit the shape along the solute's principal axes
+    bool autoShape;    // fit every shape and keep the smallest
+    double shellThickness; // 0.0 unless only a shell around the solute is filled
+    bool guessNumber;
+    double spacing;
+    double density;
+  };
+
+  struct SolvationEstimate
+  {
+    SolvationEstimate() : generation(-1), adjusted(false), number(-1) {}
+
+    int generation;
+    bool adjusted; // true if the shape was fitted to the solute
+    SolvationSpec spec;
+    int number; // -1 if the solvent number should not change
+  };
+
+  /**
+   * Fit the shape to the solute and estimate the number of solvent molecules.
+   * Returns early (with an unset estimate) as soon as @p generation shows a
+   * newer edit was made, since that result will be discarded anyway.
+   */
+  SolvationEstimate solvEstimate(const SolvationInput &input, QAtomicInt *generation)
   {
-    // mass [g/mol]
-    // density [g/ml]
-    // volume [A^3]
-    // 1 ml = 1 cm^3 = 10^24A^3
-    // 1 A^3 = 10^-24cm^3
+    SolvationEstimate estimate;
+    estimate.generation = input.generation;
+    estimate.spec = input.spec;
+
+    const QSharedPointer<CachedStructure> &structure = input.solute;
+    if (input.shellThickness > 0.0 && structure) {
+      estimate.adjusted = true;
+      estimate.spec.fitShell(structure->positions(), structure->atomicNumbers(),
+          input.shellThickness);
+    } else if (input.adjustShape && structure) {
+      std::vector<Eigen::Vector3d> positions = structure->positions();
+      if (input.alignSolute) {
+        // the solute is rotated like this when the input is generated
+        for (std::size_t i = 0; i < positions.size(); ++i)
+          positions[i] = structure->orientedBox().toBoxFrame(positions[i]);
+      }
+      estimate.adjusted = true;
+      if (input.autoShape)
+        estimate.spec.fitSmallestShape(positions, input.spacing);
+      else
+        estimate.spec.fitToSolute(positions, input.spacing);
+    }
+
+    if (input.guessNumber) {
+      // the solvent only fills what the solutes leave free
+      if (*generation != input.generation)
+        return estimate;
+      if (structure)
+        estimate.spec.soluteVolume = structure->excludedVolume();
+      if (*generation != input.generation)
+        return estimate;
+      estimate.number = input.solvent ? static_cast<int>(calcNumberOfMolecules(
+            input.solvent->molecularWeight(), input.density, estimate.spec.solventVolume())) : 0;
+    }
 
-    double mass = volume * density;
-    double moles = mass / mw;
-    double number = moles * 6.022 * 10e-2;
-    return number;
+    return estimate;
   }
 
-  double calcNumberOfMolecules(const QString &fileName, double density, double volume)
+  /**
+   * The bilayer and its structures, looked up on the GUI thread so the
+   * solute volumes and molecule numbers can be computed on a worker.
+   */
+  struct BilayerInput
   {
-    QSharedPointer<Molecule> molecule(MoleculeFile::readMolecule(fileName));
-    if (!molecule)
-      return 0.0;
-    return calcNumberOfMolecules(molecule->OBMol().GetMolWt(), density, volume);
+    BilayerSpec spec;
+    QList<QSharedPointer<CachedStructure> > structures; // null if unreadable
+  };
+
+  //! @p input's spec with the numbers of its lipids and polar solvents guessed
+  BilayerSpec bilayerEstimate(BilayerInput input)
+  {
+    // solutes keep their number and take their volume from the regions
+    BilayerSpec &spec = input.spec;
+    for (int i = 0; i < spec.structures.size(); ++i) {
+      Structure &structure = spec.structures[i];
+      if (structure.type != Structure::PolarSolute && structure.type != Structure::LipophilicSolute)
+        continue;
+      const QSharedPointer<CachedStructure> &solute = input.structures.at(i);
+      structure.volume = solute ? solute->excludedVolume() : 0.0;
+    }
+    for (int i = 0; i < spec.structures.size(); ++i) {
+      Structure &structure = spec.structures[i];
+      if (structure.type != Structure::Lipid && structure.type != Structure::PolarSolvent)
+        continue;
+      const QSharedPointer<CachedStructure> &cached = input.structures.at(i);
+      structure.number = cached ? static_cast<int>(calcNumberOfMolecules(
+            cached->molecularWeight(), structure.density, spec.regionVolume(structure.type))) : 0;
+    }
+    return spec;
+  }
+
+  //! Cell lengths of @p cached's unit cell, zero if it has no rectangular one
+  Eigen::Vector3d unitCellPeriod(const CachedStructure &cached)
+  {
+    OpenBabel::OBUnitCell *cell = cached.molecule()->OBUnitCell();
+    if (!cell || std::fabs(cell->GetAlpha() - 90.0) > 0.01 || std::fabs(cell->GetBeta() - 90.0) > 0.01
+        || std::fabs(cell->GetGamma() - 90.0) > 0.01)
+      return Eigen::Vector3d::Zero();
+    return Eigen::Vector3d(cell->GetA(), cell->GetB(), cell->GetC());
+  }
+
+  //! Copy the coordinates and topology of @p cached into @p structure
+  void setTemplate(PackingStructure &structure, const CachedStructure &cached)
+  {
+    structure.coordinates = cached.positions();
+    structure.atomicNumbers = cached.atomicNumbers();
+    structure.formalCharges = cached.formalCharges();
+    structure.bonds = cached.bonds();
+    structure.bondOrders = cached.bondOrders();
+    structure.residueName = cached.residueName();
+  }
+
+  /**
+   * Atoms in a complete result of @p job, 0 if one of its structures can't
+   * be read. Uses the cache, so call it on the GUI thread.
+   */
+  int expectedAtoms(const PackmolJob &job)
+  {
+    QFile file(job.inputFileName());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+      return 0;
+    PackmolInputDocument input(QString(file.readAll()));
+    int numAtoms = 0;
+    foreach (const InputStructure &block, input.structures()) {
+      QSharedPointer<CachedStructure> cached = StructureCache::instance()->structure(
+          QDir(job.workingDirectory()).filePath(block.fileName));
+      if (!cached)
+        return 0;
+      numAtoms += block.number * cached->numAtoms();
+    }
+    return numAtoms;
   }
 
-  double calcVolumeOfMolecules(double mw, double density, double number)
+  /**
+   * A result on its way into Avogadro. Everything the worker needs is
+   * copied in, so another run can finish meanwhile.
+   */
+  struct ResultImport
   {
-    double moles = number / (6.022 * 10e+23);
-    double mass = moles * mw;
-    double volume = mass / density;
-    return volume * 10e+24;
+    ResultImport() : validate(false), periodic(false) {}
+
+    PackingProblem problem;
+    QString directory;       // where the structures of a job are, empty if the templates are set
+    QString fileName;        // the result file, empty for the engine
+    ResultData data;         // read from fileName if there are no positions
+    bool validate;
+    bool periodic;
+    ValidationReport report;
+  };
+
+  /**
+   * Read the result, rebuild its topology from the input structures (or
+   * perceive it when they don't match) and validate it.
+   */
+  ResultImport loadResult(ResultImport import)
+  {
+    QString fileType = import.problem.fileType.isEmpty() ? "pdb" : import.problem.fileType;
+    if (import.data.positions.empty() && !readResult(import.fileName, fileType,
+          import.data, false, &import.report.error))
+      return import;
+    if (!applyTemplateTopology(import.problem, import.data))
+      perceiveResultBonds(import.data);
+
+    if (import.validate) {
+      Eigen::Vector3d period;
+      bool periodic = import.periodic && periodicBox(import.problem, period);
+      import.report = validatePacking(import.problem, import.data.positions, 0.01,
+          periodic ? &period : 0);
+    }
+    return import;
+  }
+
+  //! The worst offenders of @p report, one per line with 1-based numbers
+  QString validationDetails(const ResultImport &import)
+  {
+    const char *types[] = { "inside box", "outside box", "inside sphere", "outside sphere",
+        "over plane", "below plane", "inside ellipsoid", "outside ellipsoid", "inside cylinder",
+        "outside cylinder" };
+    const ValidationReport &report = import.report;
+    QString details;
+    foreach (const DistanceOffender &offender, report.worstDistances)
+      details += QString("atoms %1 and %2 (molecules %3 and %4) are %5 A apart\n")
+          .arg(offender.atom1 + 1).arg(offender.atom2 + 1).arg(offender.molecule1 + 1)
+          .arg(offender.molecule2 + 1).arg(offender.distance, 0, 'f', 3);
+    foreach (const ConstraintOffender &offender, report.worstConstraints) {
+      const PackingStructure &structure = import.problem.structures.at(offender.structure);
+      details += QString("atom %1 (molecule %2, %3) is %4 A outside its %5 region\n")
+          .arg(offender.atom + 1).arg(offender.molecule + 1).arg(structure.fileName)
+          .arg(offender.violation, 0, 'f', 3)
+          .arg(types[structure.constraints.at(offender.constraint).type]);
+    }
+    return details;
   }
   
   
@@ -83,11 +288,18 @@ namespace Avogadro {
   
   
   
+  //! The entry of solvShape after the SolvationSpec shapes
+  static const int solvAutoShape = 4;
+
   PackmolDialog::PackmolDialog(QWidget* parent, Qt::WindowFlags f)
-    : QDialog(parent, f), m_process(0)
+    : QDialog(parent, f), m_importFollowed(false), m_solvAutoShape(SolvationSpec::Box)
   {
     ui.setupUi(this);
+
     new Highlighter(ui.textEdit->document());
+    m_input.setText(ui.textEdit->toPlainText());
+    connect(ui.textEdit->document(), SIGNAL(contentsChange(int,int,int)), 
+        this, SLOT(inputChanged(int,int,int)));
 
     m_model = new StructuresModel;
     m_model->addDefaultStructures();
@@ -102,11 +314,63 @@ namespace Avogadro {
     ui.bilayerTableView->setColumnWidth(1, 200);
     ui.bilayerTableView->setColumnWidth(2, 100);
 
+    m_outputParser = new PackmolOutputParser(this);
+    connect(m_outputParser, SIGNAL(progressChanged(int)), ui.runProgress, SLOT(setValue(int)));
+    connect(m_outputParser, SIGNAL(phaseChanged(int)), ui.convergencePlot, SLOT(addPhase(int)));
+    connect(m_outputParser, SIGNAL(loopFinished(int,double,double,double)), 
+        ui.convergencePlot, SLOT(addLoop(int,double,double,double)));
+    connect(m_outputParser, SIGNAL(loopStarted(int,int)), this, SLOT(updateProgress()));
+    connect(m_outputParser, SIGNAL(loopFinished(int,double,double,double)), this, SLOT(updateProgress()));
+    connect(m_outputParser, SIGNAL(finished(bool)), this, SLOT(updateProgress()));
+
+    m_jobQueue = new JobQueue(this);
+    m_jobModel = new JobQueueModel(m_jobQueue, this);
+    ui.jobsView->setModel(m_jobModel);
+    ui.jobsView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    ui.jobsView->setSelectionMode(QAbstractItemView::SingleSelection);
+    ui.jobsView->setColumnWidth(0, 250);
+    ui.maxConcurrent->setValue(m_jobQueue->maxConcurrent());
+    connect(m_jobQueue, SIGNAL(jobOutput(PackmolJob*,QByteArray)), 
+        this, SLOT(jobOutput(PackmolJob*,QByteArray)));
+    connect(m_jobQueue, SIGNAL(jobFinished(PackmolJob*)), this, SLOT(jobFinished(PackmolJob*)));
+    m_jobQueue->restoreJobs();
+    connect(ui.maxConcurrent, SIGNAL(valueChanged(int)), m_jobQueue, SLOT(setMaxConcurrent(int)));
+    connect(ui.wallTimeLimit, SIGNAL(valueChanged(int)), this, SLOT(timeLimitsChanged()));
+    connect(ui.cpuTimeLimit, SIGNAL(valueChanged(int)), this, SLOT(timeLimitsChanged()));
+    m_race = new SeedRace(m_jobQueue, this);
+    connect(m_race, SIGNAL(converged(PackmolJob*)), this, SLOT(followJob(PackmolJob*)));
+    connect(m_race, SIGNAL(won(PackmolJob*)), this, SLOT(raceWon(PackmolJob*)));
+    connect(m_race, SIGNAL(lost(PackmolJob*)), this, SLOT(raceLost(PackmolJob*)));
+    m_decomposedRun = new DecomposedRun(m_jobQueue, this);
+    connect(m_decomposedRun, SIGNAL(finished(QString,SeamReport)), 
+        this, SLOT(decomposedFinished(QString,SeamReport)));
+    connect(m_decomposedRun, SIGNAL(failed(QString)), this, SLOT(decomposedFailed(QString)));
+    ui.decomposeParts->setValue(m_jobQueue->maxConcurrent());
+    m_engineRun = new EngineRun(this);
+    connect(m_engineRun, SIGNAL(loopFinished(int,int,double,double,double)), 
+        this, SLOT(engineLoopFinished(int,int,double,double,double)));
+    connect(m_engineRun, SIGNAL(finished(bool,bool)), this, SLOT(engineFinished(bool,bool)));
+    m_preview = new ResultPreview(this);
+    connect(m_preview, SIGNAL(moleculeCreated(Molecule*)), this, SIGNAL(previewReady(Molecule*)));
+
+    // coalesce spin box changes, the estimate itself runs on a worker thread
+    m_solvTimer = new QTimer(this);
+    m_solvTimer->setSingleShot(true);
+    m_solvTimer->setInterval(250);
+    m_solvWatcher = new QFutureWatcher<SolvationEstimate>(this);
+    m_bilayerWatcher = new QFutureWatcher<BilayerSpec>(this);
+    connect(m_bilayerWatcher, SIGNAL(finished()), this, SLOT(bilayerUpdateFinished()));
+    connect(m_solvTimer, SIGNAL(timeout()), this, SLOT(solvStartUpdate()));
+    connect(m_solvWatcher, SIGNAL(finished()), this, SLOT(solvUpdateFinished()));
+
     // Connect up some signals and slots
     connect(ui.solvSoluteBrowse, SIGNAL(clicked()), this, SLOT(solvSoluteBrowseClicked()));
     connect(ui.solvSolventBrowse, SIGNAL(clicked()), this, SLOT(solvSolventBrowseClicked()));
     connect(ui.solvGenerate, SIGNAL(clicked()), this, SLOT(solvGenerateClicked()));
     connect(ui.solvAdjustShape, SIGNAL(stateChanged(int)), this, SLOT(solvAdjustShapeClicked(int)));
+    connect(ui.solvAlignSolute, SIGNAL(stateChanged(int)), this, SLOT(solvScheduleUpdate()));
+    connect(ui.solvShell, SIGNAL(stateChanged(int)), this, SLOT(solvShellClicked(int)));
+    connect(ui.solvShellThickness, SIGNAL(valueChanged(double)), this, SLOT(solvVolumeChanged(double)));
     connect(ui.solvAddCounterIons, SIGNAL(stateChanged(int)), this, SLOT(solvAddCounterIonsClicked(int)));
     connect(ui.solvGuessSolventNumber, SIGNAL(stateChanged(int)), this, SLOT(solvGuessSolventNumberClicked(int)));
     connect(ui.solvSpacing, SIGNAL(valueChanged(double)), this, SLOT(solvVolumeChanged(double)));
@@ -120,6 +384,14 @@ namespace Avogadro {
     connect(ui.solvCenterY, SIGNAL(valueChanged(double)), this, SLOT(solvVolumeChanged(double)));
     connect(ui.solvCenterZ, SIGNAL(valueChanged(double)), this, SLOT(solvVolumeChanged(double)));
     connect(ui.solvRadius, SIGNAL(valueChanged(double)), this, SLOT(solvVolumeChanged(double)));
+    connect(ui.solvSemiAxisX, SIGNAL(valueChanged(double)), this, SLOT(solvVolumeChanged(double)));
+    connect(ui.solvSemiAxisY, SIGNAL(valueChanged(double)), this, SLOT(solvVolumeChanged(double)));
+    connect(ui.solvSemiAxisZ, SIGNAL(valueChanged(double)), this, SLOT(solvVolumeChanged(double)));
+    connect(ui.solvCylinderLength, SIGNAL(valueChanged(double)), this, SLOT(solvVolumeChanged(double)));
+    connect(ui.solvCylinderAxis, SIGNAL(currentIndexChanged(int)), this, SLOT(solvScheduleUpdate()));
+    connect(ui.solvDensity, SIGNAL(valueChanged(double)), this, SLOT(solvVolumeChanged(double)));
+    connect(ui.solvShape, SIGNAL(currentIndexChanged(int)), this, SLOT(solvShapeChanged(int)));
+    solvShowShape(SolvationSpec::Box);
     
     connect(ui.bilayerGenerate, SIGNAL(clicked()), this, SLOT(bilayerGenerateClicked()));
     connect(ui.bilayerGuessNumber, SIGNAL(clicked()), this, SLOT(bilayerUpdateNumber()));
@@ -127,35 +399,56 @@ namespace Avogadro {
     connect(ui.bilayerRemove, SIGNAL(clicked()), this, SLOT(bilayerRemoveClicked()));
     
     connect(ui.runButton, SIGNAL(clicked()), this, SLOT(runButtonClicked()));
+    connect(ui.raceButton, SIGNAL(clicked()), this, SLOT(raceButtonClicked()));
     connect(ui.abortButton, SIGNAL(clicked()), this, SLOT(abortButtonClicked()));
+    connect(ui.openLogButton, SIGNAL(clicked()), this, SLOT(openLogClicked()));
+    connect(ui.livePreview, SIGNAL(toggled(bool)), this, SLOT(livePreviewToggled(bool)));
     connect(ui.visitWebsite, SIGNAL(clicked()), this, SLOT(visitWebsite()));
+
+    connect(ui.queueSweepButton, SIGNAL(clicked()), this, SLOT(queueSweepClicked()));
+    connect(ui.solventBoxBrowse, SIGNAL(clicked()), this, SLOT(solventBoxBrowseClicked()));
+    connect(ui.decomposeButton, SIGNAL(clicked()), this, SLOT(decomposeClicked()));
+    connect(ui.replicateButton, SIGNAL(clicked()), this, SLOT(replicateClicked()));
+    connect(ui.abortJobButton, SIGNAL(clicked()), this, SLOT(abortJobClicked()));
+    connect(ui.importJobButton, SIGNAL(clicked()), this, SLOT(importJobClicked()));
+    connect(ui.resumeJobButton, SIGNAL(clicked()), this, SLOT(resumeJobClicked()));
+    connect(ui.clearJobsButton, SIGNAL(clicked()), this, SLOT(clearJobsClicked()));
+    connect(ui.jobsView, SIGNAL(doubleClicked(QModelIndex)), this, SLOT(jobActivated(QModelIndex)));
   }
 
   PackmolDialog::~PackmolDialog()
   {
+    // the worker refers to m_solvGeneration
+    m_solvGeneration.fetchAndAddOrdered(1);
+    m_solvWatcher->waitForFinished();
+    m_bilayerWatcher->waitForFinished();
   }
 
   void PackmolDialog::solvSoluteBrowseClicked()
   {
     QString fileName = QFileDialog::getOpenFileName(this, tr("Open Molecule"));
     ui.solvSoluteFilename->setText(fileName);
-    solvUpdateVolume();
+    solvScheduleUpdate();
 
     // keep track of files
-    QFileInfo fileInfo(fileName);
-    QString fileNameInInputFile = fileInfo.baseName() + "." + ui.filetype->currentText();
-    m_fileLookup[fileNameInInputFile] = fileName;
+    m_fileLookup[inputFileName(fileName, ui.filetype->currentText())] = fileName;
   }
  
+  void PackmolDialog::solventBoxBrowseClicked()
+  {
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open Solvent Box"));
+    if (!fileName.isEmpty())
+      ui.solventBox->setText(fileName);
+  }
+  
   void PackmolDialog::solvSolventBrowseClicked()
   {
     QString fileName = QFileDialog::getOpenFileName(this, tr("Open Molecule"));
     ui.solvSolventFilename->setText(fileName);
+    solvScheduleUpdate();
     
     // keep track of files
-    QFileInfo fileInfo(fileName);
-    QString fileNameInInputFile = fileInfo.baseName() + "." + ui.filetype->currentText();
-    m_fileLookup[fileNameInInputFile] = fileName;
+    m_fileLookup[inputFileName(fileName, ui.filetype->currentText())] = fileName;
   }
   
   void PackmolDialog::solvAdjustShapeClicked(int state)
@@ -173,6 +466,11 @@ namespace Avogadro {
         ui.solvCenterY->setEnabled(true);
         ui.solvCenterZ->setEnabled(true);
         ui.solvRadius->setEnabled(true);
+        ui.solvSemiAxisX->setEnabled(true);
+        ui.solvSemiAxisY->setEnabled(true);
+        ui.solvSemiAxisZ->setEnabled(true);
+        ui.solvCylinderAxis->setEnabled(true);
+        ui.solvCylinderLength->setEnabled(true);
         ui.solvSpacing->setEnabled(false);
         break;
       case Qt::Checked:
@@ -186,96 +484,155 @@ namespace Avogadro {
         ui.solvCenterY->setEnabled(false);
         ui.solvCenterZ->setEnabled(false);
         ui.solvRadius->setEnabled(false);
+        ui.solvSemiAxisX->setEnabled(false);
+        ui.solvSemiAxisY->setEnabled(false);
+        ui.solvSemiAxisZ->setEnabled(false);
+        ui.solvCylinderAxis->setEnabled(false);
+        ui.solvCylinderLength->setEnabled(false);
         ui.solvSpacing->setEnabled(true);
         break;
     }
 
-    solvUpdateVolume();
+    solvScheduleUpdate();
   }
-  
-  void PackmolDialog::solvUpdateVolume()
-  {
-    if (!ui.solvAdjustShape->isChecked())
-      return;
-
-    QString soluteFilename = ui.solvSoluteFilename->text();
-    if (soluteFilename.length()) {
-      QSharedPointer<Molecule> molecule(MoleculeFile::readMolecule(soluteFilename));
-      if (molecule) {
-        double spacing = ui.solvSpacing->value();
-        
-        // Box
-        double minX, minY, minZ;
-        double maxX, maxY, maxZ;
-        minX = minY = minZ = 1000.0;
-        maxX = maxY = maxZ = -1000.0;
-
-        Eigen::Vector3d center(Eigen::Vector3d::Zero());
-        foreach(Atom *atom, molecule->atoms()) {
-          Eigen::Vector3d pos = *(atom->pos());
-          center += pos;
-          if (pos.x() < minX) minX = pos.x();
-          if (pos.y() < minY) minY = pos.y();
-          if (pos.z() < minZ) minZ = pos.z();
-          if (pos.x() > maxX) maxX = pos.x();
-          if (pos.y() > maxY) maxY = pos.y();
-          if (pos.z() > maxZ) maxZ = pos.z();
-        }       
-        center /= molecule->numAtoms();
     
-        ui.solvMinX->setValue(minX - spacing);
-        ui.solvMinY->setValue(minY - spacing);
-        ui.solvMinZ->setValue(minZ - spacing);
-        ui.solvMaxX->setValue(maxX + spacing);
-        ui.solvMaxY->setValue(maxY + spacing);
-        ui.solvMaxZ->setValue(maxZ + spacing);
-          
-        // Sphere        
-        double maxR = 0.0;
-        foreach(Atom *atom, molecule->atoms()) {
-          double r = (center - *(atom->pos())).norm();
-          if (r > maxR) 
-            maxR = r;
-        }
-
-        ui.solvCenterX->setValue(center.x());
-        ui.solvCenterY->setValue(center.y());
-        ui.solvCenterZ->setValue(center.z());
-        ui.solvRadius->setValue(maxR + spacing);
-      }
+  void PackmolDialog::solvShapeChanged(int index)
+  {
+    if (index == solvAutoShape) {
+      // the shapes are compared after fitting them to the solute
+      ui.solvAdjustShape->setChecked(true);
+      ui.solvAdjustShape->setEnabled(false);
+      solvShowShape(m_solvAutoShape);
+    } else {
+      ui.solvAdjustShape->setEnabled(true);
+      solvShowShape(static_cast<SolvationSpec::Shape>(index));
     }
+
+    solvScheduleUpdate();
   }
-    
-  double PackmolDialog::solvCalcVolume()
-  {
-    if (ui.solvShape->currentIndex() == 0) {
-      // Box
-      double dx = ui.solvMaxX->value() - ui.solvMinX->value();
-      double dy = ui.solvMaxY->value() - ui.solvMinY->value();
-      double dz = ui.solvMaxZ->value() - ui.solvMinZ->value();
-      return dx * dy * dz;
+
+  void PackmolDialog::solvShellClicked(int state)
+  {
+    bool shell = state == Qt::Checked;
+    ui.solvShellThickness->setEnabled(shell);
+    ui.solvShape->setEnabled(!shell);
+    ui.solvAlignSolute->setEnabled(!shell);
+    // the shell is written around one solute only
+    ui.solvSoluteNumber->setEnabled(!shell);
+    if (shell) {
+      ui.solvSoluteNumber->setValue(1);
+      // the shell is fitted to the solute, the sphere around it holds the counter ions
+      ui.solvAdjustShape->setChecked(true);
+      ui.solvAdjustShape->setEnabled(false);
+      solvShowShape(SolvationSpec::Sphere);
+      solvScheduleUpdate();
     } else {
-      // Sphere
-      double r = ui.solvRadius->value();
-      return 4.0 / 3.0 * M_PI * r * r * r;
+      m_solvShellRegions.clear();
+      solvShapeChanged(ui.solvShape->currentIndex());
     }
   }
-    
-  void PackmolDialog::solvVolumeChanged(double value)
+
+  void PackmolDialog::solvShowShape(SolvationSpec::Shape shape)
   {
-    solvUpdateVolume();
-    solvUpdateSoluteNumber();
+    ui.solvStackedWidget->setCurrentIndex(shape == SolvationSpec::Box ? 0 : 1);
+    bool radius = shape == SolvationSpec::Sphere || shape == SolvationSpec::Cylinder;
+    bool ellipsoid = shape == SolvationSpec::Ellipsoid;
+    bool cylinder = shape == SolvationSpec::Cylinder;
+    ui.solvRadiusLabel->setVisible(radius);
+    ui.solvRadius->setVisible(radius);
+    ui.solvSemiAxesLabel->setVisible(ellipsoid);
+    ui.solvSemiAxisX->setVisible(ellipsoid);
+    ui.solvSemiAxisY->setVisible(ellipsoid);
+    ui.solvSemiAxisZ->setVisible(ellipsoid);
+    ui.solvAxisLabel->setVisible(cylinder);
+    ui.solvCylinderAxis->setVisible(cylinder);
+    ui.solvLengthLabel->setVisible(cylinder);
+    ui.solvCylinderLength->setVisible(cylinder);
   }
-    
-  void PackmolDialog::solvUpdateSoluteNumber()
+
+  void PackmolDialog::solvVolumeChanged(double)
+  {
+    solvScheduleUpdate();
+  }
+
+  void PackmolDialog::solvScheduleUpdate()
   {
-    if (!ui.solvGuessSolventNumber->isChecked())
+    // invalidate any estimate still in flight and restart the timer
+    m_solvGeneration.fetchAndAddOrdered(1);
+    m_solvTimer->start();
+  }
+
+  void PackmolDialog::solvStartUpdate()
+  {
+    if (!ui.solvAdjustShape->isChecked() && !ui.solvGuessSolventNumber->isChecked())
       return;
 
-    double volume = solvCalcVolume();
-    int number = calcNumberOfMolecules(ui.solvSolventFilename->text(), ui.solvDensity->value(), volume);
+    SolvationInput input;
+    input.generation = m_solvGeneration.fetchAndAddOrdered(1) + 1;
+    input.spec = solvationSpec();
+    if (input.spec.soluteFileName.length())
+      input.solute = StructureCache::instance()->structure(input.spec.soluteFileName);
+    if (input.spec.solventFileName.length())
+      input.solvent = StructureCache::instance()->structure(input.spec.solventFileName);
+    input.adjustShape = ui.solvAdjustShape->isChecked();
+    input.alignSolute = ui.solvAlignSolute->isChecked();
+    input.autoShape = ui.solvShape->currentIndex() == solvAutoShape;
+    input.shellThickness = ui.solvShell->isChecked() ? ui.solvShellThickness->value() : 0.0;
+    input.guessNumber = ui.solvGuessSolventNumber->isChecked();
+    input.spacing = ui.solvSpacing->value();
+    input.density = ui.solvDensity->value();
+
+    m_solvWatcher->setFuture(QtConcurrent::run(solvEstimate, input, &m_solvGeneration));
+  }
+
+  void PackmolDialog::solvUpdateFinished()
+  {
+    SolvationEstimate estimate = m_solvWatcher->result();
+    if (m_solvGeneration != estimate.generation)
+      return; // stale
+
+    if (estimate.adjusted) {
+      // these are outputs here, don't let them schedule another update
+      QList<QDoubleSpinBox*> spinBoxes;
+      spinBoxes << ui.solvMinX << ui.solvMinY << ui.solvMinZ
+                << ui.solvMaxX << ui.solvMaxY << ui.solvMaxZ
+                << ui.solvCenterX << ui.solvCenterY << ui.solvCenterZ << ui.solvRadius
+                << ui.solvSemiAxisX << ui.solvSemiAxisY << ui.solvSemiAxisZ
+                << ui.solvCylinderLength;
+      foreach (QDoubleSpinBox *spinBox, spinBoxes)
+        spinBox->blockSignals(true);
+      ui.solvCylinderAxis->blockSignals(true);
+
+      ui.solvMinX->setValue(estimate.spec.min.x());
+      ui.solvMinY->setValue(estimate.spec.min.y());
+      ui.solvMinZ->setValue(estimate.spec.min.z());
+      ui.solvMaxX->setValue(estimate.spec.max.x());
+      ui.solvMaxY->setValue(estimate.spec.max.y());
+      ui.solvMaxZ->setValue(estimate.spec.max.z());
+      ui.solvCenterX->setValue(estimate.spec.center.x());
+      ui.solvCenterY->setValue(estimate.spec.center.y());
+      ui.solvCenterZ->setValue(estimate.spec.center.z());
+      ui.solvRadius->setValue(estimate.spec.radius);
+      ui.solvSemiAxisX->setValue(estimate.spec.semiAxes.x());
+      ui.solvSemiAxisY->setValue(estimate.spec.semiAxes.y());
+      ui.solvSemiAxisZ->setValue(estimate.spec.semiAxes.z());
+      ui.solvCylinderAxis->setCurrentIndex(estimate.spec.axis);
+      ui.solvCylinderLength->setValue(estimate.spec.length);
+
+      foreach (QDoubleSpinBox *spinBox, spinBoxes)
+        spinBox->blockSignals(false);
+      ui.solvCylinderAxis->blockSignals(false);
+
+      if (ui.solvShell->isChecked()) {
+        m_solvShellRegions = estimate.spec.shellRegions;
+      } else if (ui.solvShape->currentIndex() == solvAutoShape) {
+        m_solvAutoShape = estimate.spec.shape;
+        solvShowShape(m_solvAutoShape);
+      }
+    }
 
-    ui.solvSolventNumber->setValue(number);  
+    if (estimate.number >= 0)
+      ui.solvSolventNumber->setValue(estimate.number);
   }
 
   void PackmolDialog::solvAddCounterIonsClicked(int state)
@@ -296,43 +653,46 @@ namespace Avogadro {
         break;
     }
   
-    solvUpdateSoluteNumber();
+    solvScheduleUpdate();
   }
 
-  QString PackmolDialog::solvContraintString()
+  PackmolHeader PackmolDialog::header() const
   {
-    QString text;
-    if (ui.solvShape->currentIndex() == 0) {
-      // Box
-      text += "inside box " + QString::number(ui.solvMinX->value(), 'f', 1) + " "
-                            + QString::number(ui.solvMinY->value(), 'f', 1) + " "
-                            + QString::number(ui.solvMinZ->value(), 'f', 1) + " "
-                            + QString::number(ui.solvMaxX->value(), 'f', 1) + " "
-                            + QString::number(ui.solvMaxY->value(), 'f', 1) + " "
-                            + QString::number(ui.solvMaxZ->value(), 'f', 1);
-    } else {
-      // Sphere
-      text += "inside sphere " + QString::number(ui.solvCenterX->value(), 'f', 1) + " "
-                               + QString::number(ui.solvCenterY->value(), 'f', 1) + " "
-                               + QString::number(ui.solvCenterZ->value(), 'f', 1) + " "
-                               + QString::number(ui.solvRadius->value(), 'f', 1);
-    }
-    return text;
+    PackmolHeader header;
+    header.tolerance = ui.tolerance->value();
+    header.fileType = ui.filetype->currentText();
+    header.output = ui.output->text();
+    header.seed = ui.seed->value();
+    header.writeout = ui.writeout->value();
+    header.addBoxSides = ui.addBoxSides->isChecked();
+    header.addAmberTer = ui.addAmberTer->isChecked();
+    return header;
   }
 
-  QString PackmolDialog::headerString()
+  SolvationSpec PackmolDialog::solvationSpec() const
   {
-    QString filetype = ui.filetype->currentText();
-    QString text;
-    text += "tolerance " + QString::number(ui.tolerance->value(), 'f', 1) + "\n";
-    text += "filetype " +  filetype + "\n";
-    text += "output " + ui.output->text() + "\n";
-    if (ui.addBoxSides->isChecked())
-      text += "add_box_sides\n";
-    if (ui.addAmberTer->isChecked())
-      text += "add_amber_ter\n";
-    text += "\n";
-    return text;
+    SolvationSpec spec;
+    int shape = ui.solvShape->currentIndex();
+    spec.shape = shape == solvAutoShape ? m_solvAutoShape : static_cast<SolvationSpec::Shape>(shape);
+    if (ui.solvShell->isChecked()) {
+      spec.shape = SolvationSpec::Sphere;
+      spec.shellRegions = m_solvShellRegions;
+    }
+    spec.min = Eigen::Vector3d(ui.solvMinX->value(), ui.solvMinY->value(), ui.solvMinZ->value());
+    spec.max = Eigen::Vector3d(ui.solvMaxX->value(), ui.solvMaxY->value(), ui.solvMaxZ->value());
+    spec.center = Eigen::Vector3d(ui.solvCenterX->value(), ui.solvCenterY->value(), 
+        ui.solvCenterZ->value());
+    spec.radius = ui.solvRadius->value();
+    spec.semiAxes = Eigen::Vector3d(ui.solvSemiAxisX->value(), ui.solvSemiAxisY->value(),
+        ui.solvSemiAxisZ->value());
+    spec.axis = ui.solvCylinderAxis->currentIndex();
+    spec.length = ui.solvCylinderLength->value();
+    spec.soluteFileName = ui.solvSoluteFilename->text();
+    spec.soluteNumber = ui.solvSoluteNumber->value();
+    spec.addCounterIons = ui.solvAddCounterIons->isChecked();
+    spec.solventFileName = ui.solvSolventFilename->text();
+    spec.solventNumber = ui.solvSolventNumber->value();
+    return spec;
   }
 
   void PackmolDialog::solvGenerateClicked()
@@ -348,66 +708,60 @@ namespace Avogadro {
         return;
     }
 
+    QString input = solvationInput(header(), solvationSpec());
+    if (input.isEmpty())
+      return;
+
     ui.tabWidget->setCurrentIndex(1); // change to text mode
+    ui.textEdit->setPlainText(input);
+  }
 
-    QString filetype = ui.filetype->currentText();
-    QString contraint = solvContraintString();
-    QString text;
-    text += headerString();
-    if (ui.solvSoluteFilename->text().length() > 0) {
-      // solute
-      text += "# solute\n";
-      QFileInfo soluteFileInfo(ui.solvSoluteFilename->text());
-      text += "structure " + soluteFileInfo.baseName() + "." + filetype + "\n";
-      text += "  number " + QString::number(ui.solvSoluteNumber->value()) + "\n";
-      if (ui.solvSoluteNumber->value() == 1)
-        text += "  fixed 0. 0. 0. 0. 0. 0.\n";
-      else
-        text += "  " + contraint + "\n";
-      text += "end structure\n";
-      text += "\n";
-      
-      if (ui.solvAddCounterIons->isChecked()) {
-        // compute solute charge
-        int soluteCharge = 0.0;
-        QSharedPointer<Molecule> molecule(MoleculeFile::readMolecule(ui.solvSoluteFilename->text()));
-        if (molecule) {
-          foreach (Atom *atom, molecule->atoms())
-            soluteCharge += atom->formalCharge();
-        }
-        soluteCharge *= ui.solvSoluteNumber->value();
-        
-        // coutner ions
-        if (soluteCharge) {
-          text += "# counter ions\n";
-          if (soluteCharge < 0) {
-            // add Na ions...
-            text += "structure sodium." + filetype + "\n";
-            text += "  number " + QString::number(-soluteCharge) + "\n";
-            text += "  " + contraint + "\n";
-            text += "end structure\n";
-          } else {
-            // Add Cl ions...
-            text += "structure chlorine." + filetype + "\n";
-            text += "  number " + QString::number(soluteCharge) + "\n";
-            text += "  " + contraint + "\n";
-            text += "end structure\n";
-          }
-          text += "\n";
+  QString PackmolDialog::solvationInput(const PackmolHeader &packmolHeader, SolvationSpec spec)
+  {
+    if (spec.soluteFileName.length() && ui.solvAdjustShape->isChecked()
+        && ui.solvAlignSolute->isChecked() && !ui.solvShell->isChecked()) {
+      // the shape was fitted along the principal axes, rotate the solute to match
+      QSharedPointer<CachedStructure> structure = 
+          StructureCache::instance()->structure(spec.soluteFileName);
+      if (structure && !structure->orientedBox().axes.isIdentity()) {
+        Molecule aligned(*structure->molecule());
+        foreach (Atom *atom, aligned.atoms())
+          atom->setPos(structure->orientedBox().toBoxFrame(*atom->pos()));
+
+        QFileInfo info(spec.soluteFileName);
+        QString tmpdir = QDesktopServices::storageLocation(QDesktopServices::TempLocation);
+        QString fileName = tmpdir + QDir::separator() + info.baseName() + "_aligned."
+            + info.suffix();
+        if (!MoleculeFile::writeMolecule(&aligned, fileName)) {
+          // the shape only fits the rotated solute
+          QMessageBox::warning(this, tr("Align Solute"), 
+              tr("Could not write the aligned solute to %1.").arg(fileName));
+          return QString();
         }
+        spec.soluteFileName = fileName;
+        m_fileLookup[inputFileName(fileName, packmolHeader.fileType)] = fileName;
       }
     }
-    
-    // solvent
-    text += "# solvent\n";
-    QFileInfo solventFileInfo(ui.solvSolventFilename->text());
-    text += "structure " + solventFileInfo.baseName() + "." + filetype + "\n";
-    text += "  number " + QString::number(ui.solvSolventNumber->value()) + "\n";
-    text += "  " + contraint + "\n";
-    text += "end structure\n";
-    text += "\n";
- 
-    ui.textEdit->setText(text);
+
+    if (spec.soluteFileName.length() && spec.addCounterIons) {
+      // compute solute charge
+      QSharedPointer<CachedStructure> structure = 
+          StructureCache::instance()->structure(spec.soluteFileName);
+      if (structure)
+        spec.soluteCharge = structure->totalCharge();
+
+      // the ion structures are written to the temp dir
+      QString tmpdir = QDesktopServices::storageLocation(QDesktopServices::TempLocation);
+      QStringList ions;
+      ions << "sodium" << "chlorine";
+      foreach (const QString &ion, ions) {
+        QString fileName = tmpdir + QDir::separator() + ion + "." + packmolHeader.fileType;
+        if (writeCounterIonFile(ion, packmolHeader.fileType, fileName))
+          m_fileLookup[ion + "." + packmolHeader.fileType] = fileName;
+      }
+    }
+
+    return generateSolvationInput(packmolHeader, spec);
   }
    
   void PackmolDialog::bilayerUpdateNumber()
@@ -416,21 +770,29 @@ namespace Avogadro {
     if (!L)
       return;
     
-    QList<Structure> structures;
-    foreach (Structure structure, m_model->structures()) {
-      double volume;
-      if (structure.type == Structure::Lipid) {
-        volume = ui.bilayerDimX->value() * ui.bilayerDimY->value() * (L + 1.0);
-      } else
-      if (structure.type == Structure::PolarSolvent) {
-        double thickness = 0.5 * (ui.bilayerDimZ->value() - 2.0 * L) + 3.0;
-        volume = ui.bilayerDimX->value() * ui.bilayerDimY->value() * thickness;
-      }
-      structure.number = calcNumberOfMolecules(structure.fileName, structure.density, volume);
-      structures.append(structure);
-    }
+    // the excluded volume of a large solute takes a while
+    BilayerInput input;
+    input.spec = bilayerSpec(L);
+    foreach (const Structure &structure, input.spec.structures)
+      input.structures.append(StructureCache::instance()->structure(structure.fileName));
+    ui.bilayerGuessNumber->setEnabled(false);
+    m_bilayerWatcher->setFuture(QtConcurrent::run(bilayerEstimate, input));
+  }
 
-    m_model->setStructures(structures);  
+  void PackmolDialog::bilayerUpdateFinished()
+  {
+    ui.bilayerGuessNumber->setEnabled(true);
+    BilayerSpec spec = m_bilayerWatcher->result();
+    // only the numbers, the structures may have been edited meanwhile
+    QList<Structure> structures = m_model->structures();
+    for (int i = 0; i < structures.size() && i < spec.structures.size(); ++i) {
+      Structure &structure = structures[i];
+      const Structure &estimated = spec.structures.at(i);
+      if (structure.fileName == estimated.fileName && structure.type == estimated.type
+          && structure.density == estimated.density)
+        structure.number = estimated.number;
+    }
+    m_model->setStructures(structures);
   }
  
   double PackmolDialog::bilayerCalculateL()
@@ -442,18 +804,10 @@ namespace Avogadro {
     foreach (const Structure &structure, m_model->structures()) {
       if (structure.type == Structure::Lipid) {
         foundLipid = true;
-        QFileInfo fileInfo(structure.fileName);
-        m_fileLookup[fileInfo.fileName()] = structure.fileName;
         // find the longest lipid
-        QSharedPointer<Molecule> molecule(MoleculeFile::readMolecule(structure.fileName));
-        if (molecule) {
-          foreach (Atom *a, molecule->atoms())
-            foreach (Atom *b, molecule->atoms()) {
-              double dist = (*(a->pos()) - *(b->pos())).norm();
-              if (dist > L)
-                L = dist;
-            }              
-        }
+        QSharedPointer<CachedStructure> lipid = StructureCache::instance()->structure(structure.fileName);
+        if (lipid && lipid->diameter() > L)
+          L = lipid->diameter();
       }
       if (structure.type == Structure::PolarSolvent)
         foundPolarSolvent = true;
@@ -488,240 +842,817 @@ namespace Avogadro {
     m_model->removeStructure(row);
   }
 
-  void PackmolDialog::bilayerGenerateClicked()
+  BilayerSpec PackmolDialog::bilayerSpec(double lipidLength) const
   {
-    QString filetype = ui.filetype->currentText();
-    QString text;
-    text += headerString();
+    BilayerSpec spec;
+    spec.dimensions = Eigen::Vector3d(ui.bilayerDimX->value(), ui.bilayerDimY->value(),
+        ui.bilayerDimZ->value());
+    spec.lipidLength = lipidLength;
+    spec.structures = m_model->structures();
+    return spec;
+  }
 
+  void PackmolDialog::bilayerGenerateClicked()
+  {
     double L = bilayerCalculateL();
     
     ui.tabWidget->setCurrentIndex(1); // change to text mode
 
-    // lipid polar head with polar solvent overlap
-    double overlap = 3.0;
-    foreach (const Structure &structure, m_model->structures()) {
-      QFileInfo fileInfo(structure.fileName);
-      // zShift: make sure center of bilayer is at coordinates origin...
-      double zShift = - ui.bilayerDimZ->value() / 2.0;
-      double xMin = - ui.bilayerDimX->value() / 2.0;
-      double xMax = ui.bilayerDimX->value() / 2.0;
-      double yMin = - ui.bilayerDimY->value() / 2.0;
-      double yMax = ui.bilayerDimY->value() / 2.0;
-      if (structure.type == Structure::Lipid) {
-        double thickness = 0.5 * (ui.bilayerDimZ->value() - 2.0 * L);
-        text += "structure " + fileInfo.baseName() + "." + filetype + "\n";
-        text += "  number " + QString::number(structure.number) + "\n";
-        text += "  inside box " + QString::number(xMin, 'f', 1) + " "
-                                + QString::number(yMin, 'f', 1) + " "
-                                + QString::number(thickness + zShift, 'f', 1) + " "
-                                + QString::number(xMax, 'f', 1) + " "
-                                + QString::number(yMax, 'f', 1) + " "
-                                + QString::number(thickness + L + 1.0 + zShift, 'f', 1) + "\n";
-        text += "  atoms # list polar head atoms here\n";
-        text += "    below plane 0.0 0.0 1.0 " + QString::number(thickness + overlap + 2.0 + zShift, 'f', 1) + "\n";
-        text += "  end atoms\n";
-        text += "  atoms # list lipophilic tail atoms here\n";
-        text += "    over plane 0.0 0.0 1.0 " + QString::number(thickness + overlap + L - 3.0 + zShift, 'f', 1) + "\n";
-        text += "  end atoms\n";
-        text += "end structure\n";
-        text += "\n";
-        text += "structure " + fileInfo.baseName() + "." + filetype + "\n";
-        text += "  number " + QString::number(structure.number) + "\n";
-        text += "  inside box " + QString::number(xMin, 'f', 1) + " "
-                                + QString::number(yMin, 'f', 1) + " "
-                                + QString::number(ui.bilayerDimZ->value() - thickness - L - 1.0 + zShift, 'f', 1) + " "
-                                + QString::number(xMax, 'f', 1) + " "
-                                + QString::number(yMax, 'f', 1) + " "
-                                + QString::number(ui.bilayerDimZ->value() - thickness + zShift, 'f', 1) + "\n";
-        text += "  atoms # list polar head atoms here\n";
-        text += "    over plane 0.0 0.0 1.0 " + QString::number(ui.bilayerDimZ->value() - 
-            thickness - overlap - 2.0 + zShift, 'f', 1) + "\n";
-        text += "  end atoms\n";
-        text += "  atoms # list lipophilic tail atoms here\n";
-        text += "    below plane 0.0 0.0 1.0 " + QString::number(ui.bilayerDimZ->value() - 
-            thickness - overlap - L + 3.0 + zShift, 'f', 1) + "\n";
-        text += "  end atoms\n";
-        text += "end structure\n";
-        text += "\n";
- 
-      } else
-      if (structure.type == Structure::PolarSolvent) {
-        double thickness = 0.5 * (ui.bilayerDimZ->value() - 2.0 * L) + 3.0;
-        text += "structure " + fileInfo.baseName() + "." + filetype + "\n";
-        text += "  number " + QString::number(structure.number) + "\n";
-        text += "  inside box " + QString::number(xMin, 'f', 1) + " "
-                                + QString::number(yMin, 'f', 1) + " "
-                                + QString::number(zShift, 'f', 1) + " "
-                                + QString::number(xMax, 'f', 1) + " "
-                                + QString::number(yMax, 'f', 1) + " "
-                                + QString::number(thickness + zShift, 'f', 1) + "\n";
-        text += "end structure\n";
-        text += "\n";
-        text += "structure " + fileInfo.baseName() + "." + filetype + "\n";
-        text += "  number " + QString::number(structure.number) + "\n";
-        text += "  inside box " + QString::number(xMin, 'f', 1) + " "
-                                + QString::number(yMin, 'f', 1) + " "
-                                + QString::number(ui.bilayerDimZ->value() - thickness + zShift, 'f', 1) + " "
-                                + QString::number(xMax, 'f', 1) + " "
-                                + QString::number(yMax, 'f', 1) + " "
-                                + QString::number(ui.bilayerDimZ->value() + zShift, 'f', 1) + "\n";
-        text += "end structure\n";
-        text += "\n";
+    // keep track of files
+    PackmolHeader packmolHeader = header();
+    foreach (const Structure &structure, m_model->structures())
+      m_fileLookup[inputFileName(structure.fileName, packmolHeader.fileType)] = structure.fileName;
+
+    ui.textEdit->setPlainText(generateBilayerInput(packmolHeader, bilayerSpec(L)));
+  }
+
+  QString PackmolDialog::stagingDirectory() const
+  {
+    return QDir(m_jobQueue->rootDirectory()).filePath("staging");
+  }
+
+  bool PackmolDialog::locateStructures(const QStringList &files)
+  {
+    foreach (const QString &file, files) {
+      if (!m_fileLookup.contains(file)) {
+        QMessageBox::StandardButton result = QMessageBox::question(this, tr("File not found"), 
+            tr("File %1 not found. Look forit now?").arg(file), QMessageBox::Yes | QMessageBox::No);
+        if (result == QMessageBox::No)
+          return false;
+        QString fileName = QFileDialog::getOpenFileName(this, tr("Open Molecule"));
+        m_fileLookup[file] = fileName;
       }
     }
+    return true;
+  }
+
+  bool PackmolDialog::stageStructures(const QStringList &files, QHash<QString, QString> &staged)
+  {
+    // Make sure we know where all files are
+    if (!locateStructures(files))
+      return false;
 
-    ui.textEdit->setText(text);
+    // Now we know where all files are, copy or convert them once, the
+    // jobs link to the staged files
+    QString directory = stagingDirectory();
+    QDir().mkpath(directory);
+    QHash<QString, QString> referenced;
+    foreach (const QString &file, files)
+      referenced[file] = m_fileLookup.value(file);
+    QStringList failed = m_stager.stage(referenced, directory, ui.filetype->currentText());
+    if (!failed.isEmpty()) {
+      QMessageBox::warning(this, tr("Staging failed"), 
+          tr("Could not convert %1 for packmol.").arg(failed.join(", ")));
+      return false;
+    }
+
+    staged.clear();
+    foreach (const QString &file, files)
+      staged[file] = QDir(directory).filePath(file);
+    return true;
   }
-    
-  void PackmolDialog::createSodiumFile()
+
+  PackmolJob* PackmolDialog::submitJob(const QString &name, const QString &input,
+      const QHash<QString, QString> &staged, const QString &output)
   {
-    bool formatIsPdb = (ui.filetype->currentText() == "pdb") ? true : false;
-    QString tmpdir = QDesktopServices::storageLocation(QDesktopServices::TempLocation);
-    QString fileName = tmpdir + QDir::separator() + "sodium." + ui.filetype->currentText();
-    QFile file(fileName);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
-      return;
-    QTextStream stream(&file);
-    if (formatIsPdb) {
-      stream << "HETATM    1 NA   LIG     1       0.000   0.000   0.000  1.00  0.00          Na  ";
-    } else {
-      // xyz
-      stream << "1\n";
-      stream << "sodium.xyz\n";
-      stream << "Na         0.00000        0.00000        0.00000";
+    m_jobQueue->setExecutable(ui.packmolExecutable->text());
+    PackmolJob *job = m_jobQueue->createJob(name, output.isEmpty() ? ui.output->text() : output);
+    if (!job) {
+      QMessageBox::warning(this, tr("Packmol"), tr("Could not create a job directory in %1.")
+          .arg(m_jobQueue->rootDirectory()));
+      return 0;
     }
-    file.close();
+
+    // the staged files are already in the right format, so they are linked
+    QStringList failed = m_stager.stage(staged, job->workingDirectory(), ui.filetype->currentText());
+    QString jobInput = input;
+    if (ui.checkpoints->isChecked())
+      jobInput = setGlobalKeyword(jobInput, "restart_to", QFileInfo(job->restartFileName()).fileName());
+    if (!failed.isEmpty() || !m_jobQueue->enqueue(job, jobInput)) {
+      QMessageBox::warning(this, tr("Packmol"), tr("Could not prepare %1.")
+          .arg(job->workingDirectory()));
+      delete job;
+      return 0;
+    }
+    return job;
   }
-   
-  void PackmolDialog::createChlorineFile()
+
+  void PackmolDialog::inputChanged(int position, int charsRemoved, int charsAdded)
   {
-    bool formatIsPdb = (ui.filetype->currentText() == "pdb") ? true : false;
-    QString tmpdir = QDesktopServices::storageLocation(QDesktopServices::TempLocation);
-    QString fileName = tmpdir + QDir::separator() + "chlorine." + ui.filetype->currentText();
-    QFile file(fileName);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
-      return;
-    QTextStream stream(&file);
-    if (formatIsPdb) {
-      stream << "HETATM    1 CL   LIG     1       0.000   0.000   0.000  1.00  0.00          Cl  ";
-    } else {
-      // xyz
-      stream << "1\n";
-      stream << "chlorine.xyz\n";
-      stream << "Cl         0.00000        0.00000        0.00000";
+    Q_UNUSED(charsRemoved);
+    // the blocks that hold the new text replace as many lines as the
+    // document grew less
+    QTextDocument *document = ui.textEdit->document();
+    QTextBlock first = document->findBlock(position);
+    QTextBlock last = document->findBlock(position + charsAdded);
+    if (!first.isValid())
+      first = document->lastBlock();
+    if (!last.isValid())
+      last = document->lastBlock();
+    QStringList lines;
+    for (QTextBlock block = first; block.isValid(); block = block.next()) {
+      lines.append(block.text());
+      if (block == last)
+        break;
     }
-    file.close();
+    int removed = lines.size() - (document->blockCount() - m_input.numLines());
+    if (removed < 0 || first.blockNumber() + removed > m_input.numLines())
+      m_input.setText(ui.textEdit->toPlainText()); // should not happen
+    else
+      m_input.replaceLines(first.blockNumber(), removed, lines);
+  }
+
+  bool PackmolDialog::checkInput(const PackmolInputDocument &document)
+  {
+    if (document.errors().isEmpty())
+      return true;
+    QStringList messages;
+    foreach (const InputError &error, document.errors())
+      messages.append(tr("line %1: %2").arg(error.line + 1).arg(error.message));
+    QMessageBox box(QMessageBox::Warning, tr("Packmol"), 
+        tr("The input has %n problem(s), packmol will probably reject it. Run anyway?", 
+          0, messages.size()), QMessageBox::Yes | QMessageBox::No, this);
+    box.setDetailedText(messages.join("\n"));
+    return box.exec() == QMessageBox::Yes;
   }
 
   void PackmolDialog::runButtonClicked()
   {
-    /*
-    if (m_process) {
-      m_process->deleteLater();
-      ui.tabWidget->setCurrentIndex(2); // change to output mode
+    if (ui.backend->currentIndex() == 1) {
+      runEngine();
       return;
     }
-    */
-    QString program = "/usr/local/bin/packmol"; // FIXME: should be option
-    
+    if (!checkInput(m_input))
+      return;
+
+    QHash<QString, QString> staged;
+    if (!stageStructures(m_input.structureFiles(), staged))
+      return;
+
+    PackmolJob *job = submitJob(tr("Single run"), m_input.text(), staged);
+    if (!job)
+      return;
+
+    followJob(job);
+    m_importFollowed = true;
+    ui.tabWidget->setCurrentIndex(2); // change to output mode
+  }
+
+  void PackmolDialog::runEngine()
+  {
+    PackingProblem problem;
+    QString error;
+    if (!parsePackingInput(m_input, problem, &error)) {
+      QMessageBox::warning(this, tr("Built-in Engine"), 
+          tr("The built-in engine does not support %1.\nUse the packmol executable for this input.")
+          .arg(error));
+      return;
+    }
+
+    QStringList files;
+    foreach (const PackingStructure &structure, problem.structures)
+      files.append(structure.fileName);
+    if (!locateStructures(files))
+      return;
+
+    // coordinates and topology straight from the cache, nothing is written to disk
+    for (int i = 0; i < problem.structures.size(); ++i) {
+      PackingStructure &structure = problem.structures[i];
+      QString fileName = m_fileLookup.value(structure.fileName);
+      QSharedPointer<CachedStructure> cached = StructureCache::instance()->structure(fileName);
+      if (!cached) {
+        QMessageBox::warning(this, tr("Built-in Engine"), tr("Could not read %1.").arg(fileName));
+        return;
+      }
+      setTemplate(structure, *cached);
+    }
+
+    // solvent copied from an equilibrated box is not packed again
+    int tiled = 0;
+    if (!ui.solventBox->text().isEmpty()) {
+      QSharedPointer<CachedStructure> cached = 
+          StructureCache::instance()->structure(ui.solventBox->text());
+      if (!cached) {
+        QMessageBox::warning(this, tr("Built-in Engine"), 
+            tr("Could not read %1.").arg(ui.solventBox->text()));
+        return;
+      }
+      SolventBox box;
+      box.positions = cached->positions();
+      box.atomicNumbers = cached->atomicNumbers();
+      box.period = unitCellPeriod(*cached);
+      if (tileSolvent(problem, box)) {
+        foreach (const PackingStructure &structure, problem.structures)
+          tiled += structure.tiled;
+      } else {
+        QMessageBox::information(this, tr("Built-in Engine"), 
+            tr("No structure of the input is made of the molecules in the solvent box, "
+               "all of them will be packed."));
+      }
+    }
+
+    followJob(0);
     ui.runButton->setEnabled(false);
+    ui.raceButton->setEnabled(false);
     ui.abortButton->setEnabled(true);
+    if (tiled)
+      ui.runStatus->setText(tr("%n solvent molecule(s) copied from the solvent box, packing the rest...",
+            0, tiled));
+    else
+      ui.runStatus->setText(tr("Building initial approximation..."));
+    ui.tabWidget->setCurrentIndex(2); // change to output mode
+    m_engineRun->start(problem);
+  }
 
-    QString tmpdir = QDesktopServices::storageLocation(QDesktopServices::TempLocation);
+  void PackmolDialog::engineLoopFinished(int loop, int maxLoops, double functionValue,
+      double maxDistanceViolation, double maxConstraintViolation)
+  {
+    ui.convergencePlot->addLoop(loop, functionValue, maxDistanceViolation, maxConstraintViolation);
+    ui.runProgress->setValue(100 * loop / qMax(1, maxLoops));
+    ui.runStatus->setText(tr("Packing all types, loop %1 of %2, f = %3, distance violation = %4, "
+          "constraint violation = %5").arg(loop).arg(maxLoops).arg(functionValue, 0, 'g', 4)
+        .arg(maxDistanceViolation, 0, 'g', 3).arg(maxConstraintViolation, 0, 'g', 3));
+  }
 
-    // Write the input file
-    QFile inputFile(tmpdir + QDir::separator() + "input.inp");
-    if (!inputFile.open(QIODevice::WriteOnly | QIODevice::Text))
+  void PackmolDialog::engineFinished(bool converged, bool aborted)
+  {
+    ui.runButton->setEnabled(true);
+    ui.raceButton->setEnabled(true);
+    ui.abortButton->setEnabled(false);
+    if (aborted) {
+      ui.runStatus->setText(tr("Aborted"));
       return;
-    QTextStream stream(&inputFile);
-    stream << ui.textEdit->toPlainText().toAscii();
-    inputFile.close();
+    }
 
-    // Make sure we know where all files are
-    QStringList files;
-    QStringList lines = ui.textEdit->toPlainText().split("\n");
-    foreach (const QString &line, lines) {
-      if (line.contains("end"))
-        continue;
-      if (!line.contains("structure"))
-        continue;
+    ui.runProgress->setValue(100);
+    ui.runStatus->setText(converged ? tr("Converged") : tr("Ended without perfect packing"));
 
-      QStringList tokens = line.split(QRegExp("\\s+"));
-      if (tokens.length() != 2)
-        continue;
+    // the templates are already in the problem
+    ResultImport import;
+    import.problem = m_engineRun->problem();
+    untileSolvent(import.problem); // the atoms of a solvent block are its molecules in order
+    import.data.positions = m_engineRun->result().positions;
+    startImport(import);
+  }
 
-      files.append(tokens[1]);
+  void PackmolDialog::raceButtonClicked()
+  {
+    if (!checkInput(m_input))
+      return;
+    QHash<QString, QString> staged;
+    if (!stageStructures(m_input.structureFiles(), staged))
+      return;
+
+    // consecutive seeds starting at the configured one (or packmol's default)
+    int baseSeed = ui.seed->value() ? ui.seed->value() : 1234567;
+    QList<PackmolJob*> jobs;
+    for (int i = 0; i < ui.raceSeeds->value(); ++i) {
+      int seed = baseSeed + i;
+      PackmolInputDocument input(m_input);
+      input.setGlobalKeyword("seed", QString::number(seed));
+      PackmolJob *job = submitJob(tr("Race, seed %1").arg(seed), input.text(), staged);
+      if (!job)
+        break;
+      jobs.append(job);
     }
+    if (jobs.isEmpty())
+      return;
 
-    foreach (const QString &file, files) {
-      if (!m_fileLookup.contains(file)) {
-        QMessageBox::StandardButton result = QMessageBox::question(this, tr("File not found"), 
-            tr("File %1 not found. Look forit now?").arg(file), QMessageBox::Yes | QMessageBox::No);
-        if (result == QMessageBox::No)
-          return;
-        QString fileName = QFileDialog::getOpenFileName(this, tr("Open Molecule"));
-        m_fileLookup[file] = fileName;
+    m_race->start(jobs);
+    followJob(jobs.first());
+    ui.tabWidget->setCurrentIndex(2); // change to output mode
+  }
+
+  void PackmolDialog::raceWon(PackmolJob *job)
+  {
+    followJob(job); // the race is over, this updates the buttons
+    importResult(job);
+  }
+
+  void PackmolDialog::raceLost(PackmolJob *best)
+  {
+    ui.runButton->setEnabled(true);
+    ui.raceButton->setEnabled(true);
+    ui.abortButton->setEnabled(false);
+    if (!best) {
+      QMessageBox::information(this, tr("Seed Race"), tr("None of the seeds produced a result."));
+      return;
+    }
+
+    followJob(best);
+    QMessageBox::StandardButton result = QMessageBox::question(this, tr("Seed Race"), 
+        tr("None of the seeds converged. Import the best result (%1)?").arg(best->name()),
+        QMessageBox::Yes | QMessageBox::No);
+    if (result == QMessageBox::Yes)
+      importResult(best);
+  }
+
+  void PackmolDialog::queueSweepClicked()
+  {
+    SweepSpec sweep;
+    bool ok1, ok2, ok3, ok4;
+    sweep.seeds = parseIntList(ui.sweepSeeds->text(), &ok1);
+    sweep.tolerances = parseDoubleList(ui.sweepTolerances->text(), &ok2);
+    sweep.solventNumbers = parseIntList(ui.sweepSolventNumbers->text(), &ok3);
+    sweep.boxScales = parseDoubleList(ui.sweepBoxScales->text(), &ok4);
+    if (!ok1 || !ok2 || !ok3 || !ok4) {
+      QMessageBox::information(this, tr("Parameter Sweep"), 
+          tr("Use comma separated values, seeds may also be ranges (e.g. 1-8)."));
+      return;
+    }
+    foreach (int number, sweep.solventNumbers)
+      if (number < 1) {
+        QMessageBox::information(this, tr("Parameter Sweep"), 
+            tr("Solvent numbers must be positive."));
+        return;
+      }
+
+    // solvent numbers and box sizes only exist in the solvation wizard
+    bool regenerate = !sweep.solventNumbers.isEmpty() || !sweep.boxScales.isEmpty();
+    if (regenerate && ui.solvSolventFilename->text().isEmpty()) {
+      QMessageBox::information(this, tr("Parameter Sweep"), 
+          tr("Sweeping solvent numbers or box sizes requires a solvent in the solvation wizard."));
+      return;
+    }
+
+    PackmolHeader packmolHeader = header();
+    PackmolInputDocument baseInput = m_input;
+    if (regenerate) {
+      QString text = solvationInput(packmolHeader, solvationSpec());
+      if (text.isEmpty())
+        return;
+      baseInput.setText(text);
+    }
+    if (!checkInput(baseInput))
+      return;
+    QHash<QString, QString> staged;
+    if (!stageStructures(baseInput.structureFiles(), staged))
+      return;
+
+    QList<SweepPoint> points = expandSweep(sweep);
+    foreach (const SweepPoint &point, points) {
+      PackmolInputDocument input = baseInput;
+      if (regenerate) {
+        SolvationSpec spec = solvationSpec();
+        if (point.boxScale > 0.0)
+          spec.scale(point.boxScale);
+        if (point.solventNumber)
+          spec.solventNumber = point.solventNumber;
+        QString text = solvationInput(packmolHeader, spec);
+        if (text.isEmpty())
+          break;
+        input.setText(text);
+      }
+      if (point.seed)
+        input.setGlobalKeyword("seed", QString::number(point.seed));
+      if (point.tolerance > 0.0)
+        input.setGlobalKeyword("tolerance", QString::number(point.tolerance));
+
+      QString name = point.name.isEmpty() ? tr("Sweep") : point.name;
+      if (!submitJob(name, input.text(), staged))
+        break;
+    }
+  }
+
+  void PackmolDialog::decomposeClicked()
+  {
+    SolvationSpec spec = solvationSpec();
+    if (spec.shape != SolvationSpec::Box || !spec.soluteFileName.isEmpty() 
+        || spec.solventFileName.isEmpty()) {
+      QMessageBox::information(this, tr("Domain Decomposition"), 
+          tr("Domain decomposition works on a box of solvent without solute, "
+             "set one up in the solvation wizard."));
+      return;
+    }
+
+    // the gap keeps molecules in neighboring slabs one tolerance apart,
+    // every slab has room for a solvent molecule
+    PackmolHeader packmolHeader = header();
+    QSharedPointer<CachedStructure> solvent = 
+        StructureCache::instance()->structure(spec.solventFileName);
+    Decomposition decomposition = decomposeSolvation(spec, ui.decomposeParts->value(), 
+        packmolHeader.tolerance, solvent ? solvent->diameter() : 0.0);
+    if (decomposition.parts.size() < 2) {
+      QMessageBox::information(this, tr("Domain Decomposition"), 
+          tr("The box is too small to split in slabs that hold a solvent molecule."));
+      return;
+    }
+    if (decomposition.parts.size() < ui.decomposeParts->value())
+      ui.decomposeParts->setValue(decomposition.parts.size());
+
+    QHash<QString, QString> staged;
+    PackmolInputDocument firstPart(generateSolvationInput(packmolHeader, decomposition.parts.first()));
+    if (!stageStructures(firstPart.structureFiles(), staged))
+      return;
+
+    // identical slabs with the same seed would be identical packings
+    int baseSeed = packmolHeader.seed ? packmolHeader.seed : 1234567;
+    QList<PackmolJob*> jobs;
+    for (int i = 0; i < decomposition.parts.size(); ++i) {
+      packmolHeader.seed = baseSeed + i;
+      PackmolJob *job = submitJob(tr("Slab %1 of %2").arg(i + 1).arg(decomposition.parts.size()),
+          generateSolvationInput(packmolHeader, decomposition.parts.at(i)), staged);
+      if (!job) {
+        foreach (PackmolJob *submitted, jobs)
+          m_jobQueue->abort(submitted);
+        return;
       }
+      jobs.append(job);
     }
 
-    // Now we know where all files are, move/convert them to the temp location
-    foreach (const QString &shortFileName, m_fileLookup.keys()) {
-      QString fullFileName = m_fileLookup.value(shortFileName);
-      QFileInfo fileInfo(fullFileName);
+    QString output = QDir(m_jobQueue->rootDirectory()).filePath(
+        QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") + "-stitched." + packmolHeader.fileType);
+    m_decomposedRun->start(jobs, decomposition, packmolHeader.fileType, 
+        packmolHeader.tolerance, output);
+    ui.decomposeButton->setEnabled(false);
+    ui.replicateButton->setEnabled(false);
+  }
 
-      QString tmpFile = tmpdir + QDir::separator() + fileInfo.baseName() + "." + ui.filetype->currentText();
+  void PackmolDialog::replicateClicked()
+  {
+    SolvationSpec spec = solvationSpec();
+    if (spec.shape != SolvationSpec::Box || !spec.soluteFileName.isEmpty() 
+        || spec.solventFileName.isEmpty()) {
+      QMessageBox::information(this, tr("Unit Cell Replication"), 
+          tr("Unit cell replication works on a box of solvent without solute, "
+             "set one up in the solvation wizard."));
+      return;
+    }
+
+    // only the cell is packed, its faces keep the copies one tolerance apart
+    PackmolHeader packmolHeader = header();
+    Replication replication = replicateSolvation(spec, ui.replicateCellSize->value(), 
+        packmolHeader.tolerance);
+
+    QHash<QString, QString> staged;
+    QString cellInput = generateSolvationInput(packmolHeader, replication.cell);
+    if (!stageStructures(PackmolInputDocument(cellInput).structureFiles(), staged))
+      return;
+    PackmolJob *job = submitJob(tr("Cell of %1 x %2 x %3").arg(replication.copies[0])
+        .arg(replication.copies[1]).arg(replication.copies[2]), cellInput, staged);
+    if (!job)
+      return;
+
+    QString output = QDir(m_jobQueue->rootDirectory()).filePath(
+        QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") + "-replicated." + packmolHeader.fileType);
+    m_decomposedRun->start(job, replication, packmolHeader.fileType, 
+        packmolHeader.tolerance, output);
+    ui.decomposeButton->setEnabled(false);
+    ui.replicateButton->setEnabled(false);
+  }
+
+  QString PackmolDialog::decomposedRunTitle() const
+  {
+    return m_decomposedRun->isReplicating() ? tr("Unit Cell Replication") 
+        : tr("Domain Decomposition");
+  }
 
-      QSharedPointer<Molecule> molecule(MoleculeFile::readMolecule(fullFileName));
-      if (!molecule)
+  void PackmolDialog::decomposedFinished(const QString &fileName, const SeamReport &report)
+  {
+    ui.decomposeButton->setEnabled(true);
+    ui.replicateButton->setEnabled(true);
+    if (report.numViolations) {
+      QMessageBox::StandardButton result = QMessageBox::question(this, decomposedRunTitle(), 
+          tr("%1 atom pairs across the seams are closer than the tolerance "
+             "(closest %2 A near %3, %4, %5). Import the result anyway?")
+          .arg(report.numViolations).arg(report.minDistance, 0, 'f', 2)
+          .arg(report.worst.x(), 0, 'f', 1).arg(report.worst.y(), 0, 'f', 1)
+          .arg(report.worst.z(), 0, 'f', 1), QMessageBox::Yes | QMessageBox::No);
+      if (result == QMessageBox::No)
         return;
-      MoleculeFile::writeMolecule(molecule.data(), tmpFile);
     }
 
-    // Create & setup the process
-    m_process = new QProcess(this);
-    connect(m_process, SIGNAL(finished(int,QProcess::ExitStatus)), 
-        this, SLOT(processFinished(int,QProcess::ExitStatus)));
-    connect(m_process, SIGNAL(readyReadStandardOutput()), this, SLOT(updateStandardOutput()));
-    m_process->setStandardInputFile(tmpdir + QDir::separator() + "input.inp");
-    m_process->setWorkingDirectory(tmpdir);
-    m_process->start(program);
+    importFile(fileName);
+  }
+
+  void PackmolDialog::decomposedFailed(const QString &message)
+  {
+    ui.decomposeButton->setEnabled(true);
+    ui.replicateButton->setEnabled(true);
+    QMessageBox::warning(this, decomposedRunTitle(), message);
+  }
+
+  void PackmolDialog::followJob(PackmolJob *job)
+  {
+    m_followedJob = job;
+    m_importFollowed = false;
+    livePreviewToggled(ui.livePreview->isChecked());
+
+    ui.outputEdit->clear();
+    m_outputParser->reset();
+    ui.convergencePlot->clear();
+    ui.runProgress->setValue(0);
+    ui.runStatus->setText(tr("Starting..."));
+    ui.openLogButton->setEnabled(job != 0);
+    bool active = job && (job->status() == PackmolJob::Queued || job->status() == PackmolJob::Running);
+    active = active || m_race->isRunning();
+    ui.abortButton->setEnabled(active);
+    ui.runButton->setEnabled(!active);
+    ui.raceButton->setEnabled(!active);
+    if (!job)
+      return;
 
+    // catch up with what the job wrote so far, the console only shows the tail
+    job->flushLog();
+    QFile log(job->logFileName());
+    if (log.open(QIODevice::ReadOnly)) {
+      QByteArray data = log.readAll();
+      m_outputParser->addData(data);
+      appendOutput(data.right(65536));
+    }
+    if (job->status() != PackmolJob::Running && job->status() != PackmolJob::Finished)
+      ui.runStatus->setText(job->statusString());
+  }
+
+  void PackmolDialog::livePreviewToggled(bool checked)
+  {
+    m_preview->stop();
+    PackmolJob *job = m_followedJob;
+    if (!checked || !job)
+      return;
+    if (job->status() != PackmolJob::Queued && job->status() != PackmolJob::Running)
+      return;
+    QString fileType = resultFileType(job->resultFileName());
+    if (!fileType.isEmpty())
+      m_preview->start(job->resultFileName(), fileType, expectedAtoms(*job));
+  }
+
+  void PackmolDialog::jobActivated(const QModelIndex &index)
+  {
+    followJob(m_jobModel->job(index));
     ui.tabWidget->setCurrentIndex(2); // change to output mode
-    ui.outputEdit->append(tr("Running...\n"));
+  }
+
+  void PackmolDialog::jobOutput(PackmolJob *job, const QByteArray &data)
+  {
+    if (job != m_followedJob)
+      return;
+    m_outputParser->addData(data);
+    appendOutput(data);
+  }
+
+  void PackmolDialog::jobFinished(PackmolJob *job)
+  {
+    if (job == m_followedJob)
+      m_preview->stop();
+    if (job != m_followedJob || m_race->isRunning())
+      return;
+
+    ui.runButton->setEnabled(true);
+    ui.raceButton->setEnabled(true);
+    ui.abortButton->setEnabled(false);
+    if (job->status() != PackmolJob::Finished)
+      ui.runStatus->setText(job->statusString());
+
+    if (m_importFollowed && job->status() == PackmolJob::Finished)
+      importResult(job);
+    m_importFollowed = false;
+  }
+
+  void PackmolDialog::importResult(PackmolJob *job)
+  {
+    ResultImport import;
+    QFile input(job->inputFileName());
+    QString error;
+    if (!input.open(QIODevice::ReadOnly | QIODevice::Text)
+        || !parsePackingInput(QString(input.readAll()), import.problem, &error)
+        || !resultFileType(job->resultFileName()).length()) {
+      // no templates to rebuild the result from
+      if (!error.isEmpty())
+        ui.runStatus->setText(tr("Imported without checking the result, %1 is not supported")
+            .arg(error));
+      importFile(job->resultFileName());
+      return;
+    }
+
+    import.directory = job->workingDirectory();
+    import.fileName = job->resultFileName();
+    startImport(import);
+  }
+
+  void PackmolDialog::importFile(const QString &fileName)
+  {
+    // packmol's tinker and moldy results still go through OpenBabel
+    QString fileType = resultFileType(fileName);
+    if (fileType.isEmpty()) {
+      Molecule *molecule = MoleculeFile::readMolecule(fileName);
+      if (molecule)
+        emit resultReady(molecule); 
+      else
+        QMessageBox::warning(this, tr("Packmol"), tr("Could not read %1.").arg(fileName));
+      return;
+    }
+
+    ResultData data;
+    QString error;
+    if (!readResult(fileName, fileType, data, true, &error)) {
+      QMessageBox::warning(this, tr("Packmol"), tr("Could not read %1.\n%2").arg(fileName)
+          .arg(error));
+      return;
+    }
+    emit resultReady(resultMolecule(data));
+  }
+
+  QString PackmolDialog::resultFileType(const QString &fileName) const
+  {
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    if (suffix == "pdb" || suffix == "xyz")
+      return suffix;
+    if (suffix.isEmpty())
+      return ui.filetype->currentText();
+    return QString();
+  }
+
+  void PackmolDialog::startImport(ResultImport &import)
+  {
+    import.validate = ui.validateResult->isChecked();
+    import.periodic = ui.validatePeriodic->isChecked();
+    if (!import.directory.isEmpty()) {
+      // the structures are read here, OpenBabel can't run on the worker
+      for (int i = 0; i < import.problem.structures.size(); ++i) {
+        PackingStructure &structure = import.problem.structures[i];
+        QSharedPointer<CachedStructure> cached = StructureCache::instance()->structure(
+            QDir(import.directory).filePath(structure.fileName));
+        if (cached)
+          setTemplate(structure, *cached);
+      }
+    }
+    QFutureWatcher<ResultImport> *watcher = new QFutureWatcher<ResultImport>(this);
+    connect(watcher, SIGNAL(finished()), this, SLOT(importFinished()));
+    watcher->setFuture(QtConcurrent::run(loadResult, import));
+  }
+
+  void PackmolDialog::importFinished()
+  {
+    QFutureWatcher<ResultImport> *watcher = static_cast<QFutureWatcher<ResultImport>*>(sender());
+    watcher->deleteLater();
+    ResultImport import = watcher->result();
+    if (!import.data.numAtoms()) {
+      QMessageBox::warning(this, tr("Packmol"), tr("Could not read %1.\n%2")
+          .arg(import.fileName).arg(import.report.error));
+      return;
+    }
+
+    const ValidationReport &report = import.report;
+    if (import.validate && !report.ok()) {
+      QMessageBox box(QMessageBox::Question, tr("Packmol"), QString(), 
+          QMessageBox::Yes | QMessageBox::No, this);
+      if (!report.valid) {
+        box.setText(tr("The result could not be validated: %1.\nImport it anyway?")
+            .arg(report.error));
+      } else {
+        box.setText(tr("%1 atom pairs are closer than the tolerance (closest %2 A) and "
+              "%3 atoms are outside their region (up to %4 A). Import the result anyway?")
+            .arg(report.numDistanceViolations).arg(qMax(0.0, report.minDistance), 0, 'f', 2)
+            .arg(report.numConstraintViolations).arg(report.maxConstraintViolation, 0, 'f', 2));
+        box.setDetailedText(validationDetails(import));
+      }
+      if (box.exec() != QMessageBox::Yes)
+        return;
+    }
+
+    emit resultReady(resultMolecule(import.data));
   }
   
   void PackmolDialog::abortButtonClicked()
   {
-    m_process->deleteLater();
-    m_process = 0;
-    ui.outputEdit->append(tr("Aborting...\n"));
+    if (m_engineRun->isRunning()) {
+      m_engineRun->abort();
+      return;
+    }
+    if (m_race->isRunning()) {
+      m_race->abort();
+      ui.runButton->setEnabled(true);
+      ui.raceButton->setEnabled(true);
+      ui.abortButton->setEnabled(false);
+    }
+    m_jobQueue->abort(m_followedJob);
   }
-  
-  void PackmolDialog::updateStandardOutput()
+
+  void PackmolDialog::timeLimitsChanged()
   {
-    ui.outputEdit->append(m_process->read(10000));
+    m_jobQueue->setWallTimeLimit(60 * ui.wallTimeLimit->value());
+    m_jobQueue->setCpuTimeLimit(60 * ui.cpuTimeLimit->value());
   }
-  
-  void PackmolDialog::processFinished(int exitCode, QProcess::ExitStatus exitStatus)
+
+  void PackmolDialog::abortJobClicked()
   {
-    ui.runButton->setEnabled(true);
-    ui.abortButton->setEnabled(false);
- 
-    if (!m_process)
+    m_jobQueue->abort(m_jobModel->job(ui.jobsView->currentIndex()));
+  }
+
+  void PackmolDialog::importJobClicked()
+  {
+    PackmolJob *job = m_jobModel->job(ui.jobsView->currentIndex());
+    if (!job)
       return;
-   
-    QString tmpdir = QDesktopServices::storageLocation(QDesktopServices::TempLocation);
-    QString resultFileName = tmpdir + QDir::separator() + ui.output->text();
+    if (!QFile::exists(job->resultFileName())) {
+      QMessageBox::information(this, tr("Packmol"), tr("This job has no result (yet)."));
+      return;
+    }
+    importResult(job);
+  }
 
-    Molecule *molecule = MoleculeFile::readMolecule(resultFileName);
-    if (molecule)
-      emit resultReady(molecule); 
-      
-    m_process->deleteLater();
-    m_process = 0;
+  void PackmolDialog::resumeJobClicked()
+  {
+    PackmolJob *job = m_jobModel->job(ui.jobsView->currentIndex());
+    if (!job || job->status() == PackmolJob::Queued || job->status() == PackmolJob::Running)
+      return;
+    if (!job->hasCheckpoint()) {
+      QMessageBox::information(this, tr("Packmol"), tr("This job has no checkpoint to resume "
+            "from. Enable restart checkpoints in the settings (packmol 16 or later)."));
+      return;
+    }
+    QFile inputFile(job->inputFileName());
+    if (!inputFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+      QMessageBox::warning(this, tr("Packmol"), tr("Could not read %1.").arg(job->inputFileName()));
+      return;
+    }
+
+    // same input and structures, starting from the checkpoint; job directories
+    // are siblings, a relative path keeps spaces in the root out of the input
+    PackmolInputDocument input(QString(inputFile.readAll()));
+    input.setGlobalKeyword("restart_from", "../" + QFileInfo(job->workingDirectory()).fileName() 
+        + "/" + QFileInfo(job->restartFileName()).fileName());
+    QHash<QString, QString> staged;
+    foreach (const QString &file, input.structureFiles())
+      staged[file] = QDir(job->workingDirectory()).filePath(file);
+
+    QString name = job->name();
+    if (!name.endsWith(tr(" (resumed)")))
+      name += tr(" (resumed)");
+    PackmolJob *resumed = submitJob(name, input.text(), staged, job->output());
+    if (!resumed)
+      return;
+    followJob(resumed);
+    m_importFollowed = true;
+    ui.tabWidget->setCurrentIndex(2); // change to output mode
   }
 
+  void PackmolDialog::clearJobsClicked()
+  {
+    int finished = 0;
+    foreach (PackmolJob *job, m_jobQueue->jobs())
+      if (job->status() != PackmolJob::Queued && job->status() != PackmolJob::Running)
+        ++finished;
+    if (!finished)
+      return;
+
+    // results of big runs take a lot of space, but can't be recovered
+    QMessageBox::StandardButton result = QMessageBox::question(this, tr("Clear Finished"),
+        tr("Also delete the files of the %1 finished job(s)? Their results and logs "
+           "can't be imported or resumed afterwards.").arg(finished),
+        QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel, QMessageBox::No);
+    if (result == QMessageBox::Cancel)
+      return;
+    m_jobQueue->removeFinished(result == QMessageBox::Yes);
+  }
+
+  void PackmolDialog::appendOutput(const QByteArray &data)
+  {
+    // the console drops old blocks by itself (maximumBlockCount)
+    QScrollBar *scrollBar = ui.outputEdit->verticalScrollBar();
+    bool atBottom = scrollBar->value() == scrollBar->maximum();
+    QTextCursor cursor(ui.outputEdit->document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(QString::fromLocal8Bit(data));
+    if (atBottom)
+      scrollBar->setValue(scrollBar->maximum());
+  }
+
+  void PackmolDialog::openLogClicked()
+  {
+    if (!m_followedJob)
+      return;
+    m_followedJob->flushLog();
+    LogViewer *viewer = new LogViewer(m_followedJob->logFileName(), this);
+    viewer->show();
+  }
+
+  void PackmolDialog::updateProgress()
+  {
+    const PackmolProgress &progress = m_outputParser->progress();
+    if (progress.finished) {
+      ui.runStatus->setText(progress.success ? tr("Converged") : 
+          tr("Ended without perfect packing"));
+      return;
+    }
+
+    if (progress.type < 0) {
+      ui.runStatus->setText(tr("Building initial approximation..."));
+      return;
+    }
+
+    QString phase = progress.type ? tr("type %1 of %2").arg(progress.type).arg(progress.numTypes)
+                                   : tr("all types");
+    QString text = tr("Packing %1, loop %2 of %3").arg(phase).arg(progress.loop).arg(progress.maxLoops);
+    if (progress.functionValue >= 0.0)
+      text += tr(", f = %1, distance violation = %2, constraint violation = %3")
+          .arg(progress.functionValue, 0, 'g', 4)
+          .arg(progress.maxDistanceViolation, 0, 'g', 3)
+          .arg(progress.maxConstraintViolation, 0, 'g', 3);
+    ui.runStatus->setText(text);
+  }
+  
   void PackmolDialog::visitWebsite()
   {
       QDesktopServices::openUrl(QUrl("http://www.ime.unicamp.br/~martinez/packmol/"));
@@ -737,9 +1668,18 @@ namespace Avogadro {
     settings.setValue("packmolMaxit", ui.maxit->value());
     settings.setValue("packmolNloop", ui.nloop->value());
     settings.setValue("packmolWriteout", ui.writeout->value());
+    settings.setValue("packmolLivePreview", ui.livePreview->isChecked());
+    settings.setValue("packmolCheckpoints", ui.checkpoints->isChecked());
     settings.setValue("packmolAddAmberTer", ui.addAmberTer->isChecked());
     settings.setValue("packmolAddBoxSides", ui.addBoxSides->isChecked());
     settings.setValue("packmolRandomInitialPoint", ui.randomInitialPoint->isChecked());
+    settings.setValue("packmolMaxConcurrent", ui.maxConcurrent->value());
+    settings.setValue("packmolWallTimeLimit", ui.wallTimeLimit->value());
+    settings.setValue("packmolCpuTimeLimit", ui.cpuTimeLimit->value());
+    settings.setValue("packmolBackend", ui.backend->currentIndex());
+    settings.setValue("packmolValidateResult", ui.validateResult->isChecked());
+    settings.setValue("packmolValidatePeriodic", ui.validatePeriodic->isChecked());
+    settings.setValue("packmolSolventBox", ui.solventBox->text());
   }
 
   void PackmolDialog::readSettings(QSettings &settings)
@@ -760,6 +1700,17 @@ namespace Avogadro {
     ui.filetype->setCurrentIndex(settings.value("packmolFiletype", 0).toInt());
     ui.output->setText(settings.value("packmolOutput", "result.pdb").toString());
     ui.seed->setValue(settings.value("packmolSeed", 0).toInt());
+    ui.writeout->setValue(settings.value("packmolWriteout", 0).toInt());
+    ui.livePreview->setChecked(settings.value("packmolLivePreview", false).toBool());
+    ui.checkpoints->setChecked(settings.value("packmolCheckpoints", false).toBool());
+    ui.maxConcurrent->setValue(settings.value("packmolMaxConcurrent", 
+          qMax(1, QThread::idealThreadCount())).toInt());
+    ui.wallTimeLimit->setValue(settings.value("packmolWallTimeLimit", 0).toInt());
+    ui.cpuTimeLimit->setValue(settings.value("packmolCpuTimeLimit", 0).toInt());
+    ui.backend->setCurrentIndex(settings.value("packmolBackend", 0).toInt());
+    ui.validateResult->setChecked(settings.value("packmolValidateResult", true).toBool());
+    ui.validatePeriodic->setChecked(settings.value("packmolValidatePeriodic", false).toBool());
+    ui.solventBox->setText(settings.value("packmolSolventBox").toString());
   }
 
 
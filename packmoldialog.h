@@ -29,15 +29,32 @@
 #include <QProcess>
 #include <QHash>
 #include <QSettings>
+#include <QFutureWatcher>
+#include <QAtomicInt>
+#include <QPointer>
 
 #include "ui_packmoldialog.h"
+#include "structurestager.h"
+#include "inputgenerator.h"
+#include "inputdocument.h"
+#include "jobqueue.h"
 
+class QTimer;
 
 namespace Avogadro
 {
 
   class Molecule;
   class StructuresModel;
+  class PackmolOutputParser;
+  class JobQueueModel;
+  class SeedRace;
+  class DecomposedRun;
+  class EngineRun;
+  class ResultPreview;
+  struct SeamReport;
+  struct SolvationEstimate;
+  struct ResultImport;
 
   class PackmolDialog : public QDialog
   {
@@ -50,19 +67,69 @@ namespace Avogadro
     void writeSettings(QSettings &settings) const;
     void readSettings(QSettings &settings);
 
+    //! Progress of the followed run, connect to its signals to follow it
+    PackmolOutputParser* outputParser() const { return m_outputParser; }
+    JobQueue* jobQueue() const { return m_jobQueue; }
+
   private:
     Ui::PackmolDialog ui;
     QHash<QString,QString> m_fileLookup; // translate short input filename to full path filenames
-    QProcess *m_process;
+    StructureStager m_stager;
+    PackmolInputDocument m_input; // the editor's text, updated line by line
+    JobQueue *m_jobQueue;
+    JobQueueModel *m_jobModel;
+    SeedRace *m_race;
+    DecomposedRun *m_decomposedRun;
+    EngineRun *m_engineRun;
+    ResultPreview *m_preview; // intermediate results of the followed job
+    QPointer<PackmolJob> m_followedJob; // shown in the output tab
+    bool m_importFollowed; // import the followed job's result when it finishes
+    PackmolOutputParser *m_outputParser;
     StructuresModel *m_model;
-
-    double solvCalcVolume();
-    void solvUpdateVolume();
-    void solvUpdateSoluteNumber();
-    QString solvContraintString();
-    QString headerString();
-    void createSodiumFile();
-    void createChlorineFile();
+    QTimer *m_solvTimer;
+    QFutureWatcher<SolvationEstimate> *m_solvWatcher;
+    QAtomicInt m_solvGeneration; // bumped on every edit, stale estimates are dropped
+    SolvationSpec::Shape m_solvAutoShape; // the shape "Auto" picked last
+    QList<ShellRegion> m_solvShellRegions; // the hydration shell fitted last
+    QFutureWatcher<BilayerSpec> *m_bilayerWatcher;
+
+    PackmolHeader header() const;
+    SolvationSpec solvationSpec() const;
+    //! Show the parameters of @p shape
+    void solvShowShape(SolvationSpec::Shape shape);
+    BilayerSpec bilayerSpec(double lipidLength) const;
+    //! Message box title for the decomposed or replicated run
+    QString decomposedRunTitle() const;
+    /**
+     * Solvation input for @p spec, writes the aligned solute and the counter
+     * ion structures if needed. Empty (after a warning) if that failed.
+     */
+    QString solvationInput(const PackmolHeader &header, SolvationSpec spec);
+    void appendOutput(const QByteArray &data);
+
+    //! Ask for the structures in @p files that are not in m_fileLookup yet
+    bool locateStructures(const QStringList &files);
+    //! The directory all structures are staged in before linking them into job directories
+    QString stagingDirectory() const;
+    /**
+     * Locate and stage the structure @p files of an input.
+     * @param staged Set to input name -> staged file.
+     */
+    bool stageStructures(const QStringList &files, QHash<QString, QString> &staged);
+    //! Show the errors in @p document, false if the user doesn't want to run it anyway
+    bool checkInput(const PackmolInputDocument &document);
+    //! @param output The result file, ui.output if empty
+    PackmolJob* submitJob(const QString &name, const QString &input,
+        const QHash<QString, QString> &staged, const QString &output = QString());
+    //! Rebuild the result of @p job from its input structures, validate and import it
+    void importResult(PackmolJob *job);
+    //! Read a result, pdb and xyz files are read without OpenBabel
+    void importFile(const QString &fileName);
+    //! pdb or xyz, empty for the formats only OpenBabel reads
+    QString resultFileType(const QString &fileName) const;
+    //! Rebuild, validate and import a result on a worker thread
+    void startImport(ResultImport &import);
+    void runEngine();
 
     double bilayerCalculateL();
 
@@ -71,23 +138,56 @@ namespace Avogadro
     void solvSolventBrowseClicked();
     void solvGenerateClicked();
     void solvAdjustShapeClicked(int);
+    void solvShapeChanged(int);
+    void solvShellClicked(int);
+    void solventBoxBrowseClicked();
     void solvAddCounterIonsClicked(int);
     void solvGuessSolventNumberClicked(int);
     void solvVolumeChanged(double);
+    void solvScheduleUpdate();
+    void solvStartUpdate();
+    void solvUpdateFinished();
 
     void bilayerNewClicked();
     void bilayerRemoveClicked();
     void bilayerGenerateClicked();
     void bilayerUpdateNumber();
+    void bilayerUpdateFinished();
 
+    void inputChanged(int position, int charsRemoved, int charsAdded);
     void runButtonClicked();
+    void raceButtonClicked();
+    void engineLoopFinished(int loop, int maxLoops, double functionValue,
+        double maxDistanceViolation, double maxConstraintViolation);
+    void engineFinished(bool converged, bool aborted);
+    void raceWon(PackmolJob *job);
+    void raceLost(PackmolJob *best);
     void abortButtonClicked();
     void visitWebsite();
-    void updateStandardOutput();
-    void processFinished(int,QProcess::ExitStatus);
+    void openLogClicked();
+    void livePreviewToggled(bool checked);
+    void updateProgress();
+
+    void queueSweepClicked();
+    void decomposeClicked();
+    void replicateClicked();
+    void decomposedFinished(const QString &fileName, const SeamReport &report);
+    void decomposedFailed(const QString &message);
+    void abortJobClicked();
+    void timeLimitsChanged();
+    void importJobClicked();
+    void resumeJobClicked();
+    void clearJobsClicked();
+    void followJob(PackmolJob *job);
+    void jobActivated(const QModelIndex &index);
+    void jobOutput(PackmolJob *job, const QByteArray &data);
+    void jobFinished(PackmolJob *job);
+    void importFinished();
 
   signals:
     void resultReady(Molecule*);
+    //! A molecule that is updated while the followed job runs
+    void previewReady(Molecule*);
   };
 
 } // End namespace Avogadro
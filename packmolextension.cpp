@@ -78,6 +78,7 @@ namespace Avogadro {
     if (!m_dialog) {
       m_dialog = new PackmolDialog(qobject_cast<QWidget *>(parent()));
       connect(m_dialog, SIGNAL(resultReady(Molecule*)), this, SLOT(resultsReady(Molecule*)));
+      connect(m_dialog, SIGNAL(previewReady(Molecule*)), this, SLOT(resultsReady(Molecule*)));
     }
   }
       
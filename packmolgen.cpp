@@ -0,0 +1,476 @@
+/**********************************************************************
+  packmol-gen - Generate packmol input files from the command line
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "inputgenerator.h"
+#include "packmolgeometry.h"
+#include "molecularvolume.h"
+#include "packmolresult.h"
+
+#include <openbabel/mol.h>
+#include <openbabel/obconversion.h>
+#include <openbabel/obiter.h>
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace Avogadro;
+
+namespace {
+
+  const char *usage =
+    "Usage: packmol-gen solvate --solvent FILE [options]\n"
+    "       packmol-gen bilayer --box X Y Z --lipid FILE DENSITY --polar-solvent FILE DENSITY [options]\n"
+    "       packmol-gen replicate --cell FILE --copies NX NY NZ --period X Y Z --output FILE [options]\n"
+    "\n"
+    "Writes a packmol input file to standard output (replicate writes the repeated cell).\n"
+    "\n"
+    "Common options:\n"
+    "  --tolerance A            minimum distance between molecules (2.0)\n"
+    "  --filetype pdb|xyz       file type used by packmol (pdb)\n"
+    "  --output FILE            packmol result file (result.pdb)\n"
+    "  --add-box-sides          add the box sides to the result\n"
+    "  --add-amber-ter          add TER records between molecules\n"
+    "  --writeout N             write the intermediate result every N loops\n"
+    "  --input FILE             write the input to FILE instead of standard output\n"
+    "  --write-ions DIR         write sodium/chlorine structures used for counter ions to DIR\n"
+    "\n"
+    "solvate:\n"
+    "  --solvent FILE           solvent structure\n"
+    "  --solvent-number N       number of solvent molecules\n"
+    "  --density D              guess the number of solvent molecules using density (g/ml)\n"
+    "  --solute FILE            solute structure\n"
+    "  --solute-number N        number of solute molecules (1)\n"
+    "  --counter-ions           add counter ions to make the system neutral\n"
+    "  --box X1 Y1 Z1 X2 Y2 Z2  solvate inside a box\n"
+    "  --sphere X Y Z R         solvate inside a sphere\n"
+    "  --ellipsoid X Y Z A B C  solvate inside an ellipsoid with semi-axes A, B and C\n"
+    "  --cylinder X Y Z x|y|z R L  solvate inside a cylinder along an axis\n"
+    "  --fit SPACING            fit the shape to the solute\n"
+    "  --shape box|sphere|ellipsoid|cylinder|auto  shape to fit, auto takes the smallest (box)\n"
+    "  --shell THICKNESS        only fill a shell around the solute\n"
+    "  --replicate SIZE         pack one cell of about SIZE of a box without solute, the\n"
+    "                           replicate command to repeat it is written to standard error\n"
+    "\n"
+    "bilayer:\n"
+    "  --box X Y Z              dimensions, the bilayer lies in the xy-plane\n"
+    "  --lipid FILE DENSITY     a lipid, may be repeated\n"
+    "  --polar-solvent FILE DENSITY  a polar solvent, may be repeated\n"
+    "\n"
+    "replicate:\n"
+    "  --cell FILE              packed cell, the packmol result of solvate --replicate\n"
+    "  --copies NX NY NZ        number of copies along x, y and z\n"
+    "  --period X Y Z           cell size\n";
+
+  struct StructureInfo
+  {
+    double molecularWeight;
+    int charge;
+    std::vector<Eigen::Vector3d> positions;
+    std::vector<int> atomicNumbers;
+  };
+
+  bool readStructure(const QString &fileName, StructureInfo &info)
+  {
+    OpenBabel::OBConversion conv;
+    OpenBabel::OBFormat *format = OpenBabel::OBConversion::FormatFromExt(
+        QFile::encodeName(fileName).constData());
+    if (!format || !conv.SetInFormat(format))
+      return false;
+    OpenBabel::OBMol mol;
+    if (!conv.ReadFile(&mol, QFile::encodeName(fileName).constData()))
+      return false;
+
+    info.molecularWeight = mol.GetMolWt();
+    info.charge = 0;
+    info.positions.clear();
+    info.atomicNumbers.clear();
+    FOR_ATOMS_OF_MOL (atom, mol) {
+      info.charge += atom->GetFormalCharge();
+      info.positions.push_back(Eigen::Vector3d(atom->x(), atom->y(), atom->z()));
+      info.atomicNumbers.push_back(atom->GetAtomicNum());
+    }
+    return true;
+  }
+
+  class Arguments
+  {
+    public:
+      Arguments(const QStringList &arguments) : m_arguments(arguments), m_error(false) {}
+
+      bool has(const QString &option)
+      {
+        return m_arguments.removeAll(option) > 0;
+      }
+
+      //! The @p count values following @p option (removed from the list)
+      QStringList values(const QString &option, int count)
+      {
+        int index = m_arguments.indexOf(option);
+        if (index < 0)
+          return QStringList();
+        QStringList result = m_arguments.mid(index + 1, count);
+        // another option is not a value, negative numbers are
+        bool missing = result.size() < count;
+        foreach (const QString &value, result)
+          missing = missing || value.startsWith("--");
+        if (missing) {
+          error(QString("%1 needs %2 value(s)").arg(option).arg(count));
+          m_arguments.removeAt(index);
+          return QStringList();
+        }
+        for (int i = 0; i <= count; ++i)
+          m_arguments.removeAt(index);
+        return result;
+      }
+
+      QString value(const QString &option, const QString &defaultValue = QString())
+      {
+        QStringList result = values(option, 1);
+        return result.isEmpty() ? defaultValue : result.first();
+      }
+
+      double number(const QString &text)
+      {
+        bool ok;
+        double result = text.toDouble(&ok);
+        if (!ok)
+          error(QString("%1 is not a number").arg(text));
+        return result;
+      }
+
+      Eigen::Vector3d vector(const QStringList &values, int offset = 0)
+      {
+        return Eigen::Vector3d(number(values.at(offset)), number(values.at(offset + 1)),
+            number(values.at(offset + 2)));
+      }
+
+      void error(const QString &message)
+      {
+        QTextStream(stderr) << "packmol-gen: " << message << "\n";
+        m_error = true;
+      }
+
+      bool failed() const { return m_error; }
+      const QStringList& remaining() const { return m_arguments; }
+
+    private:
+      QStringList m_arguments;
+      bool m_error;
+  };
+
+  bool solvate(Arguments &args, const PackmolHeader &header, QString &text, bool &needsIons)
+  {
+    SolvationSpec spec;
+    spec.solventFileName = args.value("--solvent");
+    spec.soluteFileName = args.value("--solute");
+    spec.soluteNumber = args.value("--solute-number", "1").toInt();
+    spec.addCounterIons = args.has("--counter-ions");
+    QString density = args.value("--density");
+    QString solventNumber = args.value("--solvent-number");
+    QString spacing = args.value("--fit");
+    QStringList box = args.values("--box", 6);
+    QStringList sphere = args.values("--sphere", 4);
+    QStringList ellipsoid = args.values("--ellipsoid", 6);
+    QStringList cylinder = args.values("--cylinder", 6);
+    QString shape = args.value("--shape", "box");
+    QString shell = args.value("--shell");
+    QString cellSize = args.value("--replicate");
+    bool smallest = false;
+
+    if (spec.solventFileName.isEmpty()) {
+      args.error("no solvent specified");
+      return false;
+    }
+
+    if (!sphere.isEmpty()) {
+      spec.shape = SolvationSpec::Sphere;
+      spec.center = args.vector(sphere);
+      spec.radius = args.number(sphere.at(3));
+    } else if (!ellipsoid.isEmpty()) {
+      spec.shape = SolvationSpec::Ellipsoid;
+      spec.center = args.vector(ellipsoid);
+      spec.semiAxes = args.vector(ellipsoid, 3);
+    } else if (!cylinder.isEmpty()) {
+      spec.shape = SolvationSpec::Cylinder;
+      spec.center = args.vector(cylinder);
+      spec.axis = QString("xyz").indexOf(cylinder.at(3).toLower());
+      if (spec.axis < 0 || cylinder.at(3).length() != 1) {
+        args.error("the cylinder axis is x, y or z");
+        return false;
+      }
+      spec.radius = args.number(cylinder.at(4));
+      spec.length = args.number(cylinder.at(5));
+    } else if (!box.isEmpty()) {
+      spec.min = args.vector(box);
+      spec.max = args.vector(box, 3);
+    } else if (spacing.isEmpty() && shell.isEmpty()) {
+      args.error("specify --box, --sphere, --ellipsoid, --cylinder, --fit or --shell");
+      return false;
+    } else {
+      QStringList shapes;
+      shapes << "box" << "sphere" << "ellipsoid" << "cylinder" << "auto";
+      if (!shapes.contains(shape)) {
+        args.error(QString("unknown shape %1").arg(shape));
+        return false;
+      }
+      smallest = shape == "auto";
+      if (!smallest)
+        spec.shape = static_cast<SolvationSpec::Shape>(shapes.indexOf(shape));
+    }
+
+    if (!spec.soluteFileName.isEmpty()) {
+      StructureInfo solute;
+      if (!readStructure(spec.soluteFileName, solute)) {
+        args.error(QString("could not read %1").arg(spec.soluteFileName));
+        return false;
+      }
+      spec.soluteCharge = solute.charge;
+      spec.soluteVolume = molecularVolume(solute.positions, solute.atomicNumbers);
+      needsIons = spec.addCounterIons && solute.charge;
+
+      if (!shell.isEmpty()) {
+        if (spec.soluteNumber != 1) {
+          args.error("--shell needs a single solute");
+          return false;
+        }
+        spec.fitShell(solute.positions, solute.atomicNumbers, args.number(shell));
+      } else if (!spacing.isEmpty()) {
+        if (smallest)
+          spec.fitSmallestShape(solute.positions, args.number(spacing));
+        else
+          spec.fitToSolute(solute.positions, args.number(spacing));
+      }
+    } else if (!spacing.isEmpty() || !shell.isEmpty()) {
+      args.error("--fit and --shell need a solute");
+      return false;
+    }
+
+    if (!solventNumber.isEmpty()) {
+      spec.solventNumber = solventNumber.toInt();
+    } else if (!density.isEmpty()) {
+      StructureInfo solvent;
+      if (!readStructure(spec.solventFileName, solvent)) {
+        args.error(QString("could not read %1").arg(spec.solventFileName));
+        return false;
+      }
+      spec.solventNumber = static_cast<int>(calcNumberOfMolecules(solvent.molecularWeight,
+            args.number(density), spec.solventVolume()));
+    } else {
+      args.error("specify --solvent-number or --density");
+      return false;
+    }
+
+    if (args.failed())
+      return false;
+
+    if (!cellSize.isEmpty()) {
+      if (spec.shape != SolvationSpec::Box || !spec.soluteFileName.isEmpty()) {
+        args.error("--replicate needs a box without solute");
+        return false;
+      }
+      double size = args.number(cellSize);
+      if (args.failed() || size <= 0.0) {
+        args.error("the cell size must be positive");
+        return false;
+      }
+      Replication replication = replicateSolvation(spec, size, header.tolerance);
+      text = generateSolvationInput(header, replication.cell);
+      QTextStream(stderr) << QString("packmol-gen: after packmol, run packmol-gen replicate "
+          "--cell %1 --filetype %2 --copies %3 %4 %5 --period %6 %7 %8 --output replicated.%2\n")
+          .arg(header.output).arg(header.fileType).arg(replication.copies[0])
+          .arg(replication.copies[1]).arg(replication.copies[2])
+          .arg(replication.period[0], 0, 'g', 10).arg(replication.period[1], 0, 'g', 10)
+          .arg(replication.period[2], 0, 'g', 10);
+      return true;
+    }
+
+    text = generateSolvationInput(header, spec);
+    return true;
+  }
+
+  bool bilayer(Arguments &args, const PackmolHeader &header, QString &text)
+  {
+    BilayerSpec spec;
+    QStringList box = args.values("--box", 3);
+    if (box.isEmpty()) {
+      args.error("no --box dimensions specified");
+      return false;
+    }
+    spec.dimensions = args.vector(box);
+
+    QStringList options;
+    options << "--lipid" << "--polar-solvent";
+    foreach (const QString &option, options) {
+      QStringList values;
+      while (!(values = args.values(option, 2)).isEmpty()) {
+        Structure structure;
+        structure.fileName = values.at(0);
+        structure.type = (option == "--lipid") ? Structure::Lipid : Structure::PolarSolvent;
+        structure.density = args.number(values.at(1));
+        structure.number = 0;
+        spec.structures.append(structure);
+      }
+    }
+
+    // molecular weights and the longest lipid
+    QList<double> weights;
+    bool foundLipid = false, foundPolarSolvent = false;
+    foreach (const Structure &structure, spec.structures) {
+      StructureInfo info;
+      if (!readStructure(structure.fileName, info)) {
+        args.error(QString("could not read %1").arg(structure.fileName));
+        return false;
+      }
+      weights.append(info.molecularWeight);
+      if (structure.type == Structure::Lipid) {
+        foundLipid = true;
+        spec.lipidLength = std::max(spec.lipidLength, pointSetDiameter(info.positions));
+      } else {
+        foundPolarSolvent = true;
+      }
+    }
+
+    if (!foundLipid || !foundPolarSolvent) {
+      args.error("there must be at least one lipid and one polar solvent");
+      return false;
+    }
+
+    for (int i = 0; i < spec.structures.size(); ++i) {
+      Structure &structure = spec.structures[i];
+      structure.number = static_cast<int>(calcNumberOfMolecules(weights.at(i),
+            structure.density, spec.regionVolume(structure.type)));
+    }
+
+    if (args.failed())
+      return false;
+    text = generateBilayerInput(header, spec);
+    return true;
+  }
+
+  bool replicate(Arguments &args, const PackmolHeader &header, bool hasOutput)
+  {
+    QString cell = args.value("--cell");
+    QStringList copies = args.values("--copies", 3);
+    QStringList period = args.values("--period", 3);
+    if (cell.isEmpty() || copies.isEmpty() || period.isEmpty() || !hasOutput) {
+      args.error("replicate needs --cell, --copies, --period and --output");
+      return false;
+    }
+    if (QFileInfo(cell).absoluteFilePath() == QFileInfo(header.output).absoluteFilePath()) {
+      args.error("the output would overwrite the cell");
+      return false;
+    }
+
+    Replication replication;
+    for (int j = 0; j < 3; ++j) {
+      replication.copies[j] = static_cast<int>(args.number(copies.at(j)));
+      if (replication.copies[j] < 1)
+        args.error("there must be at least one copy along each axis");
+    }
+    replication.period = args.vector(period);
+    // the output is written right away, a typo must not overwrite it
+    if (!args.remaining().isEmpty())
+      args.error(QString("unknown arguments: %1").arg(args.remaining().join(" ")));
+    if (args.failed())
+      return false;
+
+    QString error;
+    if (!replicateResult(cell, header.fileType, replication, header.output, &error)) {
+      args.error(error);
+      return false;
+    }
+    return true;
+  }
+
+} // end namespace
+
+int main(int argc, char **argv)
+{
+  QCoreApplication app(argc, argv);
+  QStringList arguments = app.arguments();
+  arguments.removeFirst();
+
+  if (arguments.isEmpty() || arguments.contains("--help") || arguments.contains("-h")) {
+    QTextStream(stdout) << usage;
+    return arguments.isEmpty() ? 1 : 0;
+  }
+
+  QString mode = arguments.takeFirst();
+  Arguments args(arguments);
+
+  PackmolHeader header;
+  header.tolerance = args.number(args.value("--tolerance", "2.0"));
+  header.fileType = args.value("--filetype", "pdb");
+  QString output = args.value("--output");
+  header.output = output.isEmpty() ? "result." + header.fileType : output;
+  header.addBoxSides = args.has("--add-box-sides");
+  header.addAmberTer = args.has("--add-amber-ter");
+  header.writeout = args.value("--writeout", "0").toInt();
+  QString inputFile = args.value("--input");
+  QString ionDir = args.value("--write-ions");
+
+  QString text;
+  bool ok = false;
+  bool needsIons = false;
+  if (mode == "solvate") {
+    ok = solvate(args, header, text, needsIons);
+  } else if (mode == "bilayer") {
+    ok = bilayer(args, header, text);
+  } else if (mode == "replicate") {
+    ok = replicate(args, header, !output.isEmpty());
+  } else {
+    args.error(QString("unknown mode %1").arg(mode));
+  }
+
+  if (ok && !args.remaining().isEmpty()) {
+    args.error(QString("unknown arguments: %1").arg(args.remaining().join(" ")));
+    ok = false;
+  }
+  if (!ok)
+    return 1;
+  if (mode == "replicate")
+    return 0; // written directly, there is no input
+
+  if (needsIons && !ionDir.isEmpty()) {
+    QStringList ions;
+    ions << "sodium" << "chlorine";
+    foreach (const QString &ion, ions)
+      writeCounterIonFile(ion, header.fileType, QDir(ionDir).filePath(ion + "." + header.fileType));
+  }
+
+  if (inputFile.isEmpty()) {
+    QTextStream(stdout) << text;
+  } else {
+    QFile file(inputFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+      QTextStream(stderr) << "packmol-gen: could not write " << inputFile << "\n";
+      return 1;
+    }
+    QTextStream(&file) << text;
+  }
+
+  return 0;
+}
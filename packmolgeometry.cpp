@@ -0,0 +1,396 @@
+/**********************************************************************
+  PackmolGeometry - Geometric helpers for setting up packmol systems
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "packmolgeometry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <utility>
+
+namespace Avogadro {
+
+  static std::size_t farthestPoint(const std::vector<Eigen::Vector3d> &points,
+      const Eigen::Vector3d &from, double &dist2)
+  {
+    std::size_t farthest = 0;
+    dist2 = -1.0;
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      double d2 = (points[i] - from).squaredNorm();
+      if (d2 > dist2) {
+        dist2 = d2;
+        farthest = i;
+      }
+    }
+    return farthest;
+  }
+
+  double pointSetDiameter(const std::vector<Eigen::Vector3d> &points)
+  {
+    if (points.size() < 2)
+      return 0.0;
+
+    // lower bound: walk to the farthest point until the distance stops growing
+    double best2 = 0.0, d2;
+    std::size_t a = farthestPoint(points, points[0], d2);
+    for (int sweep = 0; sweep < 4; ++sweep) {
+      std::size_t b = farthestPoint(points, points[a], d2);
+      if (d2 <= best2)
+        break;
+      best2 = d2;
+      a = b;
+    }
+    double best = sqrt(best2);
+
+    // distance of every point to the bounding box center
+    Eigen::Vector3d min(points[0]), max(points[0]);
+    for (std::size_t i = 1; i < points.size(); ++i)
+      for (int j = 0; j < 3; ++j) {
+        if (points[i][j] < min[j]) min[j] = points[i][j];
+        if (points[i][j] > max[j]) max[j] = points[i][j];
+      }
+    Eigen::Vector3d center = 0.5 * (min + max);
+
+    std::vector<std::pair<double, std::size_t> > candidates;
+    double maxR = 0.0;
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      double r = (points[i] - center).norm();
+      candidates.push_back(std::make_pair(r, i));
+      if (r > maxR)
+        maxR = r;
+    }
+
+    // |p - q| <= |p - c| + |q - c|, so points with r + maxR <= best
+    // can not be part of a longer pair
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < candidates.size(); ++i)
+      if (candidates[i].first + maxR > best)
+        candidates[count++] = candidates[i];
+    candidates.resize(count);
+    std::sort(candidates.begin(), candidates.end(),
+        std::greater<std::pair<double, std::size_t> >());
+
+    for (std::size_t i = 0; i < candidates.size(); ++i) {
+      if (candidates[i].first + candidates[0].first <= best)
+        break;
+      const Eigen::Vector3d &p = points[candidates[i].second];
+      for (std::size_t j = i + 1; j < candidates.size(); ++j) {
+        if (candidates[i].first + candidates[j].first <= best)
+          break;
+        double dist2 = (p - points[candidates[j].second]).squaredNorm();
+        if (dist2 > best2) {
+          best2 = dist2;
+          best = sqrt(best2);
+        }
+      }
+    }
+
+    return best;
+  }
+
+  static Eigen::Vector3d cross(const Eigen::Vector3d &a, const Eigen::Vector3d &b)
+  {
+    return Eigen::Vector3d(a.y() * b.z() - a.z() * b.y(), a.z() * b.x() - a.x() * b.z(),
+        a.x() * b.y() - a.y() * b.x());
+  }
+
+  namespace {
+
+    struct Sphere
+    {
+      Eigen::Vector3d center;
+      double radius;
+
+      bool contains(const Eigen::Vector3d &p) const
+      {
+        return (p - center).norm() <= radius * (1.0 + 1.0e-10) + 1.0e-10;
+      }
+    };
+
+    Sphere sphereThrough(const Eigen::Vector3d &a, const Eigen::Vector3d &b)
+    {
+      Sphere s;
+      s.center = 0.5 * (a + b);
+      s.radius = 0.5 * (a - b).norm();
+      return s;
+    }
+
+    //! Smallest sphere with @p a, @p b and @p c on its surface, false if they are collinear
+    bool sphereThrough(const Eigen::Vector3d &a, const Eigen::Vector3d &b,
+        const Eigen::Vector3d &c, Sphere &s)
+    {
+      Eigen::Vector3d ab = b - a, ac = c - a;
+      Eigen::Vector3d n = cross(ab, ac);
+      double n2 = n.squaredNorm();
+      if (n2 <= 1.0e-12 * ab.squaredNorm() * ac.squaredNorm())
+        return false;
+      Eigen::Vector3d offset = (ac.squaredNorm() * cross(n, ab) + ab.squaredNorm() * cross(ac, n))
+          / (2.0 * n2);
+      s.center = a + offset;
+      s.radius = offset.norm();
+      return true;
+    }
+
+    //! The sphere with all four points on its surface, false if they are coplanar
+    bool sphereThrough(const Eigen::Vector3d &a, const Eigen::Vector3d &b,
+        const Eigen::Vector3d &c, const Eigen::Vector3d &d, Sphere &s)
+    {
+      Eigen::Vector3d u = b - a, v = c - a, w = d - a;
+      double det = u.dot(cross(v, w));
+      if (std::fabs(det) <= 1.0e-12 * u.norm() * v.norm() * w.norm())
+        return false;
+      Eigen::Vector3d offset = (u.squaredNorm() * cross(v, w) + v.squaredNorm() * cross(w, u)
+          + w.squaredNorm() * cross(u, v)) / (2.0 * det);
+      s.center = a + offset;
+      s.radius = offset.norm();
+      return true;
+    }
+
+    //! Smallest sphere over pairs and triples of @p points that contains all of them
+    Sphere smallestOf(const Eigen::Vector3d *points, int n)
+    {
+      Sphere best;
+      best.radius = -1.0;
+      for (int i = 0; i < n; ++i)
+        for (int j = i + 1; j < n; ++j) {
+          Sphere candidates[8];
+          int count = 0;
+          candidates[count++] = sphereThrough(points[i], points[j]);
+          for (int k = j + 1; k < n; ++k)
+            if (sphereThrough(points[i], points[j], points[k], candidates[count]))
+              ++count;
+          for (int c = 0; c < count; ++c) {
+            bool all = true;
+            for (int m = 0; m < n && all; ++m)
+              all = candidates[c].contains(points[m]);
+            if (all && (best.radius < 0.0 || candidates[c].radius < best.radius))
+              best = candidates[c];
+          }
+        }
+      return best;
+    }
+
+  } // end anonymous namespace
+
+  void minimalEnclosingSphere(const std::vector<Eigen::Vector3d> &points,
+      Eigen::Vector3d &center, double &radius)
+  {
+    if (points.empty()) {
+      center = Eigen::Vector3d::Zero();
+      radius = 0.0;
+      return;
+    }
+
+    // random order makes the expected number of rebuilds small (fixed seed, same result every time)
+    std::vector<Eigen::Vector3d> p(points);
+    unsigned long long state = 88172645463325252ULL;
+    for (std::size_t i = p.size() - 1; i > 0; --i) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      std::swap(p[i], p[state % (i + 1)]);
+    }
+
+    // Welzl's algorithm unrolled: the support set grows by one point per level
+    Sphere s;
+    s.center = p[0];
+    s.radius = 0.0;
+    for (std::size_t i = 1; i < p.size(); ++i) {
+      if (s.contains(p[i]))
+        continue;
+      s.center = p[i];
+      s.radius = 0.0;
+      for (std::size_t j = 0; j < i; ++j) {
+        if (s.contains(p[j]))
+          continue;
+        s = sphereThrough(p[i], p[j]);
+        for (std::size_t k = 0; k < j; ++k) {
+          if (s.contains(p[k]))
+            continue;
+          if (!sphereThrough(p[i], p[j], p[k], s)) {
+            Eigen::Vector3d three[3] = { p[i], p[j], p[k] };
+            s = smallestOf(three, 3);
+          }
+          for (std::size_t l = 0; l < k; ++l) {
+            if (s.contains(p[l]))
+              continue;
+            if (!sphereThrough(p[i], p[j], p[k], p[l], s)) {
+              Eigen::Vector3d four[4] = { p[i], p[j], p[k], p[l] };
+              s = smallestOf(four, 4);
+            }
+          }
+        }
+      }
+    }
+
+    center = s.center;
+    radius = s.radius;
+  }
+
+  /**
+   * Eigenvectors of the symmetric matrix @p a as the columns of the result
+   * (cyclic Jacobi rotations, plenty for 3x3).
+   */
+  static Eigen::Matrix3d symmetricEigenvectors(Eigen::Matrix3d a)
+  {
+    Eigen::Matrix3d v = Eigen::Matrix3d::Identity();
+    for (int sweep = 0; sweep < 50; ++sweep) {
+      double off = a(0, 1) * a(0, 1) + a(0, 2) * a(0, 2) + a(1, 2) * a(1, 2);
+      double scale = a(0, 0) * a(0, 0) + a(1, 1) * a(1, 1) + a(2, 2) * a(2, 2);
+      if (off <= 1.0e-24 * scale || off == 0.0)
+        break;
+      for (int p = 0; p < 2; ++p)
+        for (int q = p + 1; q < 3; ++q) {
+          if (a(p, q) == 0.0)
+            continue;
+          double theta = (a(q, q) - a(p, p)) / (2.0 * a(p, q));
+          double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+          double c = 1.0 / std::sqrt(t * t + 1.0), s = t * c;
+          Eigen::Matrix3d j = Eigen::Matrix3d::Identity();
+          j(p, p) = c;
+          j(q, q) = c;
+          j(p, q) = s;
+          j(q, p) = -s;
+          a = j.transpose() * a * j;
+          v = v * j;
+        }
+    }
+    return v;
+  }
+
+  OrientedBox orientedBoundingBox(const std::vector<Eigen::Vector3d> &points)
+  {
+    OrientedBox aligned;
+    aligned.axes = Eigen::Matrix3d::Identity();
+    if (points.empty()) {
+      aligned.center = aligned.halfExtents = Eigen::Vector3d::Zero();
+      return aligned;
+    }
+
+    Eigen::Vector3d min(points[0]), max(points[0]), mean(Eigen::Vector3d::Zero());
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      for (int j = 0; j < 3; ++j) {
+        if (points[i][j] < min[j]) min[j] = points[i][j];
+        if (points[i][j] > max[j]) max[j] = points[i][j];
+      }
+      mean += points[i];
+    }
+    mean /= static_cast<double>(points.size());
+    aligned.center = 0.5 * (min + max);
+    aligned.halfExtents = 0.5 * (max - min);
+
+    Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      Eigen::Vector3d d = points[i] - mean;
+      covariance += d * d.transpose();
+    }
+    Eigen::Matrix3d axes = symmetricEigenvectors(covariance);
+    if (axes.col(0).dot(cross(axes.col(1), axes.col(2))) < 0.0)
+      axes.col(2) = -axes.col(2); // a rotation, not a reflection
+
+    Eigen::Vector3d boxMin(Eigen::Vector3d::Constant(1.0e300));
+    Eigen::Vector3d boxMax(Eigen::Vector3d::Constant(-1.0e300));
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      Eigen::Vector3d q = axes.transpose() * (points[i] - mean);
+      for (int j = 0; j < 3; ++j) {
+        if (q[j] < boxMin[j]) boxMin[j] = q[j];
+        if (q[j] > boxMax[j]) boxMax[j] = q[j];
+      }
+    }
+    OrientedBox box;
+    box.axes = axes;
+    box.center = mean + axes * (0.5 * (boxMin + boxMax));
+    box.halfExtents = 0.5 * (boxMax - boxMin);
+    return box.volume() < aligned.volume() ? box : aligned;
+  }
+
+  CellList::CellList(const std::vector<Eigen::Vector3d> &points, double cellSize)
+    : m_points(points), m_origin(Eigen::Vector3d::Zero()), m_cellSize(cellSize)
+  {
+    m_dims[0] = m_dims[1] = m_dims[2] = 1;
+    Eigen::Vector3d max(Eigen::Vector3d::Zero());
+    if (!points.empty()) {
+      m_origin = max = points[0];
+      for (std::size_t i = 1; i < points.size(); ++i)
+        for (int j = 0; j < 3; ++j) {
+          m_origin[j] = std::min(m_origin[j], points[i][j]);
+          max[j] = std::max(max[j], points[i][j]);
+        }
+    }
+
+    // cap the grid, sparse point sets don't need more cells than points
+    double maxCells = std::max<double>(64.0, 2.0 * points.size());
+    for (int j = 0; j < 3; ++j)
+      m_dims[j] = static_cast<int>((max[j] - m_origin[j]) / m_cellSize) + 1;
+    while (static_cast<double>(m_dims[0]) * m_dims[1] * m_dims[2] > maxCells) {
+      m_cellSize *= 1.5;
+      for (int j = 0; j < 3; ++j)
+        m_dims[j] = static_cast<int>((max[j] - m_origin[j]) / m_cellSize) + 1;
+    }
+
+    int numCells = m_dims[0] * m_dims[1] * m_dims[2];
+    std::vector<int> cells(points.size());
+    m_cellStart.assign(numCells + 1, 0);
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      int ijk[3];
+      cellOf(points[i], ijk);
+      cells[i] = cellIndex(ijk[0], ijk[1], ijk[2]);
+      ++m_cellStart[cells[i] + 1];
+    }
+    for (int c = 0; c < numCells; ++c)
+      m_cellStart[c + 1] += m_cellStart[c];
+
+    std::vector<int> fill(m_cellStart.begin(), m_cellStart.end() - 1);
+    m_indices.resize(points.size());
+    for (std::size_t i = 0; i < points.size(); ++i)
+      m_indices[fill[cells[i]]++] = static_cast<int>(i);
+  }
+
+  void CellList::cellOf(const Eigen::Vector3d &position, int ijk[3]) const
+  {
+    for (int j = 0; j < 3; ++j) {
+      int c = static_cast<int>(std::floor((position[j] - m_origin[j]) / m_cellSize));
+      ijk[j] = std::max(0, std::min(m_dims[j] - 1, c));
+    }
+  }
+
+  void CellList::neighbors(const Eigen::Vector3d &position, double cutoff,
+      std::vector<int> &result) const
+  {
+    if (m_points.empty())
+      return;
+
+    // cells overlapping the cube around position, clamped to the grid
+    int lo[3], hi[3];
+    cellOf(position - Eigen::Vector3d::Constant(cutoff), lo);
+    cellOf(position + Eigen::Vector3d::Constant(cutoff), hi);
+
+    double cutoff2 = cutoff * cutoff;
+    for (int k = lo[2]; k <= hi[2]; ++k)
+      for (int j = lo[1]; j <= hi[1]; ++j)
+        for (int i = lo[0]; i <= hi[0]; ++i) {
+          int c = cellIndex(i, j, k);
+          for (int n = m_cellStart[c]; n < m_cellStart[c + 1]; ++n) {
+            int index = m_indices[n];
+            if ((m_points[index] - position).squaredNorm() <= cutoff2)
+              result.push_back(index);
+          }
+        }
+  }
+
+} // end namespace Avogadro
@@ -0,0 +1,99 @@
+/**********************************************************************
+  PackmolGeometry - Geometric helpers for setting up packmol systems
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef PACKMOLGEOMETRY_H
+#define PACKMOLGEOMETRY_H
+
+#include <Eigen/Core>
+
+#include <vector>
+
+namespace Avogadro {
+
+  /**
+   * @return The largest distance between any two points (exact).
+   *
+   * A lower bound is found with a few farthest-point sweeps, after which
+   * only pairs that can still beat it (|p - c| + |q - c| > d for the
+   * bounding box center c) are compared. For elongated molecules such as
+   * lipids this leaves a handful of candidates at both ends.
+   */
+  double pointSetDiameter(const std::vector<Eigen::Vector3d> &points);
+
+  /**
+   * Smallest sphere that contains all @p points (exact), found with Welzl's
+   * algorithm on the points in random order, expected linear time.
+   */
+  void minimalEnclosingSphere(const std::vector<Eigen::Vector3d> &points,
+      Eigen::Vector3d &center, double &radius);
+
+  struct OrientedBox
+  {
+    Eigen::Vector3d center;
+    Eigen::Matrix3d axes;      // columns, a rotation
+    Eigen::Vector3d halfExtents;
+
+    double volume() const { return 8.0 * halfExtents.x() * halfExtents.y() * halfExtents.z(); }
+    //! Coordinates of @p point in the box frame, centered on center
+    Eigen::Vector3d toBoxFrame(const Eigen::Vector3d &point) const
+    {
+      return center + axes.transpose() * (point - center);
+    }
+  };
+
+  /**
+   * Bounding box along the principal axes of @p points (PCA of their
+   * covariance), or the axis aligned box if that one is smaller.
+   */
+  OrientedBox orientedBoundingBox(const std::vector<Eigen::Vector3d> &points);
+
+  /**
+   * Uniform grid over a fixed set of points for finding all points within
+   * a cutoff of a position in O(1). The points are sorted by cell (counting
+   * sort), so every cell is a contiguous range of indices.
+   */
+  class CellList
+  {
+    public:
+      //! @p cellSize should be at least the largest cutoff used with neighbors()
+      CellList(const std::vector<Eigen::Vector3d> &points, double cellSize);
+
+      /**
+       * Append the indices of all points within @p cutoff of @p position
+       * to @p result. @p cutoff must not exceed the cell size.
+       */
+      void neighbors(const Eigen::Vector3d &position, double cutoff,
+          std::vector<int> &result) const;
+
+      const std::vector<Eigen::Vector3d>& points() const { return m_points; }
+
+    private:
+      int cellIndex(int i, int j, int k) const { return (k * m_dims[1] + j) * m_dims[0] + i; }
+      void cellOf(const Eigen::Vector3d &position, int ijk[3]) const;
+
+      std::vector<Eigen::Vector3d> m_points;
+      Eigen::Vector3d m_origin;
+      double m_cellSize;
+      int m_dims[3];
+      std::vector<int> m_cellStart; // size numCells + 1
+      std::vector<int> m_indices;   // point indices sorted by cell
+  };
+
+} // end namespace Avogadro
+
+#endif
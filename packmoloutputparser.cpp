@@ -0,0 +1,147 @@
+/**********************************************************************
+  PackmolOutputParser - Extract progress information from packmol output
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "packmoloutputparser.h"
+
+#include <QStringList>
+
+namespace Avogadro {
+
+  // packmol prints fortran style numbers (.12345E+02, 0.1D-01)
+  static double fortranNumber(QString token)
+  {
+    token.replace('D', 'E');
+    token.replace('d', 'e');
+    return token.toDouble();
+  }
+
+  // the last whitespace separated token of the line
+  static QString lastToken(const QString &line)
+  {
+    return line.section(' ', -1, -1, QString::SectionSkipEmpty);
+  }
+
+  // the first integer after @p marker, -1 if there is none
+  static int integerAfter(const QString &line, const QString &marker)
+  {
+    int index = line.indexOf(marker);
+    if (index < 0)
+      return -1;
+    QString rest = line.mid(index + marker.length());
+    rest.replace('(', ' ').replace(')', ' ').replace(':', ' ');
+    bool ok;
+    int value = rest.section(' ', 0, 0, QString::SectionSkipEmpty).toInt(&ok);
+    return ok ? value : -1;
+  }
+
+  PackmolOutputParser::PackmolOutputParser(QObject *parent) : QObject(parent)
+  {
+  }
+
+  void PackmolOutputParser::reset()
+  {
+    m_buffer.clear();
+    m_progress = PackmolProgress();
+    m_maxLoopsType.clear();
+  }
+
+  void PackmolOutputParser::addData(const QByteArray &data)
+  {
+    m_buffer.append(data);
+    int start = 0;
+    int end;
+    while ((end = m_buffer.indexOf('\n', start)) >= 0) {
+      parseLine(QString::fromLatin1(m_buffer.constData() + start, end - start).trimmed());
+      start = end + 1;
+    }
+    m_buffer.remove(0, start);
+  }
+
+  int PackmolOutputParser::percentComplete() const
+  {
+    if (m_progress.finished)
+      return 100;
+    if (m_progress.type < 0 || m_progress.numTypes <= 0)
+      return 0;
+
+    // one phase per type, then one for all types together
+    int phases = m_progress.numTypes + 1;
+    int phase = m_progress.type ? m_progress.type - 1 : m_progress.numTypes;
+    double fraction = 0.0;
+    if (m_progress.maxLoops > 0 && m_progress.loop > 0)
+      fraction = qMin(1.0, static_cast<double>(m_progress.loop) / m_progress.maxLoops);
+    return static_cast<int>(100.0 * (phase + fraction) / phases);
+  }
+
+  void PackmolOutputParser::parseLine(const QString &line)
+  {
+    if (line.isEmpty() || line.startsWith('#') || line.startsWith("--") || line.startsWith('|'))
+      return;
+
+    if (line.startsWith("Number of independent structures:")) {
+      m_progress.numTypes = lastToken(line).toInt();
+    } else if (line.startsWith("Maximum number of GENCAN loops for all molecule packing:")) {
+      m_progress.maxLoopsAll = lastToken(line).toInt();
+    } else if (line.startsWith("Maximum number of GENCAN loops for type:")) {
+      m_maxLoopsType.append(lastToken(line).toInt());
+    } else if (line.startsWith("Packing molecules of type:")) {
+      m_progress.type = lastToken(line).toInt();
+      m_progress.loop = -1;
+      int index = m_progress.type - 1;
+      m_progress.maxLoops = (index >= 0 && index < m_maxLoopsType.size())
+          ? m_maxLoopsType.at(index) : m_progress.maxLoopsAll;
+      emit phaseChanged(m_progress.type);
+      emit progressChanged(percentComplete());
+    } else if (line.startsWith("Packing all molecules together")) {
+      m_progress.type = 0;
+      m_progress.loop = -1;
+      m_progress.maxLoops = m_progress.maxLoopsAll;
+      emit phaseChanged(0);
+      emit progressChanged(percentComplete());
+    } else if (line.startsWith("Starting GENCAN loop")) {
+      m_progress.loop = integerAfter(line, "loop");
+      emit loopStarted(m_progress.loop, m_progress.maxLoops);
+      emit progressChanged(percentComplete());
+    } else if (line.startsWith("Function value from last GENCAN loop:")) {
+      m_progress.functionValue = fortranNumber(lastToken(line));
+    } else if (line.startsWith("Maximum violation of target distance:")) {
+      m_progress.maxDistanceViolation = fortranNumber(lastToken(line));
+    } else if (line.startsWith("Maximum violation of the constraints:")) {
+      m_progress.maxConstraintViolation = fortranNumber(lastToken(line));
+      // last value packmol prints after a loop
+      if (!m_progress.finished)
+        emit loopFinished(m_progress.loop, m_progress.functionValue,
+            m_progress.maxDistanceViolation, m_progress.maxConstraintViolation);
+    } else if (line.startsWith("Final objective function value:")) {
+      m_progress.functionValue = fortranNumber(lastToken(line));
+    } else if (line.startsWith("Success!")) {
+      m_progress.finished = true;
+      m_progress.success = true;
+      emit progressChanged(100);
+      emit finished(true);
+    } else if (line.startsWith("ENDED WITHOUT PERFECT PACKING")) {
+      m_progress.finished = true;
+      m_progress.success = false;
+      emit progressChanged(100);
+      emit finished(false);
+    }
+  }
+
+} // end namespace Avogadro
+
+#include "packmoloutputparser.moc"
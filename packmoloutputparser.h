@@ -0,0 +1,90 @@
+/**********************************************************************
+  PackmolOutputParser - Extract progress information from packmol output
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef PACKMOLOUTPUTPARSER_H
+#define PACKMOLOUTPUTPARSER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QList>
+
+namespace Avogadro {
+
+  /**
+   * The state of a packmol run as far as it can be told from its output.
+   */
+  struct PackmolProgress
+  {
+    PackmolProgress() : numTypes(0), type(-1), loop(-1), maxLoops(0),
+        maxLoopsAll(0), functionValue(-1.0), maxDistanceViolation(-1.0),
+        maxConstraintViolation(-1.0), finished(false), success(false) {}
+
+    int numTypes;                  // number of independent structures
+    int type;                      // type being packed, 0 = all together, -1 = not packing yet
+    int loop;                      // current GENCAN loop
+    int maxLoops;                  // maximum number of loops for the current phase
+    int maxLoopsAll;               // maximum number of loops for all molecules together
+    double functionValue;          // objective function after the last loop
+    double maxDistanceViolation;
+    double maxConstraintViolation;
+    bool finished;
+    bool success;
+  };
+
+  /**
+   * Incremental parser for packmol's standard output. Feed it whatever the
+   * process returned with addData(), partial lines are kept until the rest
+   * arrives.
+   */
+  class PackmolOutputParser : public QObject
+  {
+    Q_OBJECT
+
+    public:
+      PackmolOutputParser(QObject *parent = 0);
+
+      void reset();
+      void addData(const QByteArray &data);
+
+      const PackmolProgress& progress() const { return m_progress; }
+      //! Overall progress estimate in percent, types are packed first and then all together
+      int percentComplete() const;
+
+    signals:
+      //! Packing molecules of @p type (1-based), 0 if all types are packed together
+      void phaseChanged(int type);
+      void loopStarted(int loop, int maxLoops);
+      //! Emitted once per GENCAN loop with the values printed after it
+      void loopFinished(int loop, double functionValue,
+          double maxDistanceViolation, double maxConstraintViolation);
+      void progressChanged(int percent);
+      //! Packmol printed its final verdict
+      void finished(bool success);
+
+    private:
+      void parseLine(const QString &line);
+
+      QByteArray m_buffer;
+      PackmolProgress m_progress;
+      QList<int> m_maxLoopsType;
+  };
+
+} // end namespace Avogadro
+
+#endif
@@ -0,0 +1,119 @@
+/**********************************************************************
+  PackmolProcess - A packmol process that can be limited and stopped
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "packmolprocess.h"
+
+#include <QTimer>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <signal.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/prctl.h>
+#endif
+
+namespace Avogadro {
+
+  PackmolProcess::PackmolProcess(QObject *parent) : QProcess(parent), m_cpuTimeLimit(0)
+  {
+  }
+
+  void PackmolProcess::setupChildProcess()
+  {
+    // runs in the child between fork() and exec()
+#ifdef Q_OS_UNIX
+    if (m_cpuTimeLimit > 0) {
+      struct rlimit limit;
+      limit.rlim_cur = m_cpuTimeLimit;
+      limit.rlim_max = m_cpuTimeLimit + 5;
+      setrlimit(RLIMIT_CPU, &limit);
+    }
+#endif
+#ifdef Q_OS_LINUX
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+  }
+
+  void PackmolProcess::stop(int graceMsec)
+  {
+    disconnect(this, SIGNAL(finished(int,QProcess::ExitStatus)), 0, 0);
+    if (state() == QProcess::NotRunning) {
+      deleteLater();
+      return;
+    }
+    connect(this, SIGNAL(finished(int,QProcess::ExitStatus)), this, SLOT(deleteLater()));
+    // packmol has no handler for SIGTERM, on Windows terminate() is a
+    // WM_CLOSE that console programs ignore: the kill is what usually ends it
+    terminate();
+    QTimer::singleShot(graceMsec, this, SLOT(killIfRunning()));
+  }
+
+  void PackmolProcess::killIfRunning()
+  {
+    if (state() != QProcess::NotRunning)
+      kill();
+  }
+
+  qint64 PackmolProcess::processId() const
+  {
+#ifdef Q_OS_UNIX
+    return state() == QProcess::NotRunning ? 0 : static_cast<qint64>(pid());
+#else
+    return 0; // Q_PID is a PROCESS_INFORMATION pointer on Windows
+#endif
+  }
+
+  bool PackmolProcess::terminateOrphan(qint64 pid, const QString &workingDirectory,
+      const QString &executable, bool kill)
+  {
+#ifdef Q_OS_LINUX
+    if (pid <= 0)
+      return false;
+    QString proc = QString("/proc/%1/").arg(pid);
+    QFileInfo cwd(QFileInfo(proc + "cwd").symLinkTarget());
+    QFileInfo exe(QFileInfo(proc + "exe").symLinkTarget());
+    if (cwd.filePath().isEmpty() || exe.filePath().isEmpty())
+      return false; // gone, or not ours to look at
+    if (cwd.canonicalFilePath() != QFileInfo(workingDirectory).canonicalFilePath())
+      return false;
+    // argv[0] as well, the executable may be a symbolic link
+    QFile cmdline(proc + "cmdline");
+    QByteArray argv0;
+    if (cmdline.open(QIODevice::ReadOnly))
+      argv0 = cmdline.readAll().split('\0').first();
+    QString name = QFileInfo(executable).fileName();
+    if (exe.fileName() != name && QFileInfo(QFile::decodeName(argv0)).fileName() != name)
+      return false;
+    return ::kill(static_cast<pid_t>(pid), kill ? SIGKILL : SIGTERM) == 0;
+#else
+    Q_UNUSED(pid);
+    Q_UNUSED(workingDirectory);
+    Q_UNUSED(executable);
+    Q_UNUSED(kill);
+    return false;
+#endif
+  }
+
+} // end namespace Avogadro
+
+#include "packmolprocess.moc"
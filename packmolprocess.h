@@ -0,0 +1,74 @@
+/**********************************************************************
+  PackmolProcess - A packmol process that can be limited and stopped
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef PACKMOLPROCESS_H
+#define PACKMOLPROCESS_H
+
+#include <QProcess>
+
+namespace Avogadro {
+
+  /**
+   * QProcess that sets up the packmol child: on Unix the CPU time limit is
+   * enforced by the kernel (SIGXCPU, SIGKILL a few seconds later) and on
+   * Linux the child is terminated when Avogadro dies, even if it crashes.
+   */
+  class PackmolProcess : public QProcess
+  {
+    Q_OBJECT
+
+    public:
+      PackmolProcess(QObject *parent = 0);
+
+      //! CPU time limit in seconds, 0 for none. Only enforced on Unix.
+      void setCpuTimeLimit(int seconds) { m_cpuTimeLimit = seconds; }
+      int cpuTimeLimit() const { return m_cpuTimeLimit; }
+
+      /**
+       * Ask the process to terminate and kill it if it still runs after
+       * @p graceMsec. Returns immediately, the process deletes itself once
+       * it has exited.
+       */
+      void stop(int graceMsec);
+
+      //! The operating system's process id, 0 if not running or unknown
+      qint64 processId() const;
+
+      /**
+       * Stop a packmol process left behind by an earlier session with
+       * SIGTERM, or SIGKILL if @p kill is true. Only a process that still
+       * runs @p executable in @p workingDirectory is touched, so a reused pid
+       * is never hit. Linux only, elsewhere this does nothing.
+       * @return true if a signal was sent.
+       */
+      static bool terminateOrphan(qint64 pid, const QString &workingDirectory,
+          const QString &executable, bool kill);
+
+    protected:
+      void setupChildProcess();
+
+    private slots:
+      void killIfRunning();
+
+    private:
+      int m_cpuTimeLimit;
+  };
+
+} // end namespace Avogadro
+
+#endif
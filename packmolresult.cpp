@@ -0,0 +1,375 @@
+/**********************************************************************
+  PackmolResult - Read, combine and check packmol result files
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "packmolresult.h"
+#include "packmolgeometry.h"
+#include "resultreader.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QByteArray>
+
+#include <cmath>
+#include <cstdio>
+
+namespace Avogadro {
+
+  Decomposition decomposeSolvation(const SolvationSpec &spec, int numParts, double gap,
+      double minWidth)
+  {
+    Decomposition decomposition;
+    Eigen::Vector3d size = spec.max - spec.min;
+    int axis = 0;
+    for (int j = 1; j < 3; ++j)
+      if (size[j] > size[axis])
+        axis = j;
+    decomposition.axis = axis;
+
+    // an interior slab is size / numParts - gap wide, the outer ones are wider
+    double pitch = qMax(gap, minWidth) + gap;
+    if (pitch > 0.0)
+      numParts = qMin(numParts, static_cast<int>(std::floor(size[axis] / pitch)));
+    numParts = qMax(1, numParts);
+    double width = size[axis] / numParts;
+    double packedWidth = size[axis] - (numParts - 1) * gap; // all slabs together
+    int remaining = spec.solventNumber;
+    for (int i = 0; i < numParts; ++i) {
+      SolvationSpec part = spec;
+      // interior faces move back by half the gap
+      part.min[axis] = spec.min[axis] + i * width + (i ? 0.5 * gap : 0.0);
+      part.max[axis] = spec.min[axis] + (i + 1) * width - (i < numParts - 1 ? 0.5 * gap : 0.0);
+      if (i < numParts - 1) {
+        part.solventNumber = qRound(spec.solventNumber * (part.max[axis] - part.min[axis])
+            / packedWidth);
+        part.solventNumber = qMin(part.solventNumber, remaining);
+        decomposition.seams.append(spec.min[axis] + (i + 1) * width);
+      } else {
+        part.solventNumber = remaining;
+      }
+      remaining -= part.solventNumber;
+      decomposition.parts.append(part);
+    }
+
+    return decomposition;
+  }
+
+  Replication replicateSolvation(const SolvationSpec &spec, double cellSize, double tolerance)
+  {
+    Replication replication;
+    Eigen::Vector3d size = spec.max - spec.min;
+    for (int j = 0; j < 3; ++j) {
+      replication.copies[j] = qMax(1, qRound(size[j] / cellSize));
+      replication.period[j] = size[j] / replication.copies[j];
+    }
+
+    // the faces move in by half the tolerance, the copies' faces meet
+    replication.cell = spec;
+    replication.cell.min = spec.min + Eigen::Vector3d::Constant(0.5 * tolerance);
+    replication.cell.max = spec.min + replication.period - Eigen::Vector3d::Constant(0.5 * tolerance);
+    replication.cell.solventNumber = qMax(1, qRound(static_cast<double>(spec.solventNumber)
+          / replication.numCopies()));
+    return replication;
+  }
+
+  bool readResultPositions(const QString &fileName, const QString &fileType,
+      std::vector<Eigen::Vector3d> &positions)
+  {
+    ResultData data;
+    if (!readResult(fileName, fileType, data, false))
+      return false;
+    positions.swap(data.positions);
+    return true;
+  }
+
+  //! Renumber a pdb atom record, wrapping like packmol does for large systems
+  static void renumberAtom(QByteArray &line, int &serial, int residue)
+  {
+    serial = serial % 99999 + 1;
+    line.replace(6, 5, QByteArray::number(serial).rightJustified(5, ' '));
+    line.replace(22, 4, QByteArray::number((residue - 1) % 9999 + 1).rightJustified(4, ' '));
+  }
+
+  bool stitchResults(const QStringList &fileNames, const QString &fileType, 
+      const QString &output)
+  {
+    QFile out(output);
+    if (!out.open(QIODevice::WriteOnly))
+      return false;
+
+    if (fileType == "xyz") {
+      QList<QByteArray> atoms;
+      foreach (const QString &fileName, fileNames) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+          return false;
+        int numAtoms = file.readLine().trimmed().toInt();
+        file.readLine();
+        for (int i = 0; i < numAtoms && !file.atEnd(); ++i)
+          atoms.append(file.readLine());
+      }
+      out.write(QByteArray::number(atoms.size()) + "\n");
+      out.write("Built with Packmol (stitched)\n");
+      foreach (const QByteArray &line, atoms) {
+        out.write(line);
+        if (!line.endsWith('\n'))
+          out.write("\n");
+      }
+      return true;
+    }
+
+    // pdb, continue numbering where the previous part stopped
+    int serial = 0;
+    int residueOffset = 0;
+    for (int part = 0; part < fileNames.size(); ++part) {
+      QFile file(fileNames.at(part));
+      if (!file.open(QIODevice::ReadOnly))
+        return false;
+      int maxResidue = 0;
+      while (!file.atEnd()) {
+        QByteArray line = file.readLine();
+        if (line.startsWith("ATOM") || line.startsWith("HETATM")) {
+          if (line.size() < 27)
+            return false;
+          int residue = line.mid(22, 4).trimmed().toInt();
+          maxResidue = qMax(maxResidue, residue);
+          renumberAtom(line, serial, residue + residueOffset);
+          out.write(line);
+        } else if (line.startsWith("TER")) {
+          out.write("TER\n");
+        } else if (part == 0 && !line.startsWith("END") && !line.startsWith("CONECT")) {
+          out.write(line); // header records
+        }
+      }
+      residueOffset += maxResidue;
+    }
+    out.write("END\n");
+    return true;
+  }
+
+  bool replicateResult(const QString &cellFile, const QString &fileType,
+      const Replication &replication, const QString &output, QString *error)
+  {
+    QFile file(cellFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+      if (error)
+        *error = QString("Could not read %1").arg(cellFile);
+      return false;
+    }
+
+    // the cell's records, TER records are kept in place
+    QList<QByteArray> headers, atoms;
+    if (fileType == "xyz") {
+      int numAtoms = file.readLine().trimmed().toInt();
+      file.readLine();
+      for (int i = 0; i < numAtoms && !file.atEnd(); ++i)
+        atoms.append(file.readLine());
+    } else {
+      while (!file.atEnd()) {
+        QByteArray line = file.readLine();
+        if (line.startsWith("ATOM") || line.startsWith("HETATM")) {
+          if (line.size() < 54) {
+            if (error)
+              *error = QString("%1 has a truncated atom record").arg(cellFile);
+            return false;
+          }
+          atoms.append(line);
+        } else if (line.startsWith("TER")) {
+          atoms.append("TER\n");
+        } else if (atoms.isEmpty() && !line.startsWith("END") && !line.startsWith("CONECT")
+            && !line.startsWith("CRYST1")) {
+          headers.append(line);
+        }
+      }
+    }
+
+    if (fileType != "xyz") {
+      // %8.3f fills the pdb columns from -999.999 to 9999.999
+      Eigen::Vector3d min(Eigen::Vector3d::Constant(1e30)), max(Eigen::Vector3d::Constant(-1e30));
+      foreach (const QByteArray &line, atoms)
+        if (!line.startsWith("TER"))
+          for (int c = 0; c < 3; ++c) {
+            double value = line.mid(30 + 8 * c, 8).trimmed().toDouble();
+            min[c] = qMin(min[c], value);
+            max[c] = qMax(max[c], value + (replication.copies[c] - 1) * replication.period[c]);
+          }
+      if (min.minCoeff() < -999.999 || max.maxCoeff() > 9999.999) {
+        if (error)
+          *error = QString("The replicated box does not fit the PDB coordinate columns "
+              "(-999.999 to 9999.999 A), use xyz");
+        return false;
+      }
+    }
+
+    QFile out(output);
+    if (!out.open(QIODevice::WriteOnly)) {
+      if (error)
+        *error = QString("Could not write %1").arg(output);
+      return false;
+    }
+
+    char buffer[128];
+    int numAtoms = 0;
+    foreach (const QByteArray &line, atoms)
+      if (!line.startsWith("TER"))
+        ++numAtoms;
+    if (fileType == "xyz") {
+      out.write(QByteArray::number(numAtoms * replication.numCopies()) + "\n");
+      out.write("Built with Packmol (replicated)\n");
+    } else {
+      foreach (const QByteArray &line, headers)
+        out.write(line);
+      std::sprintf(buffer, "CRYST1%9.3f%9.3f%9.3f%7.2f%7.2f%7.2f P 1           1\n",
+          replication.copies[0] * replication.period[0], replication.copies[1] * replication.period[1],
+          replication.copies[2] * replication.period[2], 90.0, 90.0, 90.0);
+      out.write(buffer);
+    }
+
+    int serial = 0;
+    int residueOffset = 0;
+    for (int i = 0; i < replication.copies[0]; ++i)
+      for (int j = 0; j < replication.copies[1]; ++j)
+        for (int k = 0; k < replication.copies[2]; ++k) {
+          Eigen::Vector3d offset(i * replication.period[0], j * replication.period[1],
+              k * replication.period[2]);
+          int maxResidue = 0;
+          foreach (QByteArray line, atoms) {
+            if (line.startsWith("TER")) {
+              out.write(line);
+              continue;
+            }
+            if (fileType == "xyz") {
+              QList<QByteArray> fields = line.simplified().split(' ');
+              if (fields.size() < 4) {
+                if (error)
+                  *error = QString("%1 has a truncated atom line").arg(cellFile);
+                return false;
+              }
+              std::sprintf(buffer, " %14.6f %14.6f %14.6f\n", fields.at(1).toDouble() + offset[0],
+                  fields.at(2).toDouble() + offset[1], fields.at(3).toDouble() + offset[2]);
+              out.write(fields.at(0) + buffer);
+              continue;
+            }
+            for (int c = 0; c < 3; ++c) {
+              std::sprintf(buffer, "%8.3f", line.mid(30 + 8 * c, 8).trimmed().toDouble() + offset[c]);
+              line.replace(30 + 8 * c, 8, buffer);
+            }
+            int residue = line.mid(22, 4).trimmed().toInt();
+            maxResidue = qMax(maxResidue, residue);
+            renumberAtom(line, serial, residue + residueOffset);
+            out.write(line);
+          }
+          residueOffset += maxResidue;
+        }
+    if (fileType != "xyz")
+      out.write("END\n");
+    return true;
+  }
+
+  SeamReport validateSeams(const QList<std::vector<Eigen::Vector3d> > &parts,
+      const Decomposition &decomposition, double tolerance)
+  {
+    SeamReport report;
+    int axis = decomposition.axis;
+    double minDistance2 = -1.0;
+
+    for (int s = 0; s < decomposition.seams.size() && s + 1 < parts.size(); ++s) {
+      double seam = decomposition.seams.at(s);
+      // only atoms within the tolerance of the seam can form a bad pair
+      std::vector<Eigen::Vector3d> below, above;
+      for (std::size_t i = 0; i < parts[s].size(); ++i)
+        if (parts[s][i][axis] > seam - tolerance)
+          below.push_back(parts[s][i]);
+      for (std::size_t i = 0; i < parts[s + 1].size(); ++i)
+        if (parts[s + 1][i][axis] < seam + tolerance)
+          above.push_back(parts[s + 1][i]);
+      if (below.empty() || above.empty())
+        continue;
+
+      CellList cells(above, tolerance);
+      std::vector<int> neighbors;
+      for (std::size_t i = 0; i < below.size(); ++i) {
+        neighbors.clear();
+        cells.neighbors(below[i], tolerance, neighbors);
+        for (std::size_t n = 0; n < neighbors.size(); ++n) {
+          const Eigen::Vector3d &other = above[neighbors[n]];
+          double d2 = (below[i] - other).squaredNorm();
+          if (d2 < tolerance * tolerance)
+            ++report.numViolations;
+          if (minDistance2 < 0.0 || d2 < minDistance2) {
+            minDistance2 = d2;
+            report.worst = 0.5 * (below[i] + other);
+          }
+        }
+      }
+    }
+
+    if (minDistance2 >= 0.0)
+      report.minDistance = std::sqrt(minDistance2);
+    return report;
+  }
+
+  SeamReport validateReplication(const std::vector<Eigen::Vector3d> &positions,
+      const Replication &replication, double tolerance)
+  {
+    SeamReport report;
+    double minDistance2 = -1.0;
+    Eigen::Vector3d min = replication.cell.min - Eigen::Vector3d::Constant(0.5 * tolerance);
+    Eigen::Vector3d max = min + replication.period;
+
+    // atoms within the tolerance of a face meet the images of the next copy
+    CellList cells(positions, tolerance);
+    std::vector<int> neighbors;
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+      const Eigen::Vector3d &position = positions[i];
+      int low[3], high[3];
+      for (int c = 0; c < 3; ++c) {
+        bool repeated = replication.copies[c] > 1;
+        // near the upper face, the image one copy down lies near the lower face
+        low[c] = repeated && position[c] > max[c] - tolerance ? -1 : 0;
+        high[c] = repeated && position[c] < min[c] + tolerance ? 1 : 0;
+      }
+      for (int a = low[0]; a <= high[0]; ++a)
+        for (int b = low[1]; b <= high[1]; ++b)
+          for (int c = low[2]; c <= high[2]; ++c) {
+            if (!a && !b && !c)
+              continue;
+            Eigen::Vector3d image = position + Eigen::Vector3d(a * replication.period[0],
+                b * replication.period[1], c * replication.period[2]);
+            neighbors.clear();
+            cells.neighbors(image, tolerance, neighbors);
+            for (std::size_t n = 0; n < neighbors.size(); ++n) {
+              const Eigen::Vector3d &other = positions[neighbors[n]];
+              double d2 = (image - other).squaredNorm();
+              if (d2 < tolerance * tolerance)
+                ++report.numViolations;
+              if (minDistance2 < 0.0 || d2 < minDistance2) {
+                minDistance2 = d2;
+                report.worst = 0.5 * (image + other);
+              }
+            }
+          }
+    }
+
+    // every pair was seen from both sides
+    report.numViolations /= 2;
+    if (minDistance2 >= 0.0)
+      report.minDistance = std::sqrt(minDistance2);
+    return report;
+  }
+
+} // end namespace Avogadro
@@ -0,0 +1,122 @@
+/**********************************************************************
+  PackmolResult - Read, combine and check packmol result files
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef PACKMOLRESULT_H
+#define PACKMOLRESULT_H
+
+#include "inputgenerator.h"
+
+#include <Eigen/Core>
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+#include <vector>
+
+namespace Avogadro {
+
+  /**
+   * A pure solvent box split into slabs along its longest axis. The slabs
+   * are separated by a gap so molecules packed in neighboring slabs can't
+   * overlap when the constraints are met.
+   */
+  struct Decomposition
+  {
+    Decomposition() : axis(0) {}
+
+    int axis;                  // 0, 1 or 2
+    QList<SolvationSpec> parts;
+    QList<double> seams;       // planes halfway between consecutive parts
+  };
+
+  /**
+   * Split @p spec (a box without solute) in @p numParts slabs with @p gap
+   * between them. The solvent molecules are distributed by slab volume.
+   * There are fewer slabs if they would be narrower than the gap or
+   * @p minWidth, e.g. the diameter of a solvent molecule.
+   */
+  Decomposition decomposeSolvation(const SolvationSpec &spec, int numParts, double gap,
+      double minWidth = 0.0);
+
+  /**
+   * A pure solvent box packed as one small cell that is repeated to fill
+   * it. The cell is packed half a tolerance inside its faces, so molecules
+   * in neighboring copies (and periodic images of the whole box) are a
+   * tolerance apart when the constraints are met.
+   */
+  struct Replication
+  {
+    Replication() : period(Eigen::Vector3d::Zero()) { copies[0] = copies[1] = copies[2] = 1; }
+
+    SolvationSpec cell;        // the packed cell, at the box's lower corner
+    int copies[3];             // along x, y and z
+    Eigen::Vector3d period;    // cell size, the box size is copies * period
+
+    int numCopies() const { return copies[0] * copies[1] * copies[2]; }
+  };
+
+  /**
+   * Cells of about @p cellSize filling @p spec (a box without solute). The
+   * cell gets the solvent molecules of @p spec by volume, so the density of
+   * the whole box follows the spec's number.
+   */
+  Replication replicateSolvation(const SolvationSpec &spec, double cellSize, double tolerance);
+
+  /**
+   * Write the copies of the packed cell @p cellFile to @p output. PDB files
+   * are renumbered like stitchResults() and get a CRYST1 record for the
+   * whole box. Fails without writing if a copy doesn't fit the PDB
+   * coordinate columns.
+   */
+  bool replicateResult(const QString &cellFile, const QString &fileType,
+      const Replication &replication, const QString &output, QString *error = 0);
+
+  /**
+   * The atom positions in a packmol result (@p fileType pdb or xyz).
+   */
+  bool readResultPositions(const QString &fileName, const QString &fileType,
+      std::vector<Eigen::Vector3d> &positions);
+
+  /**
+   * Concatenate packmol results into @p output. PDB atom serials and
+   * residue numbers are renumbered, CONECT records are dropped.
+   */
+  bool stitchResults(const QStringList &fileNames, const QString &fileType, 
+      const QString &output);
+
+  struct SeamReport
+  {
+    SeamReport() : numViolations(0), minDistance(-1.0), worst(Eigen::Vector3d::Zero()) {}
+
+    int numViolations;         // atom pairs across a seam closer than the tolerance
+    double minDistance;        // closest pair across any seam, -1.0 if none near
+    Eigen::Vector3d worst;     // midpoint of the closest pair
+  };
+
+  //! Check atoms of neighboring parts (@p parts in decomposition order) across the seams
+  SeamReport validateSeams(const QList<std::vector<Eigen::Vector3d> > &parts,
+      const Decomposition &decomposition, double tolerance);
+
+  //! Check atoms of the packed cell @p positions against its images in the neighboring copies
+  SeamReport validateReplication(const std::vector<Eigen::Vector3d> &positions,
+      const Replication &replication, double tolerance);
+
+} // end namespace Avogadro
+
+#endif
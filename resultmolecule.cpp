@@ -0,0 +1,71 @@
+/**********************************************************************
+  ResultMolecule - Build and update molecules from packmol results
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "resultmolecule.h"
+#include "resultreader.h"
+
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+#include <avogadro/molecule.h>
+#include <avogadro/residue.h>
+
+namespace Avogadro {
+
+  Molecule* resultMolecule(const ResultData &data)
+  {
+    Molecule *molecule = new Molecule;
+    std::vector<unsigned long> ids(data.numAtoms());
+    for (int i = 0; i < data.numAtoms(); ++i) {
+      Atom *atom = molecule->addAtom();
+      atom->setAtomicNumber(data.atomicNumbers[i]);
+      if (data.formalCharges[i])
+        atom->setFormalCharge(data.formalCharges[i]);
+      atom->setPos(data.positions[i]);
+      ids[i] = atom->id();
+    }
+    for (std::size_t i = 0; i < data.bonds.size(); ++i) {
+      Bond *bond = molecule->addBond();
+      bond->setAtoms(ids[data.bonds[i].first], ids[data.bonds[i].second],
+          data.bondOrders.empty() ? 1 : data.bondOrders[i]);
+    }
+    for (std::size_t r = 0; r < data.residues.size(); ++r) {
+      const ResultResidue &result = data.residues[r];
+      Residue *residue = molecule->addResidue();
+      residue->setName(QString(result.name).trimmed());
+      residue->setNumber(QString(result.number).trimmed());
+      residue->setChainID(result.chain);
+      for (int i = result.firstAtom; i < result.firstAtom + result.numAtoms; ++i) {
+        residue->addAtom(ids[i]);
+        residue->setAtomId(ids[i], data.atomName(i));
+      }
+    }
+    return molecule;
+  }
+
+  bool updateResultMolecule(Molecule *molecule, const ResultData &data)
+  {
+    if (static_cast<int>(molecule->numAtoms()) != data.numAtoms())
+      return false;
+    int i = 0;
+    foreach (Atom *atom, molecule->atoms())
+      atom->setPos(data.positions[i++]);
+    molecule->update();
+    return true;
+  }
+
+} // end namespace Avogadro
@@ -0,0 +1,42 @@
+/**********************************************************************
+  ResultMolecule - Build and update molecules from packmol results
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef RESULTMOLECULE_H
+#define RESULTMOLECULE_H
+
+namespace Avogadro {
+
+  class Molecule;
+  struct ResultData;
+
+  /**
+   * Build a Molecule straight from a parsed result, without going through
+   * an OBMol. Atoms are added in file order.
+   */
+  Molecule* resultMolecule(const ResultData &data);
+
+  /**
+   * Move the atoms of @p molecule (built by resultMolecule()) to the
+   * positions in @p data, keeping the atom objects.
+   * @return false if the number of atoms differs.
+   */
+  bool updateResultMolecule(Molecule *molecule, const ResultData &data);
+
+} // end namespace Avogadro
+
+#endif
@@ -0,0 +1,156 @@
+/**********************************************************************
+  ResultPreview - Follow the intermediate results of a running job
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "resultpreview.h"
+#include "resultreader.h"
+#include "resultmolecule.h"
+
+#include <avogadro/molecule.h>
+
+#include <QFileSystemWatcher>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+#include <QtConcurrentRun>
+
+namespace Avogadro {
+
+  struct PreviewSnapshot
+  {
+    int generation;
+    bool ok;
+    ResultData data;
+  };
+
+  static PreviewSnapshot readPreview(int generation, const QString &fileName,
+      const QString &fileType, int numAtoms, bool perceiveBonds)
+  {
+    PreviewSnapshot snapshot;
+    snapshot.generation = generation;
+    // a file packmol is still writing fails to parse or ends early, the next change brings it
+    snapshot.ok = readResult(fileName, fileType, snapshot.data, perceiveBonds);
+    if (numAtoms && snapshot.data.numAtoms() != numAtoms)
+      snapshot.ok = false;
+    return snapshot;
+  }
+
+  ResultPreview::ResultPreview(QObject *parent) : QObject(parent), m_numAtoms(0),
+      m_generation(0), m_snapshots(0), m_created(false), m_pending(false)
+  {
+    m_watcher = new QFileSystemWatcher(this);
+    connect(m_watcher, SIGNAL(fileChanged(QString)), this, SLOT(pathChanged()));
+    connect(m_watcher, SIGNAL(directoryChanged(QString)), this, SLOT(pathChanged()));
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    m_timer->setInterval(1000);
+    connect(m_timer, SIGNAL(timeout()), this, SLOT(readSnapshot()));
+    m_future = new QFutureWatcher<PreviewSnapshot>(this);
+    connect(m_future, SIGNAL(finished()), this, SLOT(readFinished()));
+  }
+
+  ResultPreview::~ResultPreview()
+  {
+    m_future->waitForFinished();
+  }
+
+  void ResultPreview::setInterval(int msec)
+  {
+    m_timer->setInterval(msec);
+  }
+
+  void ResultPreview::start(const QString &fileName, const QString &fileType, int numAtoms)
+  {
+    stop();
+    m_fileName = fileName;
+    m_fileType = fileType;
+    m_numAtoms = numAtoms;
+    m_molecule = 0;
+    m_snapshots = 0;
+    m_created = false;
+    // packmol replaces the file, the directory tells when it is back
+    m_watcher->addPath(QFileInfo(fileName).absolutePath());
+    if (QFile::exists(fileName)) {
+      m_watcher->addPath(fileName);
+      m_timer->start();
+    }
+  }
+
+  void ResultPreview::stop()
+  {
+    ++m_generation;
+    m_timer->stop();
+    m_pending = false;
+    if (!m_watcher->files().isEmpty())
+      m_watcher->removePaths(m_watcher->files());
+    if (!m_watcher->directories().isEmpty())
+      m_watcher->removePaths(m_watcher->directories());
+    m_fileName.clear();
+  }
+
+  void ResultPreview::pathChanged()
+  {
+    if (m_fileName.isEmpty() || !QFile::exists(m_fileName))
+      return;
+    if (!m_watcher->files().contains(m_fileName))
+      m_watcher->addPath(m_fileName);
+    // throttle: the first change starts the timer, later ones ride along
+    if (!m_timer->isActive())
+      m_timer->start();
+  }
+
+  void ResultPreview::readSnapshot()
+  {
+    if (m_fileName.isEmpty())
+      return;
+    if (m_future->isRunning()) {
+      m_pending = true;
+      return;
+    }
+    m_future->setFuture(QtConcurrent::run(readPreview, m_generation, m_fileName, m_fileType,
+          m_numAtoms, !m_created));
+  }
+
+  void ResultPreview::readFinished()
+  {
+    // a change seen during the read may belong to a job started meanwhile
+    PreviewSnapshot snapshot = m_future->result();
+    if (m_pending) {
+      m_pending = false;
+      m_timer->start();
+    }
+    if (snapshot.generation != m_generation)
+      return;
+    if (!snapshot.ok)
+      return;
+
+    if (m_created) {
+      // every new molecule would open another window
+      if (m_molecule && updateResultMolecule(m_molecule, snapshot.data))
+        emit snapshotRead(++m_snapshots);
+      return;
+    }
+    // the bonds were perceived on the worker
+    m_molecule = resultMolecule(snapshot.data);
+    m_created = true;
+    emit moleculeCreated(m_molecule);
+    emit snapshotRead(++m_snapshots);
+  }
+
+} // end namespace Avogadro
+
+#include "resultpreview.moc"
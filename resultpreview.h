@@ -0,0 +1,89 @@
+/**********************************************************************
+  ResultPreview - Follow the intermediate results of a running job
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef RESULTPREVIEW_H
+#define RESULTPREVIEW_H
+
+#include <QObject>
+#include <QString>
+#include <QPointer>
+#include <QFutureWatcher>
+
+class QFileSystemWatcher;
+class QTimer;
+
+namespace Avogadro {
+
+  class Molecule;
+  struct PreviewSnapshot;
+
+  /**
+   * Follows the result file packmol rewrites every writeout loops. The
+   * file is watched with a QFileSystemWatcher, reads are throttled to one
+   * per interval and run on a worker thread. The first snapshot creates
+   * the preview molecule, later ones only move its atoms. Snapshots with
+   * another number of atoms are reads of a half written file and dropped.
+   */
+  class ResultPreview : public QObject
+  {
+    Q_OBJECT
+
+    public:
+      ResultPreview(QObject *parent = 0);
+      ~ResultPreview();
+
+      /**
+       * Follow @p fileName (pdb or xyz), which doesn't have to exist yet.
+       * @param numAtoms The atoms of a complete result, 0 if unknown.
+       */
+      void start(const QString &fileName, const QString &fileType, int numAtoms = 0);
+      void stop();
+      bool isActive() const { return !m_fileName.isEmpty(); }
+
+      //! Minimum time between two reads in milliseconds
+      void setInterval(int msec);
+      //! The current preview, 0 before the first snapshot or once it was closed
+      Molecule* molecule() const { return m_molecule; }
+
+    signals:
+      //! A new preview molecule, owned by the receiver
+      void moleculeCreated(Molecule *molecule);
+      void snapshotRead(int snapshot);
+
+    private slots:
+      void pathChanged();
+      void readSnapshot();
+      void readFinished();
+
+    private:
+      QFileSystemWatcher *m_watcher;
+      QTimer *m_timer;
+      QFutureWatcher<PreviewSnapshot> *m_future;
+      QPointer<Molecule> m_molecule;
+      QString m_fileName;
+      QString m_fileType;
+      int m_numAtoms;
+      int m_generation;        // bumped by start() and stop(), stale reads are dropped
+      int m_snapshots;
+      bool m_created;          // the molecule is created once, even if it was closed
+      bool m_pending;          // the file changed while it was read
+  };
+
+} // end namespace Avogadro
+
+#endif
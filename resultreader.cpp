@@ -0,0 +1,570 @@
+/**********************************************************************
+  ResultReader - Fast reader for packmol's pdb and xyz results
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "resultreader.h"
+#include "packmolgeometry.h"
+
+#include <QFile>
+#include <QThread>
+#include <QtConcurrentMap>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace Avogadro {
+
+  static const char *elementSymbols[] = { "Xx",
+    "H", "He", "Li", "Be", "B", "C", "N", "O", "F", "Ne", "Na", "Mg", "Al", "Si", "P", "S",
+    "Cl", "Ar", "K", "Ca", "Sc", "Ti", "V", "Cr", "Mn", "Fe", "Co", "Ni", "Cu", "Zn", "Ga",
+    "Ge", "As", "Se", "Br", "Kr", "Rb", "Sr", "Y", "Zr", "Nb", "Mo", "Tc", "Ru", "Rh", "Pd",
+    "Ag", "Cd", "In", "Sn", "Sb", "Te", "I", "Xe", "Cs", "Ba", "La", "Ce", "Pr", "Nd", "Pm",
+    "Sm", "Eu", "Gd", "Tb", "Dy", "Ho", "Er", "Tm", "Yb", "Lu", "Hf", "Ta", "W", "Re", "Os",
+    "Ir", "Pt", "Au", "Hg", "Tl", "Pb", "Bi", "Po", "At", "Rn", "Fr", "Ra", "Ac", "Th", "Pa",
+    "U", "Np", "Pu", "Am", "Cm", "Bk", "Cf", "Es", "Fm", "Md", "No", "Lr", "Rf", "Db", "Sg",
+    "Bh", "Hs", "Mt", "Ds", "Rg", "Cn" };
+  static const int numElements = sizeof(elementSymbols) / sizeof(elementSymbols[0]);
+
+  // covalent radii (Cordero et al. 2008) up to xenon, 1.5 A beyond
+  static const double covalentRadii[] = { 0.0,
+    0.31, 0.28, 1.28, 0.96, 0.84, 0.76, 0.71, 0.66, 0.57, 0.58, 1.66, 1.41, 1.21, 1.11, 1.07,
+    1.05, 1.02, 1.06, 2.03, 1.76, 1.70, 1.60, 1.53, 1.39, 1.39, 1.32, 1.26, 1.24, 1.32, 1.22,
+    1.22, 1.20, 1.19, 1.20, 1.20, 1.16, 2.20, 1.95, 1.90, 1.75, 1.64, 1.54, 1.47, 1.46, 1.42,
+    1.39, 1.45, 1.44, 1.42, 1.39, 1.39, 1.38, 1.39, 1.40 };
+  static const int numRadii = sizeof(covalentRadii) / sizeof(covalentRadii[0]);
+
+  static double covalentRadius(int atomicNumber)
+  {
+    return atomicNumber > 0 && atomicNumber < numRadii ? covalentRadii[atomicNumber] : 1.5;
+  }
+
+  /**
+   * Symbol lookup by the (upper, lower) letter pair, filled before main()
+   * so the parser threads only read it.
+   */
+  class ElementTable
+  {
+    public:
+      ElementTable()
+      {
+        std::fill(m_numbers, m_numbers + 26 * 27, 0);
+        for (int i = 1; i < numElements; ++i)
+          m_numbers[code(elementSymbols[i][0], elementSymbols[i][1])] = i;
+      }
+
+      int number(char first, char second) const
+      {
+        if (first >= 'a' && first <= 'z')
+          first -= 'a' - 'A';
+        if (second >= 'A' && second <= 'Z')
+          second += 'a' - 'A';
+        if (first < 'A' || first > 'Z' || (second && (second < 'a' || second > 'z')))
+          return 0;
+        return m_numbers[code(first, second)];
+      }
+
+    private:
+      static int code(char first, char second)
+      {
+        return (first - 'A') * 27 + (second ? second - 'a' + 1 : 0);
+      }
+
+      int m_numbers[26 * 27];
+  };
+
+  static const ElementTable elementTable;
+
+  int elementNumber(const char *symbol, int length)
+  {
+    const char *end = symbol + length;
+    while (symbol < end && *symbol == ' ')
+      ++symbol;
+    while (end > symbol && end[-1] == ' ')
+      --end;
+    if (symbol == end || end - symbol > 2)
+      return 0;
+    if (*symbol >= '0' && *symbol <= '9') {
+      int number = 0;
+      for (; symbol < end && *symbol >= '0' && *symbol <= '9'; ++symbol)
+        number = 10 * number + (*symbol - '0');
+      return symbol == end && number < numElements ? number : 0;
+    }
+    return elementTable.number(symbol[0], end - symbol == 2 ? symbol[1] : 0);
+  }
+
+  static bool isLetter(char c)
+  {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+  }
+
+  /**
+   * Parse a number that fills [@p p, @p end) apart from blanks. strtod
+   * can't be used on the mapped file, it may read past the last line.
+   */
+  static bool parseNumber(const char *p, const char *end, double &value)
+  {
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    while (p < end && (*p == ' ' || *p == '\t'))
+      ++p;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+      --end;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+      negative = *p++ == '-';
+
+    double mantissa = 0.0;
+    int exponent = 0;
+    bool digits = false;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, digits = true)
+      mantissa = 10.0 * mantissa + (*p - '0');
+    if (p < end && *p == '.')
+      for (++p; p < end && *p >= '0' && *p <= '9'; ++p, digits = true, --exponent)
+        mantissa = 10.0 * mantissa + (*p - '0');
+    if (!digits)
+      return false;
+    if (p < end && (*p == 'e' || *p == 'E' || *p == 'd' || *p == 'D')) {
+      ++p;
+      bool negativeExponent = false;
+      if (p < end && (*p == '-' || *p == '+'))
+        negativeExponent = *p++ == '-';
+      int e = 0;
+      for (digits = false; p < end && *p >= '0' && *p <= '9'; ++p, digits = true)
+        e = 10 * e + (*p - '0');
+      if (!digits)
+        return false;
+      exponent += negativeExponent ? -e : e;
+    }
+    if (p != end)
+      return false;
+
+    // dividing by an exact power of ten keeps "1.234" correctly rounded
+    if (exponent < 0 && exponent >= -22)
+      mantissa /= powers[-exponent];
+    else if (exponent > 0 && exponent <= 22)
+      mantissa *= powers[exponent];
+    else if (exponent)
+      mantissa *= std::pow(10.0, exponent);
+    value = negative ? -mantissa : mantissa;
+    return true;
+  }
+
+  static bool sameResidue(const ResultResidue &a, const ResultResidue &b)
+  {
+    return a.chain == b.chain && !std::strcmp(a.name, b.name) && !std::strcmp(a.number, b.number);
+  }
+
+  /**
+   * The lines in [begin, end) of the mapped file, parsed by one thread.
+   */
+  struct ParseChunk
+  {
+    const char *begin, *end;
+    bool pdb;
+    ResultData data;
+    bool breakBefore;          // a TER record precedes the first atom
+    const char *badLine;       // first line that could not be parsed
+
+    void parse()
+    {
+      breakBefore = false;
+      badLine = 0;
+      bool newResidue = true;
+      const char *line = begin;
+      while (line < end) {
+        const char *next = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        const char *lineEnd = next ? next : end;
+        next = next ? next + 1 : end;
+        if (lineEnd > line && lineEnd[-1] == '\r')
+          --lineEnd;
+
+        bool ok = true;
+        if (pdb) {
+          int length = lineEnd - line;
+          if ((length >= 4 && !std::strncmp(line, "ATOM", 4))
+              || (length >= 6 && !std::strncmp(line, "HETATM", 6))) {
+            ok = parseAtom(line, length, newResidue);
+            newResidue = false;
+          } else if (length >= 3 && !std::strncmp(line, "TER", 3)) {
+            if (data.positions.empty())
+              breakBefore = true;
+            newResidue = true;
+          }
+        } else {
+          ok = parseXyz(line, lineEnd);
+        }
+
+        if (!ok) {
+          badLine = line;
+          return;
+        }
+        line = next;
+      }
+    }
+
+    bool parseAtom(const char *line, int length, bool newResidue)
+    {
+      if (length < 54)
+        return false;
+      Eigen::Vector3d pos;
+      if (!parseNumber(line + 30, line + 38, pos[0]) || !parseNumber(line + 38, line + 46, pos[1])
+          || !parseNumber(line + 46, line + 54, pos[2]))
+        return false;
+
+      const char *name = line + 12;
+      int atomicNumber = 0;
+      if (length >= 78)
+        atomicNumber = elementNumber(line + 76, 2);
+      if (!atomicNumber) {
+        // no element columns: two letter elements start in column 13,
+        // except for 4 character hydrogen names such as HG11 and numbered
+        // atoms (C1, O12). Digits in names are never atomic numbers.
+        if (name[0] == 'H' && name[3] != ' ') {
+          atomicNumber = 1;
+        } else if (isLetter(name[0])) {
+          if (isLetter(name[1]))
+            atomicNumber = elementNumber(name, 2);
+          if (!atomicNumber)
+            atomicNumber = elementNumber(name, 1);
+        } else if (isLetter(name[1])) {
+          atomicNumber = elementNumber(name + 1, 1);
+        }
+      }
+      int charge = 0;
+      if (length >= 80 && line[78] >= '0' && line[78] <= '9'
+          && (line[79] == '+' || line[79] == '-'))
+        charge = (line[79] == '-' ? -1 : 1) * (line[78] - '0');
+
+      ResultResidue residue;
+      std::memcpy(residue.name, line + 17, 3);
+      residue.name[3] = 0;
+      std::memcpy(residue.number, line + 22, 5);
+      residue.number[5] = 0;
+      residue.chain = line[21];
+      residue.firstAtom = data.numAtoms();
+      residue.numAtoms = 1;
+      if (newResidue || data.residues.empty() || !sameResidue(data.residues.back(), residue))
+        data.residues.push_back(residue);
+      else
+        ++data.residues.back().numAtoms;
+
+      data.positions.push_back(pos);
+      data.atomicNumbers.push_back(atomicNumber);
+      data.formalCharges.push_back(charge);
+      data.atomNames.insert(data.atomNames.end(), name, name + 4);
+      return true;
+    }
+
+    bool parseXyz(const char *line, const char *lineEnd)
+    {
+      const char *tokens[4][2];
+      int numTokens = 0;
+      for (const char *p = line; p < lineEnd && numTokens < 4; ) {
+        while (p < lineEnd && (*p == ' ' || *p == '\t'))
+          ++p;
+        if (p == lineEnd)
+          break;
+        tokens[numTokens][0] = p;
+        while (p < lineEnd && *p != ' ' && *p != '\t')
+          ++p;
+        tokens[numTokens++][1] = p;
+      }
+      if (!numTokens)
+        return true; // blank line
+      Eigen::Vector3d pos;
+      if (numTokens < 4 || !parseNumber(tokens[1][0], tokens[1][1], pos[0])
+          || !parseNumber(tokens[2][0], tokens[2][1], pos[1])
+          || !parseNumber(tokens[3][0], tokens[3][1], pos[2]))
+        return false;
+      data.positions.push_back(pos);
+      data.atomicNumbers.push_back(elementNumber(tokens[0][0], tokens[0][1] - tokens[0][0]));
+      data.formalCharges.push_back(0);
+      return true;
+    }
+  };
+
+  QByteArray ResultData::atomName(int atom) const
+  {
+    if (atomNames.empty())
+      return QByteArray();
+    return QByteArray(&atomNames[4 * atom], 4).trimmed();
+  }
+
+  void ResultData::clear()
+  {
+    positions.clear();
+    atomicNumbers.clear();
+    formalCharges.clear();
+    atomNames.clear();
+    residues.clear();
+    bonds.clear();
+    bondOrders.clear();
+  }
+
+  bool readResult(const QString &fileName, const QString &fileType, ResultData &data,
+      bool perceiveBonds, QString *error)
+  {
+    data.clear();
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+      if (error)
+        *error = QString("Could not open %1").arg(fileName);
+      return false;
+    }
+
+    // not every file system can be mapped
+    qint64 size = file.size();
+    QByteArray contents;
+    const char *begin = size ? reinterpret_cast<const char*>(file.map(0, size)) : 0;
+    if (!begin) {
+      contents = file.readAll();
+      begin = contents.constData();
+      size = contents.size();
+    }
+    const char *end = begin + size;
+
+    bool pdb = fileType.toLower() == "pdb";
+    int expected = -1;
+    if (!pdb) {
+      // xyz: count and comment line
+      for (int i = 0; i < 2 && begin < end; ++i) {
+        const char *lineEnd = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        lineEnd = lineEnd ? lineEnd : end;
+        double count;
+        if (!i && parseNumber(begin, lineEnd > begin && lineEnd[-1] == '\r' ? lineEnd - 1 : lineEnd,
+              count))
+          expected = static_cast<int>(count);
+        begin = lineEnd < end ? lineEnd + 1 : end;
+      }
+      if (expected < 0) {
+        if (error)
+          *error = QString("%1 does not start with the number of atoms").arg(fileName);
+        return false;
+      }
+    }
+
+    // chunks of whole lines, a few per thread to even out the load
+    int numChunks = std::max(1, std::min(4 * std::max(1, QThread::idealThreadCount()),
+          static_cast<int>((end - begin) / 65536)));
+    std::vector<ParseChunk> chunks(numChunks);
+    const char *chunkBegin = begin;
+    for (int c = 0; c < numChunks; ++c) {
+      const char *chunkEnd = c + 1 == numChunks ? end : begin + (end - begin) * (c + 1) / numChunks;
+      if (chunkEnd < chunkBegin)
+        chunkEnd = chunkBegin;
+      const char *newline = static_cast<const char*>(std::memchr(chunkEnd, '\n', end - chunkEnd));
+      chunkEnd = newline ? newline + 1 : end;
+      chunks[c].begin = chunkBegin;
+      chunks[c].end = chunkEnd;
+      chunks[c].pdb = pdb;
+      chunkBegin = chunkEnd;
+    }
+    QtConcurrent::blockingMap(chunks, &ParseChunk::parse);
+
+    std::size_t numAtoms = 0, numResidues = 0;
+    for (int c = 0; c < numChunks; ++c) {
+      if (chunks[c].badLine) {
+        if (error) {
+          const char *lineEnd = static_cast<const char*>(std::memchr(chunks[c].badLine, '\n',
+                end - chunks[c].badLine));
+          *error = QString("Could not parse \"%1\"").arg(QString::fromLatin1(chunks[c].badLine,
+                (lineEnd ? lineEnd : end) - chunks[c].badLine).trimmed());
+        }
+        return false;
+      }
+      numAtoms += chunks[c].data.positions.size();
+      numResidues += chunks[c].data.residues.size();
+    }
+
+    data.positions.reserve(numAtoms);
+    data.atomicNumbers.reserve(numAtoms);
+    data.formalCharges.reserve(numAtoms);
+    data.atomNames.reserve(pdb ? 4 * numAtoms : 0);
+    data.residues.reserve(numResidues);
+    for (int c = 0; c < numChunks; ++c) {
+      ResultData &part = chunks[c].data;
+      int offset = data.numAtoms();
+      for (std::size_t r = 0; r < part.residues.size(); ++r) {
+        ResultResidue residue = part.residues[r];
+        residue.firstAtom += offset;
+        // a residue split over two chunks
+        if (!r && !chunks[c].breakBefore && !data.residues.empty()
+            && sameResidue(data.residues.back(), residue))
+          data.residues.back().numAtoms += residue.numAtoms;
+        else
+          data.residues.push_back(residue);
+      }
+      data.positions.insert(data.positions.end(), part.positions.begin(), part.positions.end());
+      data.atomicNumbers.insert(data.atomicNumbers.end(), part.atomicNumbers.begin(),
+          part.atomicNumbers.end());
+      data.formalCharges.insert(data.formalCharges.end(), part.formalCharges.begin(),
+          part.formalCharges.end());
+      data.atomNames.insert(data.atomNames.end(), part.atomNames.begin(), part.atomNames.end());
+      part.clear();
+    }
+
+    if (!pdb && data.numAtoms() != expected) {
+      if (error)
+        *error = QString("%1 has %2 atoms instead of %3").arg(fileName)
+            .arg(data.numAtoms()).arg(expected);
+      return false;
+    }
+    if (!data.numAtoms()) {
+      if (error)
+        *error = QString("%1 has no atoms").arg(fileName);
+      return false;
+    }
+
+    if (perceiveBonds)
+      perceiveResultBonds(data);
+    return true;
+  }
+
+  /**
+   * Bonds of the atoms in [begin, end) to atoms with a higher index.
+   */
+  struct BondChunk
+  {
+    const ResultData *data;
+    const CellList *cells;
+    const std::vector<int> *atomResidue; // empty if all atoms may bond
+    double cutoff;
+    int begin, end;
+    std::vector<std::pair<int, int> > bonds;
+
+    void perceive()
+    {
+      std::vector<int> neighbors;
+      const std::vector<Eigen::Vector3d> &positions = data->positions;
+      for (int i = begin; i < end; ++i) {
+        neighbors.clear();
+        cells->neighbors(positions[i], cutoff, neighbors);
+        std::sort(neighbors.begin(), neighbors.end());
+        double radius = covalentRadius(data->atomicNumbers[i]);
+        for (std::size_t n = 0; n < neighbors.size(); ++n) {
+          int j = neighbors[n];
+          if (j <= i || (!atomResidue->empty() && (*atomResidue)[i] != (*atomResidue)[j]))
+            continue;
+          double max = radius + covalentRadius(data->atomicNumbers[j]) + 0.45;
+          double d2 = (positions[i] - positions[j]).squaredNorm();
+          if (d2 > 0.16 && d2 < max * max)
+            bonds.push_back(std::make_pair(i, j));
+        }
+      }
+    }
+  };
+
+  void perceiveResultBonds(ResultData &data)
+  {
+    data.bonds.clear();
+    data.bondOrders.clear();
+    int numAtoms = data.numAtoms();
+    if (numAtoms < 2)
+      return;
+
+    std::vector<int> atomResidue;
+    if (!data.residues.empty()) {
+      atomResidue.resize(numAtoms);
+      for (std::size_t r = 0; r < data.residues.size(); ++r)
+        std::fill(atomResidue.begin() + data.residues[r].firstAtom, atomResidue.begin()
+            + data.residues[r].firstAtom + data.residues[r].numAtoms, static_cast<int>(r));
+    }
+
+    double maxRadius = 0.0;
+    for (int i = 0; i < numAtoms; ++i)
+      maxRadius = std::max(maxRadius, covalentRadius(data.atomicNumbers[i]));
+    double cutoff = 2.0 * maxRadius + 0.45;
+    CellList cells(data.positions, cutoff);
+
+    int numChunks = std::min(numAtoms, 4 * std::max(1, QThread::idealThreadCount()));
+    std::vector<BondChunk> chunks(numChunks);
+    for (int c = 0; c < numChunks; ++c) {
+      BondChunk &chunk = chunks[c];
+      chunk.data = &data;
+      chunk.cells = &cells;
+      chunk.atomResidue = &atomResidue;
+      chunk.cutoff = cutoff;
+      chunk.begin = static_cast<int>(static_cast<qint64>(numAtoms) * c / numChunks);
+      chunk.end = static_cast<int>(static_cast<qint64>(numAtoms) * (c + 1) / numChunks);
+    }
+    QtConcurrent::blockingMap(chunks, &BondChunk::perceive);
+
+    for (int c = 0; c < numChunks; ++c)
+      data.bonds.insert(data.bonds.end(), chunks[c].bonds.begin(), chunks[c].bonds.end());
+  }
+
+  bool applyTemplateTopology(const PackingProblem &problem, ResultData &data)
+  {
+    std::size_t numAtoms = 0, numBonds = 0;
+    int numMolecules = 0;
+    foreach (const PackingStructure &structure, problem.structures) {
+      if (structure.atomicNumbers.empty())
+        return false;
+      numAtoms += structure.number * structure.atomicNumbers.size();
+      numBonds += structure.number * structure.bonds.size();
+      numMolecules += structure.number;
+    }
+    if (numAtoms != data.positions.size())
+      return false;
+
+    data.atomicNumbers.resize(numAtoms, 0);
+    data.formalCharges.resize(numAtoms, 0);
+    data.bonds.clear();
+    data.bondOrders.clear();
+    data.bonds.reserve(numBonds);
+    data.bondOrders.reserve(numBonds);
+    bool addResidues = data.residues.empty();
+    if (addResidues)
+      data.residues.reserve(numMolecules);
+
+    int first = 0;
+    foreach (const PackingStructure &structure, problem.structures) {
+      int size = static_cast<int>(structure.atomicNumbers.size());
+      ResultResidue residue;
+      std::memset(residue.name, 0, sizeof(residue.name));
+      std::strncpy(residue.name, structure.residueName.isEmpty() ? "UNK"
+          : structure.residueName.constData(), 3);
+      residue.chain = ' ';
+      residue.numAtoms = size;
+
+      for (int copy = 0; copy < structure.number; ++copy, first += size) {
+        for (int i = 0; i < size; ++i) {
+          if (structure.atomicNumbers[i])
+            data.atomicNumbers[first + i] = structure.atomicNumbers[i];
+          if (i < static_cast<int>(structure.formalCharges.size()))
+            data.formalCharges[first + i] = structure.formalCharges[i];
+        }
+        for (std::size_t b = 0; b < structure.bonds.size(); ++b) {
+          data.bonds.push_back(std::make_pair(first + structure.bonds[b].first,
+                first + structure.bonds[b].second));
+          data.bondOrders.push_back(b < structure.bondOrders.size() ? structure.bondOrders[b] : 1);
+        }
+        if (addResidues) {
+          // pdb's 4 digit residue numbers, as packmol writes them
+          std::sprintf(residue.number, "%4d ", (copy + 1) % 10000);
+          residue.firstAtom = first;
+          data.residues.push_back(residue);
+        }
+      }
+    }
+    return true;
+  }
+
+} // end namespace Avogadro
@@ -0,0 +1,94 @@
+/**********************************************************************
+  ResultReader - Fast reader for packmol's pdb and xyz results
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef RESULTREADER_H
+#define RESULTREADER_H
+
+#include "packingengine.h"
+
+#include <Eigen/Core>
+
+#include <QByteArray>
+#include <QString>
+
+#include <utility>
+#include <vector>
+
+namespace Avogadro {
+
+  struct ResultResidue
+  {
+    char name[4];              // residue name, columns 18-20
+    char number[6];            // residue sequence number and insertion code, columns 23-27
+    char chain;
+    int firstAtom;
+    int numAtoms;
+  };
+
+  /**
+   * The atoms of a packmol result, stored flat so a million atoms cost a
+   * few arrays instead of a million objects.
+   */
+  struct ResultData
+  {
+    std::vector<Eigen::Vector3d> positions;
+    std::vector<int> atomicNumbers;
+    std::vector<int> formalCharges;
+    std::vector<char> atomNames;          // 4 characters per atom, pdb only
+    std::vector<ResultResidue> residues;  // consecutive atoms, pdb only
+    std::vector<std::pair<int, int> > bonds;
+    std::vector<int> bondOrders;          // empty if all bonds are single
+
+    int numAtoms() const { return static_cast<int>(positions.size()); }
+    QByteArray atomName(int atom) const;
+    void clear();
+  };
+
+  /**
+   * Read a packmol result (@p fileType pdb or xyz). The file is memory
+   * mapped and split into chunks of whole lines that are parsed in
+   * parallel, then the chunks are concatenated in file order.
+   *
+   * @param perceiveBonds Connect atoms closer than the sum of their
+   * covalent radii plus 0.45 A. In pdb files only atoms of the same
+   * residue are bonded, packmol gives every molecule its own residue.
+   */
+  bool readResult(const QString &fileName, const QString &fileType, ResultData &data,
+      bool perceiveBonds = true, QString *error = 0);
+
+  //! Add distance based bonds to @p data (see readResult())
+  void perceiveResultBonds(ResultData &data);
+
+  /**
+   * Rebuild the topology of @p data from the template structures in
+   * @p problem, instead of perceiving it. packmol writes every copy of every
+   * structure contiguously, in input order, so each molecule gets the bonds
+   * (and bond orders), elements and charges of its template. Results
+   * without residues get one residue per molecule.
+   *
+   * @return false if the templates don't add up to the atoms in @p data,
+   * @p data is left alone then.
+   */
+  bool applyTemplateTopology(const PackingProblem &problem, ResultData &data);
+
+  //! Atomic number of an element symbol (case insensitive), 0 if unknown
+  int elementNumber(const char *symbol, int length);
+
+} // end namespace Avogadro
+
+#endif
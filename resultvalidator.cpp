@@ -0,0 +1,191 @@
+/**********************************************************************
+  ResultValidator - Check a packing against its input
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "resultvalidator.h"
+#include "packmolgeometry.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Avogadro {
+
+  static bool closerThan(const DistanceOffender &a, const DistanceOffender &b)
+  {
+    return a.distance < b.distance;
+  }
+
+  static bool furtherOut(const ConstraintOffender &a, const ConstraintOffender &b)
+  {
+    return a.violation > b.violation;
+  }
+
+  /**
+   * Insert @p item in the sorted @p list if it is among the @p max worst.
+   */
+  template<typename T, typename Compare>
+  static void keepWorst(QList<T> &list, const T &item, int max, Compare worse)
+  {
+    if (max <= 0 || (list.size() == max && !worse(item, list.last())))
+      return;
+    typename QList<T>::iterator it = std::upper_bound(list.begin(), list.end(), item, worse);
+    list.insert(it, item);
+    if (list.size() > max)
+      list.removeLast();
+  }
+
+  ValidationReport validatePacking(const PackingProblem &problem,
+      const std::vector<Eigen::Vector3d> &positions, double precision,
+      const Eigen::Vector3d *period, int maxOffenders)
+  {
+    ValidationReport report;
+    double tolerance = problem.tolerance;
+
+    // molecule and structure of every atom, in packmol's output order
+    std::vector<int> atomMolecule, atomStructure, atomInMolecule;
+    atomMolecule.reserve(positions.size());
+    int numMolecules = 0;
+    for (int s = 0; s < problem.structures.size(); ++s) {
+      const PackingStructure &structure = problem.structures.at(s);
+      int numAtoms = static_cast<int>(structure.coordinates.size());
+      if (!numAtoms) {
+        report.error = QString("The number of atoms in %1 is unknown").arg(structure.fileName);
+        return report;
+      }
+      for (int m = 0; m < structure.number; ++m, ++numMolecules)
+        for (int i = 0; i < numAtoms; ++i) {
+          atomMolecule.push_back(numMolecules);
+          atomStructure.push_back(s);
+          atomInMolecule.push_back(i);
+        }
+    }
+    if (atomMolecule.size() != positions.size()) {
+      report.error = QString("The result has %1 atoms, the input describes %2")
+          .arg(positions.size()).arg(atomMolecule.size());
+      return report;
+    }
+    if (period && period->minCoeff() < 2.0 * tolerance) {
+      report.error = QString("The periodic box must be at least twice the tolerance");
+      return report;
+    }
+    report.valid = true;
+    if (positions.empty())
+      return report;
+
+    // constraints: every atom against the regions of its structure
+    double limit = precision * tolerance;
+    for (std::size_t a = 0; a < positions.size(); ++a) {
+      const PackingStructure &structure = problem.structures.at(atomStructure[a]);
+      for (int c = 0; c < structure.constraints.size(); ++c) {
+        const PackingConstraint &constraint = structure.constraints.at(c);
+        if (!constraint.atoms.empty() && std::find(constraint.atoms.begin(),
+              constraint.atoms.end(), atomInMolecule[a]) == constraint.atoms.end())
+          continue;
+        double violation = constraintViolation(constraint, positions[a]);
+        if (violation <= limit)
+          continue;
+        ++report.numConstraintViolations;
+        report.maxConstraintViolation = std::max(report.maxConstraintViolation, violation);
+        ConstraintOffender offender = { static_cast<int>(a), atomMolecule[a],
+            atomStructure[a], c, violation };
+        keepWorst(report.worstConstraints, offender, maxOffenders, furtherOut);
+      }
+    }
+
+    // distances: wrap into the periodic box, images are found by querying
+    // shifted positions of the atoms near its faces
+    std::vector<Eigen::Vector3d> wrapped;
+    const std::vector<Eigen::Vector3d> *points = &positions;
+    if (period) {
+      wrapped = positions;
+      for (std::size_t a = 0; a < wrapped.size(); ++a)
+        for (int j = 0; j < 3; ++j)
+          wrapped[a][j] -= (*period)[j] * std::floor(wrapped[a][j] / (*period)[j]);
+      points = &wrapped;
+    }
+
+    CellList cells(*points, tolerance);
+    double cutoff = tolerance - limit;
+    std::vector<int> neighbors;
+    std::vector<Eigen::Vector3d> queries;
+    for (std::size_t a = 0; a < points->size(); ++a) {
+      const Eigen::Vector3d &p = (*points)[a];
+      queries.clear();
+      queries.push_back(p);
+      if (period) {
+        for (int j = 0; j < 3; ++j) {
+          double shift = 0.0;
+          if (p[j] < tolerance)
+            shift = (*period)[j];
+          else if (p[j] > (*period)[j] - tolerance)
+            shift = -(*period)[j];
+          if (shift == 0.0)
+            continue;
+          for (std::size_t q = 0, n = queries.size(); q < n; ++q) {
+            Eigen::Vector3d image = queries[q];
+            image[j] += shift;
+            queries.push_back(image);
+          }
+        }
+      }
+
+      for (std::size_t q = 0; q < queries.size(); ++q) {
+        neighbors.clear();
+        cells.neighbors(queries[q], cutoff, neighbors);
+        for (std::size_t n = 0; n < neighbors.size(); ++n) {
+          int b = neighbors[n];
+          // every pair once, atoms of the same molecule don't count
+          if (b <= static_cast<int>(a) || atomMolecule[b] == atomMolecule[a])
+            continue;
+          double distance = (queries[q] - (*points)[b]).norm();
+          if (distance >= cutoff)
+            continue;
+          ++report.numDistanceViolations;
+          if (report.minDistance < 0.0 || distance < report.minDistance)
+            report.minDistance = distance;
+          DistanceOffender offender = { static_cast<int>(a), b, atomMolecule[a],
+              atomMolecule[b], distance };
+          keepWorst(report.worstDistances, offender, maxOffenders, closerThan);
+        }
+      }
+    }
+
+    return report;
+  }
+
+  bool periodicBox(const PackingProblem &problem, Eigen::Vector3d &period)
+  {
+    bool found = false;
+    Eigen::Vector3d min, max;
+    foreach (const PackingStructure &structure, problem.structures)
+      foreach (const PackingConstraint &constraint, structure.constraints) {
+        if (constraint.type != PackingConstraint::InsideBox)
+          continue;
+        for (int j = 0; j < 3; ++j) {
+          if (!found || constraint.params[j] < min[j])
+            min[j] = constraint.params[j];
+          if (!found || constraint.params[j + 3] > max[j])
+            max[j] = constraint.params[j + 3];
+        }
+        found = true;
+      }
+    if (found)
+      period = max - min + Eigen::Vector3d::Constant(problem.tolerance);
+    return found;
+  }
+
+} // end namespace Avogadro
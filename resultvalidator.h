@@ -0,0 +1,90 @@
+/**********************************************************************
+  ResultValidator - Check a packing against its input
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef RESULTVALIDATOR_H
+#define RESULTVALIDATOR_H
+
+#include "packingengine.h"
+
+#include <Eigen/Core>
+
+#include <QList>
+#include <QString>
+
+#include <vector>
+
+namespace Avogadro {
+
+  struct DistanceOffender
+  {
+    int atom1, atom2;          // 0-based atoms in the result
+    int molecule1, molecule2;
+    double distance;
+  };
+
+  struct ConstraintOffender
+  {
+    int atom;
+    int molecule;
+    int structure;             // index in PackingProblem::structures
+    int constraint;            // index in PackingStructure::constraints
+    double violation;          // A outside the region
+  };
+
+  struct ValidationReport
+  {
+    ValidationReport() : valid(false), numDistanceViolations(0), minDistance(-1.0),
+        numConstraintViolations(0), maxConstraintViolation(0.0) {}
+
+    bool valid;                // false if the result does not match the input
+    QString error;
+    int numDistanceViolations; // pairs of atoms in different molecules closer than the tolerance
+    double minDistance;        // closest such pair, -1.0 if none is closer than the tolerance
+    int numConstraintViolations;
+    double maxConstraintViolation;
+    QList<DistanceOffender> worstDistances;     // closest first
+    QList<ConstraintOffender> worstConstraints; // furthest out first
+
+    bool ok() const { return valid && !numDistanceViolations && !numConstraintViolations; }
+  };
+
+  /**
+   * Check every intermolecular pair of atoms in @p positions against the
+   * tolerance and every atom against its structure's constraints. Pairs are
+   * found with a cell list, so this is linear in the number of atoms.
+   *
+   * @param positions Atoms in packmol's order: structure by structure,
+   * molecule by molecule. The coordinates of the structures in @p problem
+   * are only used for the number of atoms per molecule.
+   * @param precision Distance and constraint violations up to this
+   * fraction of the tolerance are accepted, as in the engine's convergence
+   * test.
+   * @param period If not 0, distances use the minimum image in a periodic
+   * box with these dimensions.
+   * @param maxOffenders Number of worst pairs and atoms kept in the report.
+   */
+  ValidationReport validatePacking(const PackingProblem &problem,
+      const std::vector<Eigen::Vector3d> &positions, double precision = 0.01,
+      const Eigen::Vector3d *period = 0, int maxOffenders = 10);
+
+  //! Periodic box used by packmol users: all inside boxes plus the tolerance
+  bool periodicBox(const PackingProblem &problem, Eigen::Vector3d &period);
+
+} // end namespace Avogadro
+
+#endif
@@ -0,0 +1,108 @@
+/**********************************************************************
+  SeedRace - Run one input with several seeds, the first to converge wins
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "seedrace.h"
+#include "jobqueue.h"
+#include "packmoloutputparser.h"
+
+namespace Avogadro {
+
+  SeedRace::SeedRace(JobQueue *queue, QObject *parent) : QObject(parent), m_queue(queue)
+  {
+    connect(queue, SIGNAL(jobFinished(PackmolJob*)), this, SLOT(jobFinished(PackmolJob*)));
+  }
+
+  void SeedRace::start(const QList<PackmolJob*> &jobs)
+  {
+    abort();
+    foreach (PackmolJob *job, jobs) {
+      m_jobs.append(job);
+      connect(job->parser(), SIGNAL(finished(bool)), this, SLOT(parserFinished(bool)));
+    }
+  }
+
+  void SeedRace::abort()
+  {
+    QList<QPointer<PackmolJob> > jobs = m_jobs;
+    clear();
+    foreach (PackmolJob *job, jobs)
+      m_queue->abort(job);
+  }
+
+  void SeedRace::clear()
+  {
+    foreach (PackmolJob *job, m_jobs)
+      if (job)
+        job->parser()->disconnect(this);
+    m_jobs.clear();
+    m_leader = 0;
+  }
+
+  void SeedRace::parserFinished(bool success)
+  {
+    if (!success || m_leader)
+      return;
+    PackmolJob *job = qobject_cast<PackmolJob*>(sender()->parent());
+    if (!job || !m_jobs.contains(job))
+      return;
+
+    // packmol still has to write the result, the losers can go right away
+    m_leader = job;
+    emit converged(job);
+    foreach (PackmolJob *other, m_jobs)
+      if (other && other != job)
+        m_queue->abort(other);
+  }
+
+  void SeedRace::jobFinished(PackmolJob *job)
+  {
+    if (!m_jobs.contains(job))
+      return;
+
+    if (m_leader) {
+      if (job != m_leader)
+        return; // aborted loser
+      clear();
+      if (job->status() == PackmolJob::Finished)
+        emit won(job);
+      else
+        emit lost(0);
+      return;
+    }
+
+    // without a leader the race ends when every job is done
+    PackmolJob *best = 0;
+    foreach (PackmolJob *other, m_jobs) {
+      if (!other)
+        continue;
+      if (other->status() == PackmolJob::Queued || other->status() == PackmolJob::Running)
+        return;
+      if (other->status() != PackmolJob::Finished)
+        continue;
+      double f = other->parser()->progress().functionValue;
+      double bestF = best ? best->parser()->progress().functionValue : -1.0;
+      if (!best || (f >= 0.0 && (bestF < 0.0 || f < bestF)))
+        best = other;
+    }
+    clear();
+    emit lost(best);
+  }
+
+} // end namespace Avogadro
+
+#include "seedrace.moc"
@@ -0,0 +1,76 @@
+/**********************************************************************
+  SeedRace - Run one input with several seeds, the first to converge wins
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef SEEDRACE_H
+#define SEEDRACE_H
+
+#include <QObject>
+#include <QList>
+#include <QPointer>
+
+namespace Avogadro {
+
+  class JobQueue;
+  class PackmolJob;
+
+  /**
+   * Watches a set of queued jobs that only differ in their seed. As soon as
+   * one of them reports a converged packing, all others are aborted. Packmol
+   * run times vary a lot between seeds, so this cuts the long tail of seeds
+   * that stall near convergence.
+   */
+  class SeedRace : public QObject
+  {
+    Q_OBJECT
+
+    public:
+      SeedRace(JobQueue *queue, QObject *parent = 0);
+
+      //! Start watching @p jobs, an earlier race is aborted
+      void start(const QList<PackmolJob*> &jobs);
+      void abort();
+      bool isRunning() const { return !m_jobs.isEmpty(); }
+      //! The job that converged first, it may still be writing its result
+      PackmolJob* leader() const { return m_leader; }
+
+    signals:
+      //! @p job is the first to converge, the others are aborted right after this
+      void converged(PackmolJob *job);
+      //! The first converged job has finished writing its result
+      void won(PackmolJob *job);
+      /**
+       * No job converged. @p best is the finished job with the lowest
+       * objective function or 0 if none wrote a result.
+       */
+      void lost(PackmolJob *best);
+
+    private slots:
+      void parserFinished(bool success);
+      void jobFinished(PackmolJob *job);
+
+    private:
+      void clear();
+
+      JobQueue *m_queue;
+      QList<QPointer<PackmolJob> > m_jobs;
+      QPointer<PackmolJob> m_leader;
+  };
+
+} // end namespace Avogadro
+
+#endif
@@ -0,0 +1,265 @@
+/**********************************************************************
+  SolventTiler - Fill regions with copies of a pre-equilibrated solvent box
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "solventtiler.h"
+#include "packmolgeometry.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Avogadro {
+
+  //! The region all atoms are confined to, false if no constraint bounds it
+  static bool regionBounds(const QList<PackingConstraint> &constraints,
+      Eigen::Vector3d &min, Eigen::Vector3d &max)
+  {
+    min = Eigen::Vector3d::Constant(-1e30);
+    max = Eigen::Vector3d::Constant(1e30);
+    bool bounded = false;
+    foreach (const PackingConstraint &constraint, constraints) {
+      Eigen::Vector3d cmin, cmax;
+      if (!constraintBounds(constraint, cmin, cmax))
+        continue;
+      for (int j = 0; j < 3; ++j) {
+        min[j] = std::max(min[j], cmin[j]);
+        max[j] = std::min(max[j], cmax[j]);
+      }
+      bounded = true;
+    }
+    return bounded;
+  }
+
+  std::vector<Eigen::Vector3d> tileSolventBox(const SolventBox &box, int atomsPerMolecule,
+      const QList<PackingConstraint> &constraints, const std::vector<Eigen::Vector3d> &obstacles,
+      double tolerance)
+  {
+    std::vector<Eigen::Vector3d> kept;
+    Eigen::Vector3d min, max;
+    if (atomsPerMolecule <= 0 || box.positions.empty() || !regionBounds(constraints, min, max))
+      return kept;
+    int numMolecules = static_cast<int>(box.positions.size()) / atomsPerMolecule;
+
+    Eigen::Vector3d boxMin(box.positions[0]), boxMax(box.positions[0]);
+    for (std::size_t i = 0; i < box.positions.size(); ++i)
+      for (int j = 0; j < 3; ++j) {
+        boxMin[j] = std::min(boxMin[j], box.positions[i][j]);
+        boxMax[j] = std::max(boxMax[j], box.positions[i][j]);
+      }
+    Eigen::Vector3d period(box.period);
+    for (int j = 0; j < 3; ++j)
+      if (period[j] <= 0.0)
+        period[j] = boxMax[j] - boxMin[j] + tolerance;
+    if (period.minCoeff() <= 0.0)
+      return kept;
+
+    // whole molecules, centers wrapped into one period starting at the origin
+    std::vector<Eigen::Vector3d> molecules(box.positions.begin(),
+        box.positions.begin() + numMolecules * atomsPerMolecule);
+    std::vector<Eigen::Vector3d> centers(numMolecules, Eigen::Vector3d::Zero());
+    double extent = 0.0;
+    for (int m = 0; m < numMolecules; ++m) {
+      Eigen::Vector3d &center = centers[m];
+      for (int i = 0; i < atomsPerMolecule; ++i)
+        center += molecules[m * atomsPerMolecule + i];
+      center /= static_cast<double>(atomsPerMolecule);
+      Eigen::Vector3d shift;
+      for (int j = 0; j < 3; ++j)
+        shift[j] = -std::floor((center[j] - boxMin[j]) / period[j]) * period[j] - boxMin[j];
+      center += shift;
+      for (int i = 0; i < atomsPerMolecule; ++i) {
+        molecules[m * atomsPerMolecule + i] += shift;
+        extent = std::max(extent, (molecules[m * atomsPerMolecule + i] - center).norm());
+      }
+    }
+
+    // obstacles are found with a cell list of tolerance sized cells
+    CellList cells(obstacles, std::max(tolerance, 1.0));
+    std::vector<int> neighbors;
+
+    int first[3], last[3];
+    for (int j = 0; j < 3; ++j) {
+      first[j] = static_cast<int>(std::floor((min[j] - extent) / period[j]));
+      last[j] = static_cast<int>(std::floor((max[j] + extent) / period[j]));
+    }
+    for (int a = first[0]; a <= last[0]; ++a)
+      for (int b = first[1]; b <= last[1]; ++b)
+        for (int c = first[2]; c <= last[2]; ++c) {
+          Eigen::Vector3d offset(a * period[0], b * period[1], c * period[2]);
+          for (int m = 0; m < numMolecules; ++m) {
+            Eigen::Vector3d center = centers[m] + offset;
+            bool outside = false;
+            for (int j = 0; j < 3 && !outside; ++j)
+              outside = center[j] + extent < min[j] || center[j] - extent > max[j];
+            if (outside)
+              continue;
+
+            bool keep = true;
+            for (int i = 0; i < atomsPerMolecule && keep; ++i) {
+              Eigen::Vector3d position = molecules[m * atomsPerMolecule + i] + offset;
+              foreach (const PackingConstraint &constraint, constraints)
+                if (constraintViolation(constraint, position) > 0.0) {
+                  keep = false;
+                  break;
+                }
+              if (keep && !obstacles.empty()) {
+                neighbors.clear();
+                cells.neighbors(position, tolerance, neighbors);
+                keep = neighbors.empty();
+              }
+            }
+            if (!keep)
+              continue;
+            for (int i = 0; i < atomsPerMolecule; ++i)
+              kept.push_back(molecules[m * atomsPerMolecule + i] + offset);
+          }
+        }
+
+    return kept;
+  }
+
+  //! True if @p box holds whole molecules of @p structure
+  static bool sameMolecules(const SolventBox &box, const PackingStructure &structure)
+  {
+    std::size_t size = structure.atomicNumbers.size();
+    if (!size || size != structure.coordinates.size() || box.atomicNumbers.size() % size
+        || box.atomicNumbers.size() != box.positions.size())
+      return false;
+    for (std::size_t i = 0; i < box.atomicNumbers.size(); ++i)
+      if (box.atomicNumbers[i] != structure.atomicNumbers[i % size])
+        return false;
+    return true;
+  }
+
+  /**
+   * Remove molecules of the filled structure @p tiled where the free
+   * molecules of @p free fit, one for each of them, spread over the part
+   * of its region they share. The free molecules start at their centers.
+   */
+  static void makeRoom(PackingStructure &tiled, PackingStructure &free)
+  {
+    int needed = free.number - static_cast<int>(free.startCenters.size());
+    if (needed <= 0 || tiled.tiled < 2)
+      return;
+    int size = static_cast<int>(tiled.coordinates.size()) / tiled.tiled;
+
+    std::vector<int> candidates;
+    std::vector<Eigen::Vector3d> centers(tiled.tiled, Eigen::Vector3d::Zero());
+    for (int m = 0; m < tiled.tiled; ++m) {
+      for (int i = 0; i < size; ++i)
+        centers[m] += tiled.coordinates[m * size + i];
+      centers[m] /= static_cast<double>(size);
+      bool inside = true;
+      foreach (const PackingConstraint &constraint, free.constraints)
+        if (constraint.atoms.empty() && constraintViolation(constraint, centers[m]) > 0.0) {
+          inside = false;
+          break;
+        }
+      if (inside)
+        candidates.push_back(m);
+    }
+    if (candidates.empty())
+      return;
+
+    // every k-th candidate, the tiles come in spatial order;
+    // one molecule stays so untileSolvent() finds the template
+    int numRemoved = std::min(std::min(needed, static_cast<int>(candidates.size())),
+        tiled.tiled - 1);
+    std::vector<char> removed(tiled.tiled, 0);
+    for (int k = 0; k < numRemoved; ++k) {
+      int m = candidates[static_cast<std::size_t>(k) * candidates.size() / numRemoved];
+      removed[m] = 1;
+      free.startCenters.push_back(centers[m]);
+    }
+    std::vector<Eigen::Vector3d> coordinates;
+    coordinates.reserve(tiled.coordinates.size() - numRemoved * size);
+    for (int m = 0; m < tiled.tiled; ++m)
+      if (!removed[m])
+        coordinates.insert(coordinates.end(), tiled.coordinates.begin() + m * size,
+            tiled.coordinates.begin() + (m + 1) * size);
+    tiled.coordinates.swap(coordinates);
+    tiled.tiled -= numRemoved;
+  }
+
+  int tileSolvent(PackingProblem &problem, const SolventBox &box)
+  {
+    // the solvent keeps the tolerance from everything that doesn't move
+    std::vector<Eigen::Vector3d> obstacles;
+    foreach (const PackingStructure &structure, problem.structures)
+      if (structure.fixed) {
+        std::vector<Eigen::Vector3d> positions = fixedPositions(structure);
+        obstacles.insert(obstacles.end(), positions.begin(), positions.end());
+      }
+
+    int count = 0;
+    for (int s = 0; s < problem.structures.size(); ++s) {
+      PackingStructure &structure = problem.structures[s];
+      if (structure.fixed || !sameMolecules(box, structure))
+        continue;
+      bool perAtom = false;
+      foreach (const PackingConstraint &constraint, structure.constraints)
+        perAtom = perAtom || !constraint.atoms.empty();
+      if (perAtom)
+        continue;
+
+      std::vector<Eigen::Vector3d> positions = tileSolventBox(box,
+          static_cast<int>(structure.coordinates.size()), structure.constraints, obstacles,
+          problem.tolerance);
+      if (positions.empty())
+        continue;
+
+      structure.tiled = static_cast<int>(positions.size() / structure.coordinates.size());
+      structure.number = 1;
+      structure.fixed = true;
+      structure.center = false;
+      for (int i = 0; i < 6; ++i)
+        structure.fixedPosition[i] = 0.0;
+      structure.coordinates = positions;
+      obstacles.insert(obstacles.end(), positions.begin(), positions.end());
+      ++count;
+    }
+
+    // free molecules in a filled region, such as counter ions, take the
+    // place of solvent molecules instead of squeezing in between them
+    for (int s = 0; s < problem.structures.size(); ++s) {
+      PackingStructure &tiled = problem.structures[s];
+      if (!tiled.tiled)
+        continue;
+      for (int f = 0; f < problem.structures.size(); ++f) {
+        PackingStructure &free = problem.structures[f];
+        if (!free.fixed)
+          makeRoom(tiled, free);
+      }
+    }
+    return count;
+  }
+
+  void untileSolvent(PackingProblem &problem)
+  {
+    for (int s = 0; s < problem.structures.size(); ++s) {
+      PackingStructure &structure = problem.structures[s];
+      if (!structure.tiled)
+        continue;
+      // the template is the first molecule, the result has all of them
+      structure.coordinates.resize(structure.coordinates.size() / structure.tiled);
+      structure.number = structure.tiled;
+      structure.fixed = false;
+      structure.tiled = 0;
+    }
+  }
+
+} // end namespace Avogadro
@@ -0,0 +1,73 @@
+/**********************************************************************
+  SolventTiler - Fill regions with copies of a pre-equilibrated solvent box
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef SOLVENTTILER_H
+#define SOLVENTTILER_H
+
+#include "packingengine.h"
+
+#include <Eigen/Core>
+
+#include <vector>
+
+namespace Avogadro {
+
+  /**
+   * An equilibrated box of solvent molecules, e.g. the result of an earlier
+   * packing of pure solvent. The molecules have to be whole and in the same
+   * atom order as the structure they replace.
+   */
+  struct SolventBox
+  {
+    SolventBox() : period(Eigen::Vector3d::Zero()) {}
+
+    std::vector<Eigen::Vector3d> positions;
+    std::vector<int> atomicNumbers;
+    //! Repeat of the box along x, y and z, the bounding box plus the tolerance if zero
+    Eigen::Vector3d period;
+  };
+
+  /**
+   * Copies of @p box over the region of @p constraints, keeping the
+   * molecules (@p atomsPerMolecule atoms each) that satisfy all constraints
+   * and have no atom within @p tolerance of the @p obstacles. The
+   * constraints have to bound the region with an inside box or sphere.
+   * @return The positions of the kept molecules, molecule by molecule
+   */
+  std::vector<Eigen::Vector3d> tileSolventBox(const SolventBox &box, int atomsPerMolecule,
+      const QList<PackingConstraint> &constraints, const std::vector<Eigen::Vector3d> &obstacles,
+      double tolerance);
+
+  /**
+   * Fill the free structures of @p problem that are made of the molecules
+   * in @p box with copies of it, around the fixed structures. A filled
+   * structure becomes one fixed block holding all its molecules (the number
+   * is set by the box's density, not by the input), so the engine only
+   * packs what is left. Every free molecule whose region overlaps a filled
+   * one replaces a solvent molecule there and starts at its center (see
+   * PackingStructure::startCenters). The templates must be set.
+   * @return The number of structures filled
+   */
+  int tileSolvent(PackingProblem &problem, const SolventBox &box);
+
+  //! Turn the blocks of tileSolvent() back into molecules of their structure
+  void untileSolvent(PackingProblem &problem);
+
+} // end namespace Avogadro
+
+#endif
@@ -0,0 +1,205 @@
+/**********************************************************************
+  StructureCache - Shared cache of parsed structure files
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "structurecache.h"
+#include "packmolgeometry.h"
+#include "molecularvolume.h"
+
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+#include <avogadro/residue.h>
+#include <avogadro/molecule.h>
+#include <avogadro/moleculefile.h>
+
+#include <openbabel/mol.h>
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QCryptographicHash>
+#include <QDebug>
+
+#include <cmath>
+
+namespace Avogadro {
+
+  QByteArray fileHash(const QString &fileName)
+  {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+      return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    while (!file.atEnd())
+      hash.addData(file.read(1 << 20));
+    return hash.result();
+  }
+
+  static bool isGuiThread()
+  {
+    return QCoreApplication::instance() 
+        && QThread::currentThread() == QCoreApplication::instance()->thread();
+  }
+
+  CachedStructure::~CachedStructure()
+  {
+    // the last reference may be dropped by a worker
+    if (m_molecule && m_molecule->thread() != QThread::currentThread())
+      m_molecule->deleteLater();
+    else
+      delete m_molecule;
+  }
+
+  double CachedStructure::diameter() const
+  {
+    QMutexLocker locker(&m_mutex);
+    if (m_diameter >= 0.0)
+      return m_diameter;
+
+    m_diameter = pointSetDiameter(m_positions);
+    return m_diameter;
+  }
+
+  double CachedStructure::excludedVolume() const
+  {
+    QMutexLocker locker(&m_mutex);
+    if (m_excludedVolume >= 0.0)
+      return m_excludedVolume;
+
+    m_excludedVolume = molecularVolume(m_positions, m_atomicNumbers);
+    return m_excludedVolume;
+  }
+
+  StructureCache* StructureCache::instance()
+  {
+    static StructureCache cache;
+    return &cache;
+  }
+
+  QSharedPointer<CachedStructure> StructureCache::structure(const QString &fileName)
+  {
+    QFileInfo fileInfo(fileName);
+    QString key = fileInfo.canonicalFilePath();
+    if (key.isEmpty())
+      return QSharedPointer<CachedStructure>();
+
+    QDateTime lastModified = fileInfo.lastModified();
+    qint64 size = fileInfo.size();
+    QByteArray hash;
+
+    {
+      QMutexLocker locker(&m_mutex);
+      QHash<QString, Entry>::iterator entry = m_entries.find(key);
+      if (entry != m_entries.end()) {
+        if (entry->lastModified == lastModified && entry->size == size)
+          return entry->structure;
+        // touched on disk, only parse again if the content changed
+        locker.unlock();
+        hash = fileHash(key);
+        locker.relock();
+        entry = m_entries.find(key);
+        if (entry != m_entries.end() && entry->hash == hash) {
+          entry->lastModified = lastModified;
+          entry->size = size;
+          return entry->structure;
+        }
+      }
+    }
+
+    if (!isGuiThread())
+      return QSharedPointer<CachedStructure>();
+
+    // parse outside the lock, other files can be served in the meantime
+    if (hash.isEmpty())
+      hash = fileHash(key);
+    QSharedPointer<CachedStructure> structure = load(key);
+    if (!structure)
+      return structure;
+
+    QMutexLocker locker(&m_mutex);
+    Entry &entry = m_entries[key];
+    entry.lastModified = lastModified;
+    entry.size = size;
+    entry.hash = hash;
+    entry.structure = structure;
+    return structure;
+  }
+
+  void StructureCache::remove(const QString &fileName)
+  {
+    QString key = QFileInfo(fileName).canonicalFilePath();
+    QMutexLocker locker(&m_mutex);
+    m_entries.remove(key);
+  }
+
+  void StructureCache::clear()
+  {
+    QMutexLocker locker(&m_mutex);
+    m_entries.clear();
+  }
+
+  QSharedPointer<CachedStructure> StructureCache::load(const QString &fileName) const
+  {
+    Molecule *molecule = MoleculeFile::readMolecule(fileName);
+    if (!molecule)
+      return QSharedPointer<CachedStructure>();
+
+    QSharedPointer<CachedStructure> structure(new CachedStructure);
+    structure->m_fileName = fileName;
+    structure->m_molecule = molecule;
+    structure->m_molecularWeight = molecule->OBMol().GetMolWt();
+
+    unsigned int numAtoms = molecule->numAtoms();
+    structure->m_positions.reserve(numAtoms);
+    structure->m_atomicNumbers.reserve(numAtoms);
+    structure->m_formalCharges.reserve(numAtoms);
+
+    Eigen::Vector3d bboxMin(Eigen::Vector3d::Constant(1.0e10));
+    Eigen::Vector3d bboxMax(Eigen::Vector3d::Constant(-1.0e10));
+    foreach (Atom *atom, molecule->atoms()) {
+      const Eigen::Vector3d &pos = *(atom->pos());
+      structure->m_positions.push_back(pos);
+      structure->m_atomicNumbers.push_back(atom->atomicNumber());
+      structure->m_formalCharges.push_back(atom->formalCharge());
+      structure->m_totalCharge += atom->formalCharge();
+      for (int i = 0; i < 3; ++i) {
+        if (pos[i] < bboxMin[i]) bboxMin[i] = pos[i];
+        if (pos[i] > bboxMax[i]) bboxMax[i] = pos[i];
+      }
+    }
+    foreach (Bond *bond, molecule->bonds()) {
+      structure->m_bonds.push_back(std::make_pair(static_cast<int>(bond->beginAtom()->index()),
+            static_cast<int>(bond->endAtom()->index())));
+      structure->m_bondOrders.push_back(bond->order());
+    }
+    if (molecule->numResidues())
+      structure->m_residueName = molecule->residue(0)->name().toAscii();
+
+    if (!numAtoms)
+      bboxMin = bboxMax = Eigen::Vector3d::Zero();
+
+    structure->m_bboxMin = bboxMin;
+    structure->m_bboxMax = bboxMax;
+    minimalEnclosingSphere(structure->m_positions, structure->m_center, structure->m_radius);
+    structure->m_orientedBox = orientedBoundingBox(structure->m_positions);
+
+    return structure;
+  }
+
+} // end namespace Avogadro
@@ -0,0 +1,149 @@
+/**********************************************************************
+  StructureCache - Shared cache of parsed structure files
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef STRUCTURECACHE_H
+#define STRUCTURECACHE_H
+
+#include "packmolgeometry.h"
+
+#include <Eigen/Core>
+
+#include <QString>
+#include <QHash>
+#include <QDateTime>
+#include <QByteArray>
+#include <QMutex>
+#include <QSharedPointer>
+
+#include <utility>
+#include <vector>
+
+namespace Avogadro {
+
+  class Molecule;
+
+  /**
+   * A parsed structure file together with the derived data the dialog
+   * needs for volume, count and charge estimates. Instances are immutable
+   * once handed out by the StructureCache, except for the lazily computed
+   * diameter.
+   */
+  class CachedStructure
+  {
+    public:
+      ~CachedStructure();
+
+      const QString& fileName() const { return m_fileName; }
+      //! The molecule as read by MoleculeFile::readMolecule (do not modify)
+      Molecule* molecule() const { return m_molecule; }
+
+      int numAtoms() const { return static_cast<int>(m_positions.size()); }
+      const std::vector<Eigen::Vector3d>& positions() const { return m_positions; }
+      const std::vector<int>& atomicNumbers() const { return m_atomicNumbers; }
+      const std::vector<int>& formalCharges() const { return m_formalCharges; }
+      //! Bonds as pairs of 0-based atom indices
+      const std::vector<std::pair<int, int> >& bonds() const { return m_bonds; }
+      const std::vector<int>& bondOrders() const { return m_bondOrders; }
+      //! Name of the first residue, empty if the file has none
+      const QByteArray& residueName() const { return m_residueName; }
+
+      double molecularWeight() const { return m_molecularWeight; }
+      int totalCharge() const { return m_totalCharge; }
+
+      const Eigen::Vector3d& boundingBoxMin() const { return m_bboxMin; }
+      const Eigen::Vector3d& boundingBoxMax() const { return m_bboxMax; }
+      //! Center of the smallest sphere around all atoms
+      const Eigen::Vector3d& center() const { return m_center; }
+      //! Radius of the smallest sphere around all atoms
+      double radius() const { return m_radius; }
+      //! Box along the principal axes, the bounding box if that is smaller
+      const OrientedBox& orientedBox() const { return m_orientedBox; }
+      //! Largest interatomic distance, computed once on first use
+      double diameter() const;
+      //! Solvent excluded volume (A^3, 1.4 A probe), computed once on first use
+      double excludedVolume() const;
+
+    private:
+      friend class StructureCache;
+      CachedStructure() : m_molecule(0), m_molecularWeight(0.0),
+          m_totalCharge(0), m_radius(0.0), m_diameter(-1.0), m_excludedVolume(-1.0) {}
+
+      QString m_fileName;
+      Molecule *m_molecule;
+      std::vector<Eigen::Vector3d> m_positions;
+      std::vector<int> m_atomicNumbers;
+      std::vector<int> m_formalCharges;
+      std::vector<std::pair<int, int> > m_bonds;
+      std::vector<int> m_bondOrders;
+      QByteArray m_residueName;
+      double m_molecularWeight;
+      int m_totalCharge;
+      Eigen::Vector3d m_bboxMin, m_bboxMax, m_center;
+      double m_radius;
+      OrientedBox m_orientedBox;
+      mutable double m_diameter;
+      mutable double m_excludedVolume;
+      mutable QMutex m_mutex;
+  };
+
+  //! MD5 of the content of @p fileName, empty if it can't be read
+  QByteArray fileHash(const QString &fileName);
+
+  /**
+   * Process wide cache of structure files keyed by canonical path. Each
+   * lookup checks the modification time and size of the file; when those
+   * changed the content hash decides whether the file has to be parsed
+   * again. All methods are thread safe, but files are only parsed on the
+   * GUI thread: OpenBabel and the Molecule QObject can't be used on
+   * workers. Workers should be handed the structures they need.
+   */
+  class StructureCache
+  {
+    public:
+      static StructureCache* instance();
+
+      /**
+       * @return The parsed structure for @p fileName or a null pointer if
+       * the file does not exist or could not be read. Other threads than
+       * the GUI thread only get structures that are already parsed.
+       */
+      QSharedPointer<CachedStructure> structure(const QString &fileName);
+
+      void remove(const QString &fileName);
+      void clear();
+
+    private:
+      StructureCache() {}
+
+      struct Entry
+      {
+        QDateTime lastModified;
+        qint64 size;
+        QByteArray hash;
+        QSharedPointer<CachedStructure> structure;
+      };
+
+      QSharedPointer<CachedStructure> load(const QString &fileName) const;
+
+      QHash<QString, Entry> m_entries;
+      QMutex m_mutex;
+  };
+
+} // end namespace Avogadro
+
+#endif
@@ -25,20 +25,12 @@
 #include <QAbstractTableModel>
 #include <QItemDelegate>
 
+#include "inputgenerator.h"
+
 namespace Avogadro {
 
   enum { ComboBoxRole = 100 };
 
-  struct Structure
-  {
-    enum Type { Lipid, PolarSolvent, PolarSolute, LipophilicSolute };
-
-    QString fileName;
-    Type type;
-    int number;
-    double density;
-  };
-   
   class StructuresModel : public QAbstractTableModel
   {
     Q_OBJECT
@@ -0,0 +1,166 @@
+/**********************************************************************
+  StructureStager - Copy/convert structure files next to the input file
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "structurestager.h"
+#include "structurecache.h"
+
+#include <avogadro/moleculefile.h>
+
+#include <openbabel/obconversion.h>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QtConcurrentMap>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace Avogadro {
+
+  struct StagingJob
+  {
+    QString name;
+    QString source;
+    QString target;
+    bool sameFormat;
+    bool link;                              // the source was staged before, see linkFile()
+    bool convert;                           // left to the calling thread
+    StructureStager::FileState sourceState; // hash is empty if unknown
+    StructureStager::FileState staged;      // previous staged state, if any
+    StructureStager::FileState result;      // staged state after running
+    bool ok;
+  };
+
+  /**
+   * Hard link @p target to @p source, a file the stager staged. Those are
+   * replaced, never changed in place, so the link keeps the content it was
+   * staged with. A symbolic link would follow the replacement.
+   */
+  static bool linkFile(const QString &source, const QString &target)
+  {
+#ifdef Q_OS_UNIX
+    if (::link(QFile::encodeName(source).constData(), QFile::encodeName(target).constData()) == 0)
+      return true;
+#endif
+    return QFile::copy(source, target);
+  }
+
+  //! Record the staged state of a successful @p job
+  static void finishJob(StagingJob &job)
+  {
+    if (!job.ok)
+      return;
+    QFileInfo targetInfo(job.target);
+    job.result.lastModified = targetInfo.lastModified();
+    job.result.size = targetInfo.size();
+    job.result.hash = job.sourceState.hash;
+  }
+
+  static void stageFile(StagingJob &job)
+  {
+    job.ok = false;
+    if (job.source == job.target) {
+      // already in place, don't delete the original
+      job.ok = true;
+      return;
+    }
+    if (job.sourceState.hash.isEmpty())
+      job.sourceState.hash = fileHash(job.source);
+
+    QFileInfo targetInfo(job.target);
+    if (targetInfo.exists() && job.staged.hash == job.sourceState.hash &&
+        job.staged.lastModified == targetInfo.lastModified() &&
+        job.staged.size == targetInfo.size()) {
+      // staged copy is up to date
+      job.result = job.staged;
+      job.ok = true;
+      return;
+    }
+
+    QFile::remove(job.target);
+    if (job.sameFormat) {
+      // a link to the user's file would change with it, and with it every job
+      job.ok = job.link ? linkFile(job.source, job.target) : QFile::copy(job.source, job.target);
+      finishJob(job);
+    } else {
+      job.convert = true;
+    }
+  }
+
+  //! Convert the structure of @p job, OpenBabel only runs on the GUI thread
+  static void convertFile(StagingJob &job)
+  {
+    QSharedPointer<CachedStructure> structure = StructureCache::instance()->structure(job.source);
+    if (structure)
+      job.ok = MoleculeFile::writeMolecule(structure->molecule(), job.target);
+    finishJob(job);
+  }
+
+  QStringList StructureStager::stage(const QHash<QString, QString> &files,
+      const QString &directory, const QString &fileType)
+  {
+    // load the format plugin here, not concurrently in the workers
+    OpenBabel::OBConversion::FindFormat(fileType.toAscii().constData());
+
+    QList<StagingJob> jobs;
+    QHash<QString, QString>::const_iterator i;
+    for (i = files.constBegin(); i != files.constEnd(); ++i) {
+      QFileInfo sourceInfo(i.value());
+      StagingJob job;
+      job.name = i.key();
+      job.source = sourceInfo.absoluteFilePath();
+      job.target = QDir(directory).absoluteFilePath(i.key());
+      job.sameFormat = sourceInfo.suffix().toLower() == fileType.toLower();
+      job.sourceState.lastModified = sourceInfo.lastModified();
+      job.sourceState.size = sourceInfo.size();
+      // only hash sources that changed since we last saw them
+      const FileState &known = m_sources.value(job.source);
+      if (known.lastModified == job.sourceState.lastModified && known.size == job.sourceState.size)
+        job.sourceState.hash = known.hash;
+      job.staged = m_staged.value(job.target);
+      job.link = m_staged.contains(job.source);
+      job.ok = false;
+      job.convert = false;
+      jobs.append(job);
+    }
+
+    // hashing, copying and linking in parallel; conversions here, one by
+    // one, since OpenBabel and the Molecule can't be used on the workers
+    QtConcurrent::blockingMap(jobs, stageFile);
+    for (int j = 0; j < jobs.size(); ++j)
+      if (jobs[j].convert)
+        convertFile(jobs[j]);
+
+    QStringList failed;
+    foreach (const StagingJob &job, jobs) {
+      m_sources[job.source] = job.sourceState;
+      if (job.ok) {
+        m_staged[job.target] = job.result;
+      } else {
+        m_staged.remove(job.target);
+        failed.append(job.name);
+      }
+    }
+
+    return failed;
+  }
+
+} // end namespace Avogadro
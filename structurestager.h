@@ -0,0 +1,66 @@
+/**********************************************************************
+  StructureStager - Copy/convert structure files next to the input file
+
+  Copyright (C) 2010 by Tim Vandermeersch
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef STRUCTURESTAGER_H
+#define STRUCTURESTAGER_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QDateTime>
+#include <QByteArray>
+
+namespace Avogadro {
+
+  /**
+   * Places the structure files referenced by a packmol input in the
+   * directory packmol runs in. Files are staged incrementally: a staged
+   * copy made from the same content is kept, files already in the
+   * requested format are copied in parallel and all others are converted
+   * on the calling (GUI) thread (OpenBabel can't run on workers). Files
+   * the stager staged itself, e.g. in a staging directory, are hard linked
+   * instead: they are only ever replaced, so a job keeps its structures
+   * even if the user edits the originals.
+   */
+  class StructureStager
+  {
+    public:
+      /**
+       * Stage @p files (name used in the input file -> original file) in
+       * @p directory as @p fileType.
+       * @return The names in @p files that could not be staged.
+       */
+      QStringList stage(const QHash<QString, QString> &files,
+          const QString &directory, const QString &fileType);
+
+      struct FileState
+      {
+        FileState() : size(-1) {}
+        QDateTime lastModified;
+        qint64 size;
+        QByteArray hash;
+      };
+
+    private:
+      QHash<QString, FileState> m_sources; // original file -> last seen state
+      QHash<QString, FileState> m_staged;  // staged file -> state after staging, hash of its source
+  };
+
+} // end namespace Avogadro
+
+#endif